@@ -19,6 +19,9 @@
 #include "PinKeepAlive.h"
 #include "ExposeToModbus.h"
 #include "ReadFromInfoDSS.h"
+#include "Scheduler.h"
+#include "StackMonitor.h"
+#include "WarmStart.h"
 
 #ifdef PINMAPPING_CCW
 #error "Sketch was written for clockwise pin mapping!"
@@ -27,7 +30,12 @@
 volatile static bool ticked = false;
 
 static ObisValues obisValues = ObisValues();
+#if INFO_DSS_AUTO_PROTOCOL
+static InfoDSSDecoders infoDSSDecoders = InfoDSSDecoders(&obisValues);
+#else
 static TinySMLDecoder tinySMLDecoder = TinySMLDecoder(&obisValues);
+#endif
+static SerialModbusSlave modbusSlave = SerialModbusSlave(&obisValues);
 
 // Called every 100ms
 ISR(TIMER1_COMPA_vect)
@@ -43,23 +51,49 @@ bool resetTicked()
   return r;
 }
 
-void setup()
+bool isTicked()
 {
-  setupPinKeepAlive();
-  pushPinEntry();
-  setupModbus(&obisValues);
-  setupInfoDSS(&tinySMLDecoder);
+  return ticked;
 }
 
-void loop()
+void onTick()
 {
   if (resetTicked())
   {
     onTickPinKeepAlive();
+    onTickStackMonitor();
+    onTickWarmStart();
   }
+}
+
+// Tasks in priority order. Deadlines in 8µs units.
+// - Modbus: Reply turnaround first, always
+// - INFO-DSS: At 9600 baud a byte arrives every ~1ms, don't let the Serial1 buffer overflow: 2ms
+// - PinKeepAlive: 100ms tick, some 10ms jitter on the LED is irrelevant
+// In flash, see Scheduler.h.
+static const SchedulerTask TASKS[N_SCHEDULER_TASKS] PROGMEM = {
+    {isModbusPending, onTickModbus, 0},
+    {isInfoDSSPending, onTickInfoDSS, 250},
+    {isTicked, onTick, 1250}};
+
+void setup()
+{
+  setupWarmStart(&obisValues);
+  setupPinKeepAlive();
+  pushPinEntry();
+  setupModbus(&modbusSlave);
+#if INFO_DSS_AUTO_PROTOCOL
+  setupInfoDSS(&infoDSSDecoders, &obisValues);
+#else
+  setupInfoDSS(&tinySMLDecoder, &obisValues);
+#endif
+  setupScheduler(TASKS, &obisValues);
+  setupStackMonitor(&obisValues);
+}
 
-  onTickModbus();
-  onTickInfoDSS();
+void loop()
+{
+  onTickScheduler();
 }
 
 // END
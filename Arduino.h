@@ -1,12 +1,39 @@
 /*
- * Arduino.h - Just some typedefs to make the TinySMLDecoderTest compile standalone ... 
+ * Arduino.h - Just some typedefs to make the TinySMLDecoderTest and host tools compile standalone ... 
  */
+#ifndef __ARDUINO_H
+#define __ARDUINO_H
+
+#include <stddef.h>
+#include <stdint.h>
 typedef unsigned char byte;
-typedef unsigned char uint8_t;
-typedef signed char int8_t;
-typedef short unsigned int uint16_t;
-typedef short signed int int16_t;
-typedef signed long int32_t;
-typedef unsigned long uint32_t;
-typedef signed long long int64_t;
-typedef unsigned long long uint64_t;
+#define PROGMEM
+#define pgm_read_byte(p) (*(const uint8_t *)(p))
+#define pgm_read_word(p) (*(const uint16_t *)(p))
+#define pgm_read_ptr(p) (*(void *const *)(p))
+
+// Digital I/O and Timer/Counter1 for host tests of PinKeepAlive.cpp. The test provides them, see VirtualMeterTest.cpp.
+#define LOW 0
+#define HIGH 1
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+#define PIN_PB0 8
+#define PIN_PB1 9
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+int digitalRead(uint8_t pin);
+
+#define _BV(bit) (1 << (bit))
+#define noInterrupts()
+#define interrupts()
+#define OCIE1A 1
+extern uint8_t TCCR1A, TCCR1B, TIMSK1;
+extern uint16_t TCNT1, OCR1A;
+
+// EEPROM for host tests of WarmStart.cpp, provided by the test, see WarmStartTest.cpp. Addresses are offsets.
+uint8_t eeprom_read_byte(const uint8_t *p);
+void eeprom_write_byte(uint8_t *p, uint8_t value);
+bool eeprom_is_ready();
+
+#endif // __ARDUINO_H
@@ -0,0 +1,108 @@
+/*
+ * Baud rate detection for the INFO-DSS input. See BaudDetector.h.
+ */
+
+#include <Arduino.h>
+#include "BaudDetector.h"
+
+static const uint16_t BAUD_CANDIDATES[N_BAUD_CANDIDATES] PROGMEM = BAUD_CANDIDATES_100;
+
+BaudDetector::BaudDetector(uint32_t baud)
+{
+    candidate = 0;
+    for (uint8_t cc = 0; cc < N_BAUD_CANDIDATES; cc++)
+    {
+        if (pgm_read_word(&BAUD_CANDIDATES[cc]) * 100UL == baud)
+        {
+            candidate = cc;
+        }
+    }
+}
+
+uint32_t BaudDetector::getBaud()
+{
+    return pgm_read_word(&BAUD_CANDIDATES[candidate]) * 100UL;
+}
+
+uint8_t BaudDetector::getCandidate()
+{
+    return candidate;
+}
+
+bool BaudDetector::isLocked()
+{
+    return locked;
+}
+
+uint16_t BaudDetector::getRegister()
+{
+    return pgm_read_word(&BAUD_CANDIDATES[candidate]) | (locked ? 0 : 0x8000);
+}
+
+void BaudDetector::feed(uint8_t c)
+{
+    // 1B 1B 1B 1B 01 01 01 01, where more than four 1B may precede the 01s
+    if (matched < 4)
+    {
+        matched = (c == 0x1B) ? matched + 1 : 0;
+    }
+    else if (c == 0x01)
+    {
+        if (++matched == 8)
+        {
+            started = true;
+            matched = 0;
+        }
+    }
+    else
+    {
+        matched = (c == 0x1B) ? ((matched == 4) ? 4 : 1) : 0;
+    }
+}
+
+bool BaudDetector::update(uint16_t now, uint16_t frames)
+{
+    if (!initialized)
+    {
+        initialized = true;
+        windowStart = now;
+        lastFrames = frames;
+    }
+    if (frames != lastFrames)
+    {
+        // Good CRC: this is it
+        lastFrames = frames;
+        locked = true;
+        windowStart = now;
+        return false;
+    }
+    if (locked)
+    {
+        if ((uint16_t)(now - windowStart) >= BAUD_DETECTOR_TIMEOUT_MS)
+        {
+            locked = false;
+            windowStart = now;
+        }
+        return false;
+    }
+    if ((uint16_t)(now - windowStart) < BAUD_DETECTOR_WINDOW_MS)
+    {
+        return false;
+    }
+
+    // Window is over
+    windowStart = now;
+    if (started && !extended)
+    {
+        extended = true; // Frame started, but has not completed yet
+        started = false;
+        return false;
+    }
+    started = false;
+    extended = false;
+    matched = 0;
+    candidate = (candidate + 1) % N_BAUD_CANDIDATES;
+    return true;
+}
+
+// END
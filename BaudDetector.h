@@ -0,0 +1,70 @@
+/*
+ * Baud rate detection for the INFO-DSS input: Try candidate baud rates in turn, lock on the first one that delivers
+ * an SML frame with good CRC.
+ *
+ * While searching, each candidate gets a listening window. If the SML start sequence 1B 1B 1B 1B 01 01 01 01 shows up
+ * within the window, it gets another one for the frame to complete. When no good frame has been seen for a while
+ * after locking on (meter or IR head replaced), the search starts over.
+ */
+
+#ifndef __BAUDDETECTOR_H
+#define __BAUDDETECTOR_H
+
+#include <Arduino.h>
+
+// Listening window per candidate [ms]. Should cover the meter's frame interval, which is 1-4s usually.
+#ifndef BAUD_DETECTOR_WINDOW_MS
+#define BAUD_DETECTOR_WINDOW_MS 2500
+#endif
+
+// Search again after this long without a good frame [ms]
+#ifndef BAUD_DETECTOR_TIMEOUT_MS
+#define BAUD_DETECTOR_TIMEOUT_MS 30000
+#endif
+
+// Candidates [100 baud], most likely first. SML via IR is 9600 baud, other rates are seen with some meters and IR heads.
+#define BAUD_CANDIDATES_100 {96, 24, 48, 192, 384, 576, 1152}
+#define N_BAUD_CANDIDATES 7
+
+class BaudDetector
+{
+public:
+    /*
+     * Start with the given baud rate, if it is one of the candidates.
+     */
+    BaudDetector(uint32_t baud);
+
+    uint32_t getBaud();
+    uint8_t getCandidate(); // Index into BAUD_CANDIDATES_100
+    bool isLocked();
+
+    /*
+     * Diagnostic register value: Baud rate / 100, bit 15 set while searching.
+     */
+    uint16_t getRegister();
+
+    /*
+     * Pass in every byte received.
+     */
+    void feed(uint8_t c);
+
+    /*
+     * Call often, with current time [ms] and the number of good frames so far (DIAG_FRAMES).
+     * Return true if the baud rate was changed, i.e. the receiver must be restarted with getBaud().
+     */
+    bool update(uint16_t now, uint16_t frames);
+
+private:
+    uint8_t candidate;
+    bool locked = false;
+    bool started = false;  // Start sequence seen in current window
+    bool extended = false; // Current window extended for a frame to complete
+    uint8_t matched = 0;   // Start sequence bytes matched so far
+    uint16_t windowStart = 0;
+    uint16_t lastFrames = 0;
+    bool initialized = false;
+};
+
+#endif // __BAUDDETECTOR_H
+
+// END
@@ -0,0 +1,195 @@
+/*
+ * Baud rate detection for the INFO-DSS input: How long does it take to lock on to a meter at a given baud rate?
+ *
+ * The frames of a capture file are sent over and over at the meter's baud rate (8N1), one per second or slower for long
+ * frames at low rates. The receiver samples the line at 16x the baud rate the detector currently tries, with majority
+ * of three, like the USART does, and feeds what it gets to the SML decoder and the detector. Reports the time to lock,
+ * and how many frames were sent at the right rate before locking, for each candidate baud rate.
+ *
+ * g++ -O2 -I . -D__TEST__=1 -o test-baud BaudDetectorTest.cpp BaudDetector.cpp TinySMLDecoder.cpp ModbusCRC.cpp ObisValues.cpp
+ * ./test-baud testdata/sml.bin
+ */
+
+#include <stdio.h>
+#include "BaudDetector.h"
+#include "TinySMLDecoder.h"
+
+#if __TEST__
+#include <string.h>
+#include <vector>
+
+#define START_BAUD 9600
+#define OVERSAMPLING 16
+#define RUN_MS 60000
+
+static const uint32_t METER_BAUD_RATES[] = {9600, 2400, 4800, 19200, 38400, 57600, 115200};
+static const uint8_t START_SEQUENCE[8] = {0x1B, 0x1B, 0x1B, 0x1B, 0x01, 0x01, 0x01, 0x01};
+
+typedef std::vector<uint8_t> Frame;
+
+class Meter
+{
+public:
+    Meter(const std::vector<Frame> &frames_, uint32_t baud_)
+        : frames(frames_), baud(baud_)
+    {
+        size_t longest = 0;
+        for (const Frame &f : frames)
+        {
+            longest = f.size() > longest ? f.size() : longest;
+        }
+        double frameMs = longest * 10 * 1000.0 / baud;
+        intervalMs = frameMs * 1.5 > 1000 ? frameMs * 1.5 : 1000;
+    }
+
+    // Line level at time t [ms]: Idle high, start bit low, 8 data bits LSB first, stop bit high.
+    int line(double t)
+    {
+        size_t k = (size_t)(t / intervalMs);
+        const Frame &f = frames[k % frames.size()];
+        size_t bit = (size_t)((t - k * intervalMs) * baud / 1000);
+        size_t n = bit / 10;
+        bit %= 10;
+        if (n >= f.size() || bit == 9)
+        {
+            return 1;
+        }
+        return bit == 0 ? 0 : (f[n] >> (bit - 1)) & 1;
+    }
+
+    // Number of frames started up to time t [ms]
+    unsigned long framesSent(double t)
+    {
+        return (unsigned long)(t / intervalMs) + 1;
+    }
+
+    double intervalMs;
+
+private:
+    const std::vector<Frame> &frames;
+    uint32_t baud;
+};
+
+static std::vector<Frame> splitFrames(const std::vector<uint8_t> &capture)
+{
+    std::vector<Frame> frames;
+    for (size_t k = 0; k < capture.size(); k++)
+    {
+        if (k + sizeof(START_SEQUENCE) <= capture.size() && !memcmp(&capture[k], START_SEQUENCE, sizeof(START_SEQUENCE)) &&
+            (frames.empty() || frames.back().size() >= sizeof(START_SEQUENCE)))
+        {
+            frames.push_back(Frame());
+        }
+        if (!frames.empty())
+        {
+            frames.back().push_back(capture[k]);
+        }
+    }
+    return frames;
+}
+
+/*
+ * Run the receiver against the meter. Return the time of locking on at the right rate [ms], or -1.
+ */
+static double run(Meter &meter, uint32_t meterBaud, unsigned long *framesAtRate)
+{
+    ObisValues obisValues = ObisValues();
+    TinySMLDecoder decoder = TinySMLDecoder(&obisValues);
+    BaudDetector detector = BaudDetector(START_BAUD);
+
+    double tSample = 1000.0 / (detector.getBaud() * OVERSAMPLING);
+    double atRate = detector.getBaud() == meterBaud ? 0 : -1;
+    uint16_t nextMs = 0;
+    int previous = 1;
+    for (double t = 0; t < RUN_MS;)
+    {
+        while (t >= nextMs)
+        {
+            if (detector.update(nextMs, obisValues.getDiagnosticRegister(DIAG_FRAMES)))
+            {
+                decoder.reset();
+                tSample = 1000.0 / (detector.getBaud() * OVERSAMPLING);
+                atRate = detector.getBaud() == meterBaud ? nextMs : -1;
+                previous = 1;
+            }
+            if (detector.isLocked())
+            {
+                if (detector.getBaud() != meterBaud)
+                {
+                    return -1;
+                }
+                *framesAtRate = meter.framesSent(nextMs) - meter.framesSent(atRate) + 1;
+                return nextMs;
+            }
+            nextMs++;
+        }
+
+        int v = meter.line(t);
+        if (previous == 1 && v == 0)
+        {
+            uint16_t bits = 0; // Start, 8 data bits. Framing errors go unnoticed, as with the Arduino core.
+            for (int k = 0; k < 9; k++)
+            {
+                int middle = k * OVERSAMPLING + OVERSAMPLING / 2;
+                int votes = meter.line(t + (middle - 1) * tSample) + meter.line(t + middle * tSample) + meter.line(t + (middle + 1) * tSample);
+                bits |= (votes >= 2) << k;
+            }
+            uint8_t c = (uint8_t)(bits >> 1);
+            decoder.feed(c);
+            detector.feed(c);
+            t += (9 * OVERSAMPLING + OVERSAMPLING / 2 + 2) * tSample; // Look for the next start bit after the stop bit sample
+            previous = 1;
+            continue;
+        }
+        previous = v;
+        t += tSample;
+    }
+    return -1;
+}
+
+int main(int argc, char *argv[])
+{
+    FILE *f = argc > 1 ? fopen(argv[1], "rb") : NULL;
+    if (!f)
+    {
+        fprintf(stderr, "Usage: %s capture.bin\n", argv[0]);
+        return 2;
+    }
+    std::vector<uint8_t> capture;
+    int c;
+    while ((c = fgetc(f)) != EOF)
+    {
+        capture.push_back((uint8_t)c);
+    }
+    fclose(f);
+    std::vector<Frame> frames = splitFrames(capture);
+    if (frames.empty())
+    {
+        fprintf(stderr, "No SML start sequence in %s\n", argv[1]);
+        return 2;
+    }
+
+    int failures = 0;
+    printf("%zu frames, starting at %u baud, %ums window per candidate\n", frames.size(), START_BAUD, BAUD_DETECTOR_WINDOW_MS);
+    printf("%8s %10s %10s %14s\n", "Baud", "Interval", "Lock", "Frames at rate");
+    for (uint32_t baud : METER_BAUD_RATES)
+    {
+        Meter meter(frames, baud);
+        unsigned long framesAtRate = 0;
+        double lock = run(meter, baud, &framesAtRate);
+        if (lock < 0)
+        {
+            printf("%8u %8.0fms %10s %14s FAIL\n", baud, meter.intervalMs, "-", "-");
+            failures++;
+            continue;
+        }
+        // Lock on within a couple of frames once at the right rate
+        bool ok = framesAtRate <= 3;
+        printf("%8u %8.0fms %8.0fms %14lu %s\n", baud, meter.intervalMs, lock, framesAtRate, ok ? "OK" : "FAIL");
+        failures += !ok;
+    }
+    return failures ? 1 : 0;
+}
+#endif
+
+// END
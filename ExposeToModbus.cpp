@@ -4,7 +4,6 @@
 
 #include <Arduino.h>
 #include "ExposeToModbus.h"
-#include "ModbusCRC.h"
 #include "meterpin.h" // local settings
 
 // Modbus RTU "Silent Interval"
@@ -12,26 +11,28 @@
 // http://www.modbus.org/docs/Modbus_over_serial_line_V1_02.pdf
 #ifndef __USE_RS485_T15__
 // Use 3.5 character times as silent interval. For > 19200bd, we're supposed to use 1.75ms, independent of baud rate.
-// Timer/Counter2 increments every 8µs. 219 x 8µs = 1752µs
-static const uint16_t RS_485_SILENT_INTERVAL_uS = 1752;
-static const uint16_t RS_485_SILENT_INTERVAL_TICKS = (RS_485_SILENT_INTERVAL_uS / 8);
+// Timer/Counter2 increments every 8µs at 8MHz. 219 x 8µs = 1752µs
+#define RS_485_SILENT_INTERVAL_TENTHS 35
 #else
 // For my use case it's not necessary, but we may want to be more aggressive and honour an inter-character spacing
 // of more than 1.5 character times (> 19200 baud: 750us) as being an frame abort condition.
-// Timer/Counter2 increments every 8µs. 94 x 8µs = 752µs
-static const uint16_t RS_485_SILENT_INTERVAL_uS = 752;
-static const uint16_t RS_485_SILENT_INTERVAL_TICKS = (RS_485_SILENT_INTERVAL_uS / 8);
+// Timer/Counter2 increments every 8µs at 8MHz. 94 x 8µs = 752µs
+#define RS_485_SILENT_INTERVAL_TENTHS 15
 #endif
+static const uint16_t RS_485_SILENT_INTERVAL_TICKS = rs485Ticks(F_CPU, rs485SilentInterval_us(RS_485_BAUD, RS_485_SILENT_INTERVAL_TENTHS, RS_485_STRICT_TIMING));
 
-// We expect only one APDU here, with limited length: Read Input Registers (Function code 04) with four parameter bytes and 2 CRC bytes.
-static uint8_t apdu[16];
-// RS 485 RTU reception state
-static uint8_t zz = 0;
-static uint8_t ct = 0;
-static uint8_t expected = 0;
+// Turnaround: Reply no earlier than 3.5 character times after the request
+static const uint16_t RS_485_TURNAROUND_TICKS = rs485Ticks(F_CPU, rs485SilentInterval_us(RS_485_BAUD, 35, RS_485_STRICT_TIMING));
 
-static ModbusCRC crc = ModbusCRC();
-static ObisValues *obisValues;
+// Baud rate generator
+static const bool RS_485_U2X = rs485UseU2X(F_CPU, RS_485_BAUD);
+static const uint16_t RS_485_UBRR = rs485Ubrr(F_CPU, RS_485_BAUD, rs485Divider(F_CPU, RS_485_BAUD));
+static_assert(rs485Abs(rs485BaudErrorPermille(F_CPU, RS_485_BAUD, rs485Divider(F_CPU, RS_485_BAUD))) <= RS_485_MAX_BAUD_ERROR_PERMILLE,
+              "RS_485_BAUD cannot be generated accurately enough from F_CPU, see README for usable baud rates");
+
+static bool quiet = false;
+
+static SerialModbusSlave *modbusSlave;
 
 #if __DEBUG__
 void printHex(uint8_t c)
@@ -45,9 +46,9 @@ void printHex(uint8_t c)
 }
 #endif // __DEBUG__
 
-void setupModbus(ObisValues *obisValues_)
+void setupModbus(SerialModbusSlave *modbusSlave_)
 {
-    obisValues = obisValues_;
+    modbusSlave = modbusSlave_;
     TCCR2B = 0x00; // Timer/Counter2 stop
     TCNT2 = 0x00;  // Reset timer value to 0. No interrupt for Timer 2.
     TCCR2A = 0x00; // Timer/Counter2 Normal mode (with TCCR2B)
@@ -60,175 +61,55 @@ void setupModbus(ObisValues *obisValues_)
     Serial.begin(RS_485_BAUD, SERIAL_8N2);
     while (!Serial)
         ;
-
-#if __DEBUG__
-        // Do not disable TX
-#else
-    // https://github.com/SpenceKonde/ATTinyCore/blob/v2.0.0-devThis-is-the-head-submit-PRs-against-this/avr/extras/ATtiny_x41.md#uart-serial-support
-    UCSR1B &= ~(1 << TXEN1); // disable TX, we only ever read from INFO DSS
-#endif // __DEBUG__
-}
-
-bool checkCRC()
-{
-    crc.reset();
-    crc.feed(RS_485_ADDRESS);
-    for (ct = 0; ct < expected - 2;)
-    {
-        crc.feed(apdu[ct++]);
-    }
-    return apdu[ct++] == crc.getCRCLowByte() && apdu[ct] == crc.getCRCHighByte();
-}
-
-void send(uint8_t b)
-{
-    Serial.write(b);
-    crc.feed(b);
-#if __DEBUG__
-    printHex(b);
-#endif // __DEBUG__
-}
-
-void sendCRC()
-{
-    uint8_t crcL = crc.getCRCLowByte();
-    uint8_t crcH = crc.getCRCHighByte();
-    send(crcL);
-    send(crcH);
-#if __DEBUG__
-    Serial1.println();
-#endif // __DEBUG__
-}
-
-/**
- * Return 0x00 or Modbus Exception Code
- */
-uint8_t executeReadInputApdu()
-{
-#if __DEBUG__
-    printHex(apdu[0]); // RS_485_READ_INPUT_REGISTER
-    printHex(apdu[1]); // Address High
-    printHex(apdu[2]); // Address Low
-    printHex(apdu[3]); // Register Count High
-    printHex(apdu[4]); // Register Count Low
-    printHex(apdu[5]); // CRC
-    printHex(apdu[6]); // CRC
-    Serial1.println();
-#endif
-
-    uint8_t address = apdu[2];       // Register address 0, 1, 2, ... (+256)
-    uint8_t registerCount = apdu[4]; // Number of registers to read 1, 2, 3, ...
-    const uint8_t obisRegisters = obisValues->getLiveRegistersCount();
-
-    if (apdu[1] != 0x01                             // Address high byte must be 0x01
-        || apdu[3] != 0x00                          // Register count high byte must be zero
-        || address >= obisRegisters                 // Address must not exceed number of registers
-        || registerCount == 0x00                    // Register count must be positive
-        || registerCount > obisRegisters            // Register count must not exceed number of registers
-        || address + registerCount > obisRegisters) // Register access must not exceed number of registers
+    // Baud rate generator as checked at build time, rather than whatever the core chooses
+    UBRR0 = RS_485_UBRR;
+    if (RS_485_U2X)
     {
-        return 0x02; // Illegal data address
+        UCSR0A |= (1 << U2X0);
     }
-
-    delayMicroseconds(RS_485_SILENT_INTERVAL_uS);
-    crc.reset();
-    send(RS_485_ADDRESS);
-    send(RS_485_READ_INPUT_REGISTER);
-
-    send(registerCount << 1); // Number of bytes to send, each register has two bytes
-    while (registerCount--)
+    else
     {
-        uint16_t value = obisValues->getLiveRegister(address++);
-        send((uint8_t)(value >> 8));
-        send((uint8_t)value);
+        UCSR0A &= ~(1 << U2X0);
     }
-
-    sendCRC();
-    return 0x00;
 }
 
-void sendErrorReply(uint8_t exceptionCode)
-{
-    delayMicroseconds(RS_485_SILENT_INTERVAL_uS);
-    crc.reset();
-    send(RS_485_ADDRESS);
-    send(apdu[0] + 0x80);
-    send(exceptionCode);
-    sendCRC();
-}
+const ModbusRTUPhysical SerialModbusSlave::SERIAL_PHYSICAL PROGMEM = {waitSilentInterval, transmit};
 
-/*
- * Process incoming APDU.
- * For now we only support one single function code (0x04)
- */
-void executeApdu()
+void SerialModbusSlave::waitSilentInterval(ModbusRTUSlave *)
 {
-    uint8_t exceptionCode = 0x1; // Illegal Function
-    if (apdu[0] == RS_485_READ_INPUT_REGISTER)
-    {
-        exceptionCode = executeReadInputApdu();
-    }
-    if (exceptionCode)
-    {
-        sendErrorReply(exceptionCode);
-    }
+    // Timer/Counter2 was reset on the last character of the request
+    while (TCNT2 < RS_485_TURNAROUND_TICKS)
+        ;
 }
 
-void onRS485Receive(uint8_t c, bool quiet)
+void SerialModbusSlave::transmit(ModbusRTUSlave *, uint8_t c)
 {
-    if (quiet)
-    {
-        if (c == RS_485_ADDRESS)
-        {
-            zz = 1;
-        }
-        else
-        {
-            zz = 0;
-        }
-    }
-    else if (zz == 1)
-    {
-        if (c == RS_485_READ_INPUT_REGISTER)
-        {
-            zz = 2;
-            ct = 0;
-            apdu[ct++] = c;
-            expected = 7;
-        }
-        else
-        {
-            zz = 0;
-        }
-    }
-    else if (zz == 2)
-    {
-        apdu[ct++] = c;
-        if (expected == ct)
-        {
-            zz = 0;
-            if (checkCRC())
-            {
-                executeApdu();
-            }
-        }
-    }
+    Serial.write(c);
+#if __DEBUG__
+    printHex(c);
+#endif // __DEBUG__
 }
 
-void onTickModbus()
+bool isModbusPending()
 {
-    bool quiet = false;
+    // Latch the silent interval before Timer/Counter2 can wrap around
     if (TCNT2 >= RS_485_SILENT_INTERVAL_TICKS)
     {
         quiet = true;
         TCNT2 = RS_485_SILENT_INTERVAL_TICKS;
     }
-    if (Serial.available() > 0)
+    return Serial.available() > 0;
+}
+
+void onTickModbus()
+{
+    if (isModbusPending())
     {
         // Read current input, reset Timer/Counter2 on each character received
         int c = Serial.read();
         TCNT2 = 0;
-        onRS485Receive((uint8_t)c, quiet);
+        modbusSlave->onReceive((uint8_t)c, quiet);
+        quiet = false;
     }
 }
 
@@ -7,22 +7,96 @@
 
 #include <Arduino.h>
 #include "ObisValues.h"
+#include "ModbusSlave.h"
 
 // Which baud rate do we want to run the bus on? Ideally, you align this with the other sensors on your bus.
 // Otherwise you need a master that can switch baud rates on the fly to access different sensors. HomeAssistant can't, AFAIK.
 // We run the Microcontroller at 8MHz to get reliable 115200 baud. Didn't work reliably for me at 4MHz.
+// At 8MHz, 250000 and 500000 baud are exact. See README for the error of other baud rates, checked at build time.
 #ifndef RS_485_BAUD
 #define RS_485_BAUD 115200
 #endif
 
+// Largest acceptable baud rate error [0.1%]. 115200 baud is 3.5% off at 8MHz, but works.
+#ifndef RS_485_MAX_BAUD_ERROR_PERMILLE
+#define RS_485_MAX_BAUD_ERROR_PERMILLE 40
+#endif
+
+// Silent interval and turnaround: The spec has fixed 1750µs (750µs with __USE_RS485_T15__) above 19200 baud.
+// With 0, these are 3.5 (1.5) character times at any baud rate, which keeps the bus less busy at high baud rates.
+#ifndef RS_485_STRICT_TIMING
+#define RS_485_STRICT_TIMING 1
+#endif
+
 // RS-485 address. Default is 9. This is chosen randomly here, just make sure it does not collide with any other sensors on your bus.
 #ifndef RS_485_ADDRESS
 #define RS_485_ADDRESS ((uint8_t)0x09)
 #endif
-#define RS_485_READ_INPUT_REGISTER ((uint8_t)0x04) // Function Code 04
+
+/*
+ * RS-485 timing as functions of CPU clock and baud rate, evaluated at build time. Used by host tests, too.
+ *
+ * Baud rate generator: UBRR = f_cpu / (16 * baud) - 1, or with U2X (double speed) f_cpu / (8 * baud) - 1.
+ * The mode with the smaller error is used, normal speed on a tie for its better noise immunity.
+ */
+constexpr uint16_t rs485Ubrr(uint32_t fCpu, uint32_t baud, uint8_t divider)
+{
+    return (uint16_t)((fCpu + divider * baud / 2) / (divider * baud) - 1);
+}
+
+// Actual vs. configured baud rate [0.1%], rounded
+constexpr int32_t rs485BaudErrorPermille(uint32_t fCpu, uint32_t baud, uint8_t divider)
+{
+    return (int32_t)(((uint64_t)fCpu * 2000 / ((uint64_t)divider * (rs485Ubrr(fCpu, baud, divider) + 1) * baud) + 1) / 2) - 1000;
+}
+
+constexpr int32_t rs485Abs(int32_t v)
+{
+    return v < 0 ? -v : v;
+}
+
+constexpr bool rs485UseU2X(uint32_t fCpu, uint32_t baud)
+{
+    return rs485Abs(rs485BaudErrorPermille(fCpu, baud, 8)) < rs485Abs(rs485BaudErrorPermille(fCpu, baud, 16));
+}
+
+constexpr uint8_t rs485Divider(uint32_t fCpu, uint32_t baud)
+{
+    return rs485UseU2X(fCpu, baud) ? 8 : 16;
+}
+
+// Silent interval of tenths/10 character times (11 bits each) [µs], rounded up
+constexpr uint32_t rs485SilentInterval_us(uint32_t baud, uint8_t tenths, bool strict)
+{
+    return (strict && baud > 19200) ? (tenths > 15 ? 1750 : 750) : ((uint32_t)tenths * 1100000UL + baud - 1) / baud;
+}
+
+// Timer/Counter2 ticks (f_cpu / 64) for a time [µs], rounded up
+constexpr uint16_t rs485Ticks(uint32_t fCpu, uint32_t us)
+{
+    return (uint16_t)(((uint64_t)us * (fCpu / 64) + 999999) / 1000000);
+}
+
+// Modbus RTU slave on Serial (USART0)
+class SerialModbusSlave : public ModbusRTUSlave
+{
+public:
+    SerialModbusSlave(ObisValues *obisValues_)
+        : ModbusRTUSlave(obisValues_, RS_485_ADDRESS, &SERIAL_PHYSICAL)
+    {
+    }
+
+private:
+    static const ModbusRTUPhysical SERIAL_PHYSICAL;
+    static void waitSilentInterval(ModbusRTUSlave *slave);
+    static void transmit(ModbusRTUSlave *slave, uint8_t c);
+};
 
 // Setup
-void setupModbus(ObisValues *obisValues);
+void setupModbus(SerialModbusSlave *modbusSlave_);
+
+// Check for pending input. Needs to be called often enough to detect the silent interval.
+bool isModbusPending();
 
 // Notify on every main loop.
 void onTickModbus();
@@ -13,8 +13,7 @@ ModbusCRC::ModbusCRC()
 void ModbusCRC::reset()
 {
   crc = 0xFFFF;
-  poly = 0xA001;
-  xorOut = 0x0000;
+  isX25 = false;
 }
 
 X25CRC::X25CRC()
@@ -25,12 +24,14 @@ X25CRC::X25CRC()
 void X25CRC::reset()
 {
   crc = 0xFFFF;
-  poly = 0x8408;
-  xorOut = 0xFFFF;
+  isX25 = true;
 }
 
+#if !__HOST_CRC__
+// Host builds may select the table driven backend in ModbusCRCHost.cpp instead
 void ModbusCRC::feed(uint8_t c)
 {
+  const uint16_t poly = getPoly();
   crc ^= c;
   for (uint8_t i = 8; i != 0; i--)
   {
@@ -46,14 +47,23 @@ void ModbusCRC::feed(uint8_t c)
   }
 }
 
+void ModbusCRC::feed(const uint8_t *buf, size_t len)
+{
+  while (len--)
+  {
+    feed(*buf++);
+  }
+}
+#endif // __HOST_CRC__
+
 uint8_t ModbusCRC::getCRCLowByte()
 {
-  return crc ^ xorOut;
+  return crc ^ (isX25 ? 0xFFFF : 0x0000);
 }
 
 uint8_t ModbusCRC::getCRCHighByte()
 {
-  return (crc ^ xorOut) >> 8;
+  return (crc ^ (isX25 ? 0xFFFF : 0x0000)) >> 8;
 }
 
 // END
@@ -14,14 +14,19 @@ public:
 
   void reset();
   void feed(uint8_t c);
+  void feed(const uint8_t *buf, size_t len);
 
   uint8_t getCRCLowByte();  // Send this first.
   uint8_t getCRCHighByte(); // High byte second.
 
 protected:
   uint16_t crc;
-  uint16_t poly;
-  uint16_t xorOut;
+  bool isX25; // Polynomial, and X.25 inverts the result. A flag rather than the polynomial, to save SRAM.
+
+  inline uint16_t getPoly()
+  {
+    return isX25 ? 0x8408 : 0xA001;
+  }
 };
 
 class X25CRC : public ModbusCRC
@@ -0,0 +1,216 @@
+/*
+ * Host-only CRC16 backends, selected at compile time with -D__HOST_CRC__=1.
+ *
+ * Both polynomials are reflected CRC16 with the same register handling, so all backends only differ by polynomial.
+ * - Per byte: one table lookup, used by ModbusCRC::feed(uint8_t), i.e. by the SML decoder and the Modbus slave.
+ * - Bulk: slicing-by-8, or carry-less multiply folding when the CPU supports PCLMULQDQ (runtime dispatch).
+ *
+ * Folding, in reflected bit order: 16 bytes loaded little endian hold the polynomial with bit i <=> x^(127-i).
+ * Moving such a block D bits further towards the end of the message means multiplying by x^D. The low and high
+ * 64 bit halves are multiplied by (x^(D+63) mod P) and (x^(D-1) mod P) respectively, the extra x^-1 compensating for
+ * the one bit shift of a reflected carry-less product. The folded 16 bytes are finally run through the tables.
+ */
+
+#if __HOST_CRC__
+#include <string.h>
+#include "ModbusCRC.h"
+#include "ModbusCRCHost.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HOST_CRC_CLMUL 1
+#endif
+
+struct CRCTables
+{
+  uint16_t slice[8][256];
+#if HOST_CRC_CLMUL
+  uint64_t fold[4][2]; // Folding constants for D = 512, 384, 256, 128 bits: {low half, high half}
+#endif
+};
+
+// x^n mod P, normal (not reflected) representation
+static uint16_t xPowModP(uint32_t n, uint16_t normalPoly)
+{
+  uint16_t r = 1;
+  while (n--)
+  {
+    r = (r & 0x8000) ? (uint16_t)((r << 1) ^ normalPoly) : (uint16_t)(r << 1);
+  }
+  return r;
+}
+
+// Reflect polynomial r (degree < 16) to 64 bits with bit j <=> x^(63-j)
+static uint64_t reflect64(uint16_t r)
+{
+  uint64_t k = 0;
+  for (uint8_t d = 0; d < 16; d++)
+  {
+    if (r & (1 << d))
+    {
+      k |= 1ULL << (63 - d);
+    }
+  }
+  return k;
+}
+
+static void initTables(CRCTables &t, uint16_t poly)
+{
+  for (uint16_t b = 0; b < 256; b++)
+  {
+    uint8_t c = (uint8_t)b;
+    t.slice[0][b] = crc16Bitwise(0, poly, &c, 1);
+  }
+  for (uint8_t k = 1; k < 8; k++)
+  {
+    for (uint16_t b = 0; b < 256; b++)
+    {
+      uint16_t v = t.slice[k - 1][b];
+      t.slice[k][b] = (v >> 8) ^ t.slice[0][v & 0xFF];
+    }
+  }
+#if HOST_CRC_CLMUL
+  uint16_t normalPoly = 0;
+  for (uint8_t d = 0; d < 16; d++)
+  {
+    if (poly & (1 << d))
+    {
+      normalPoly |= 1 << (15 - d);
+    }
+  }
+  for (uint8_t k = 0; k < 4; k++)
+  {
+    uint32_t distance = 512 - 128 * k;
+    t.fold[k][0] = reflect64(xPowModP(distance + 63, normalPoly));
+    t.fold[k][1] = reflect64(xPowModP(distance - 1, normalPoly));
+  }
+#endif
+}
+
+static const CRCTables &tables(uint16_t poly)
+{
+  static CRCTables modbus, x25;
+  static bool ready = (initTables(modbus, 0xA001), initTables(x25, 0x8408), true);
+  (void)ready;
+  return poly == 0x8408 ? x25 : modbus;
+}
+
+uint16_t crc16Bitwise(uint16_t crc, uint16_t poly, const uint8_t *buf, size_t len)
+{
+  while (len--)
+  {
+    crc ^= *buf++;
+    for (uint8_t i = 8; i != 0; i--)
+    {
+      if ((crc & 0x0001) != 0)
+      {
+        crc >>= 1;
+        crc ^= poly;
+      }
+      else
+      {
+        crc >>= 1;
+      }
+    }
+  }
+  return crc;
+}
+
+static uint16_t slicing8(uint16_t crc, const CRCTables &t, const uint8_t *buf, size_t len)
+{
+  while (len >= 8)
+  {
+    uint64_t x;
+    memcpy(&x, buf, 8); // Little endian hosts only
+    x ^= crc;
+    crc = t.slice[7][x & 0xFF] ^ t.slice[6][(x >> 8) & 0xFF] ^ t.slice[5][(x >> 16) & 0xFF] ^ t.slice[4][(x >> 24) & 0xFF] ^
+          t.slice[3][(x >> 32) & 0xFF] ^ t.slice[2][(x >> 40) & 0xFF] ^ t.slice[1][(x >> 48) & 0xFF] ^ t.slice[0][x >> 56];
+    buf += 8;
+    len -= 8;
+  }
+  while (len--)
+  {
+    crc = (crc >> 8) ^ t.slice[0][(crc ^ *buf++) & 0xFF];
+  }
+  return crc;
+}
+
+uint16_t crc16Slicing8(uint16_t crc, uint16_t poly, const uint8_t *buf, size_t len)
+{
+  return slicing8(crc, tables(poly), buf, len);
+}
+
+#if HOST_CRC_CLMUL
+__attribute__((target("pclmul,sse2"))) static inline __m128i fold(__m128i v, const uint64_t *k)
+{
+  __m128i kk = _mm_set_epi64x((long long)k[1], (long long)k[0]);
+  return _mm_xor_si128(_mm_clmulepi64_si128(v, kk, 0x00), _mm_clmulepi64_si128(v, kk, 0x11));
+}
+
+__attribute__((target("pclmul,sse2"))) static uint16_t clmul(uint16_t crc, const CRCTables &t, const uint8_t *buf, size_t len)
+{
+  if (len < 128)
+  {
+    return slicing8(crc, t, buf, len);
+  }
+  // Four accumulators, 64 bytes apart. The register value goes into the first two message bytes.
+  __m128i a0 = _mm_xor_si128(_mm_loadu_si128((const __m128i *)buf), _mm_cvtsi32_si128(crc));
+  __m128i a1 = _mm_loadu_si128((const __m128i *)(buf + 16));
+  __m128i a2 = _mm_loadu_si128((const __m128i *)(buf + 32));
+  __m128i a3 = _mm_loadu_si128((const __m128i *)(buf + 48));
+  buf += 64;
+  len -= 64;
+  while (len >= 64)
+  {
+    a0 = _mm_xor_si128(fold(a0, t.fold[0]), _mm_loadu_si128((const __m128i *)buf));
+    a1 = _mm_xor_si128(fold(a1, t.fold[0]), _mm_loadu_si128((const __m128i *)(buf + 16)));
+    a2 = _mm_xor_si128(fold(a2, t.fold[0]), _mm_loadu_si128((const __m128i *)(buf + 32)));
+    a3 = _mm_xor_si128(fold(a3, t.fold[0]), _mm_loadu_si128((const __m128i *)(buf + 48)));
+    buf += 64;
+    len -= 64;
+  }
+  // Fold the accumulators onto the last one: 48, 32, 16 bytes
+  a3 = _mm_xor_si128(a3, _mm_xor_si128(fold(a0, t.fold[1]), _mm_xor_si128(fold(a1, t.fold[2]), fold(a2, t.fold[3]))));
+  uint8_t rest[16];
+  _mm_storeu_si128((__m128i *)rest, a3);
+  crc = slicing8(0, t, rest, sizeof(rest));
+  return slicing8(crc, t, buf, len);
+}
+
+bool crc16ClmulSupported()
+{
+  static bool supported = __builtin_cpu_supports("pclmul");
+  return supported;
+}
+#else
+bool crc16ClmulSupported()
+{
+  return false;
+}
+#endif // HOST_CRC_CLMUL
+
+uint16_t crc16Clmul(uint16_t crc, uint16_t poly, const uint8_t *buf, size_t len)
+{
+#if HOST_CRC_CLMUL
+  if (crc16ClmulSupported())
+  {
+    return clmul(crc, tables(poly), buf, len);
+  }
+#endif
+  return slicing8(crc, tables(poly), buf, len);
+}
+
+// Section: ModbusCRC interface
+
+void ModbusCRC::feed(uint8_t c)
+{
+  crc = (crc >> 8) ^ tables(getPoly()).slice[0][(crc ^ c) & 0xFF];
+}
+
+void ModbusCRC::feed(const uint8_t *buf, size_t len)
+{
+  crc = crc16Clmul(crc, getPoly(), buf, len);
+}
+
+#endif // __HOST_CRC__
+
+// END
@@ -0,0 +1,25 @@
+/*
+ * Host-only CRC16 backends, for both the Modbus RTU (0xA001) and the SML X.25 (0x8408) polynomial.
+ * Build with -D__HOST_CRC__=1 and ModbusCRCHost.cpp to make ModbusCRC/X25CRC use them.
+ */
+
+#ifndef __MODBUSCRCHOST_H
+#define __MODBUSCRCHOST_H
+
+#include <Arduino.h>
+
+#if __HOST_CRC__
+// All functions continue from register value crc (before xorOut) and return the new register value.
+
+// Reference: Same bitwise loop as ModbusCRC::feed() on the device
+uint16_t crc16Bitwise(uint16_t crc, uint16_t poly, const uint8_t *buf, size_t len);
+
+// Eight table lookups per eight bytes
+uint16_t crc16Slicing8(uint16_t crc, uint16_t poly, const uint8_t *buf, size_t len);
+
+// Carry-less multiply folding, 64 bytes per step. Falls back to slicing-by-8 if the CPU lacks PCLMULQDQ.
+uint16_t crc16Clmul(uint16_t crc, uint16_t poly, const uint8_t *buf, size_t len);
+bool crc16ClmulSupported();
+#endif // __HOST_CRC__
+
+#endif // __MODBUSCRCHOST_H
@@ -0,0 +1,116 @@
+/*
+ * Cross-check and benchmark of the host CRC backends against the bitwise loop used on the device.
+ *
+ * g++ -O2 -I . -D__TEST__=1 -D__HOST_CRC__=1 -o test-crc ModbusCRCTest.cpp ModbusCRC.cpp ModbusCRCHost.cpp
+ * ./test-crc [rounds]
+ */
+
+#include <stdio.h>
+#include "ModbusCRC.h"
+#include "ModbusCRCHost.h"
+
+#if __TEST__ && __HOST_CRC__
+#include <stdlib.h>
+#include <time.h>
+#include <vector>
+
+static const uint16_t POLYS[] = {0xA001, 0x8408};
+
+typedef uint16_t (*CRCFunction)(uint16_t crc, uint16_t poly, const uint8_t *buf, size_t len);
+
+static double now()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+static void benchmark(const char *name, CRCFunction f, uint16_t poly, const std::vector<uint8_t> &buf)
+{
+    double t0 = now();
+    double t1 = t0;
+    uint64_t bytes = 0;
+    uint16_t crc = 0xFFFF;
+    while (t1 - t0 < 0.5)
+    {
+        crc = f(crc, poly, buf.data(), buf.size());
+        bytes += buf.size();
+        t1 = now();
+    }
+    printf("  %-10s poly 0x%04X %9.1f MB/s (0x%04X)\n", name, poly, bytes / (t1 - t0) / 1e6, crc);
+}
+
+int main(int argc, char *argv[])
+{
+    int rounds = argc > 1 ? atoi(argv[1]) : 10000;
+    srand(4711);
+    printf("PCLMULQDQ: %s\n", crc16ClmulSupported() ? "yes" : "no");
+
+    // Cross-check on random buffers, lengths, start values and split points
+    int failures = 0;
+    std::vector<uint8_t> buf(8192);
+    for (int r = 0; r < rounds; r++)
+    {
+        size_t len = rand() % buf.size();
+        for (size_t k = 0; k < len; k++)
+        {
+            buf[k] = (uint8_t)rand();
+        }
+        for (uint16_t poly : POLYS)
+        {
+            uint16_t crc = (r & 1) ? 0xFFFF : (uint16_t)rand();
+            uint16_t expected = crc16Bitwise(crc, poly, buf.data(), len);
+            size_t split = len ? rand() % len : 0;
+            uint16_t slicing = crc16Slicing8(crc16Slicing8(crc, poly, buf.data(), split), poly, buf.data() + split, len - split);
+            uint16_t folded = crc16Clmul(crc16Clmul(crc, poly, buf.data(), split), poly, buf.data() + split, len - split);
+
+            // Class interface, as used by decoder and Modbus slave, byte by byte and in bulk
+            ModbusCRC modbus[2] = {ModbusCRC(), ModbusCRC()};
+            X25CRC x25[2] = {X25CRC(), X25CRC()};
+            ModbusCRC &c = (poly == 0x8408) ? x25[0] : modbus[0];
+            ModbusCRC &d = (poly == 0x8408) ? x25[1] : modbus[1];
+            for (size_t k = 0; k < split; k++)
+            {
+                c.feed(buf[k]);
+            }
+            c.feed(buf.data() + split, len - split);
+            d.feed(buf.data(), len);
+            uint16_t xorOut = (poly == 0x8408) ? 0xFFFF : 0x0000;
+            uint16_t reference = crc16Bitwise(0xFFFF, poly, buf.data(), len) ^ xorOut;
+            uint16_t viaClass = (c.getCRCHighByte() << 8) | c.getCRCLowByte();
+            uint16_t viaBulk = (d.getCRCHighByte() << 8) | d.getCRCLowByte();
+
+            if (slicing != expected || folded != expected || viaClass != reference || viaBulk != reference)
+            {
+                if (failures++ < 10)
+                {
+                    printf("MISMATCH poly 0x%04X len %zu split %zu: bitwise 0x%04X slicing 0x%04X clmul 0x%04X class 0x%04X/0x%04X/0x%04X\n",
+                           poly, len, split, expected, slicing, folded, reference, viaClass, viaBulk);
+                }
+            }
+        }
+    }
+    printf("Cross-check: %d rounds, %d failures\n", rounds, failures);
+
+    // Known check values for "123456789"
+    const uint8_t check[] = {'1', '2', '3', '4', '5', '6', '7', '8', '9'};
+    uint16_t modbusCheck = crc16Clmul(0xFFFF, 0xA001, check, sizeof(check));
+    uint16_t x25Check = crc16Clmul(0xFFFF, 0x8408, check, sizeof(check)) ^ 0xFFFF;
+    printf("Check values: Modbus 0x%04X (0x4B37), X.25 0x%04X (0x906E)\n", modbusCheck, x25Check);
+    if (modbusCheck != 0x4B37 || x25Check != 0x906E)
+    {
+        failures++;
+    }
+
+    printf("Throughput, %zu byte buffer:\n", buf.size());
+    for (uint16_t poly : POLYS)
+    {
+        benchmark("bitwise", crc16Bitwise, poly, buf);
+        benchmark("slicing-8", crc16Slicing8, poly, buf);
+        benchmark("clmul", crc16Clmul, poly, buf);
+    }
+    return failures ? 1 : 0;
+}
+#endif
+
+// END
@@ -0,0 +1,467 @@
+/*
+ * Bus simulation for the Modbus RTU frame tracker: How many requests to us are missed under mixed bus load?
+ *
+ * A master polls a number of slaves with a mix of function codes, every other slave answers (or not). Requests to us
+ * are answered by ModbusRTUSlave, and for comparison by the previous receiver that only relied on silent intervals.
+ * Faults: frame gaps not detected (timing jitter), gaps inside frames (slow slaves) and corrupted bytes.
+ *
+ * Also checks the RS-485 timing for common baud rates at 8MHz: Baud rate generator setting (U2X or not) and its
+ * error, bytes sent through a bit level model of the USART receivers in both directions, silent interval and
+ * turnaround in Timer/Counter2 ticks.
+ *
+ * Requests to us longer than the receive buffer (Write Multiple Registers) must get exception 01.
+ *
+ * Virtual slaves: built with VIRTUAL_SLAVE_WINDOWS, checks the window of the first one (reads inside it, exception 02
+ * outside it), that our own address still serves the full map, and that there is no reply past the last one.
+ *
+ * g++ -O2 -I . -D__TEST__=1 -o test-rtu-bus ModbusRTUBusTest.cpp ModbusSlave.cpp ModbusCRC.cpp ObisValues.cpp
+ * g++ -O2 -I . -D__TEST__=1 -DVIRTUAL_SLAVE_WINDOWS="{LIVE_REGISTERS_BASE + 6, 2}" -o test-rtu-bus-windows ModbusRTUBusTest.cpp ModbusSlave.cpp ModbusCRC.cpp ObisValues.cpp
+ * ./test-rtu-bus [transactions]
+ */
+
+#include <stdio.h>
+#include "ModbusSlave.h"
+#include "ExposeToModbus.h"
+
+#if __TEST__
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <vector>
+
+#define OUR_ADDRESS 9
+#define TEST_F_CPU 8000000UL
+
+static const uint32_t BAUD_RATES[] = {9600, 19200, 38400, 57600, 115200, 230400, 250000, 500000, 1000000};
+
+struct Faults
+{
+    const char *name;
+    double missedGap;   // Probability that a gap between frames is not detected
+    double spuriousGap; // Probability per byte of a gap inside a frame
+    double corruption;  // Probability per byte of a bit error
+};
+
+static const Faults SCENARIOS[] = {
+    {"clean", 0, 0, 0},
+    {"jitter: 20% frame gaps missed", 0.2, 0, 0},
+    {"slow slaves: 1% gaps in frames", 0, 0.01, 0},
+    {"noise: 1e-3 byte errors", 0, 0, 0.001},
+    {"all of the above", 0.2, 0.01, 0.001},
+};
+
+struct BusByte
+{
+    uint8_t c;
+    bool quiet;
+};
+
+class BenchSlave : public ModbusRTUSlave
+{
+public:
+    unsigned long responses = 0;
+
+    BenchSlave(ObisValues *obisValues_)
+        : ModbusRTUSlave(obisValues_, OUR_ADDRESS, &PHYSICAL)
+    {
+    }
+
+private:
+    static const ModbusRTUPhysical PHYSICAL;
+    static void waitSilentInterval(ModbusRTUSlave *slave)
+    {
+        static_cast<BenchSlave *>(slave)->responses++;
+    }
+    static void transmit(ModbusRTUSlave *, uint8_t)
+    {
+    }
+};
+const ModbusRTUPhysical BenchSlave::PHYSICAL = {waitSilentInterval, transmit};
+
+// Keeps its responses
+class CaptureSlave : public ModbusRTUSlave
+{
+public:
+    std::vector<uint8_t> response;
+
+    CaptureSlave(ObisValues *obisValues_)
+        : ModbusRTUSlave(obisValues_, OUR_ADDRESS, &PHYSICAL)
+    {
+    }
+
+private:
+    static const ModbusRTUPhysical PHYSICAL;
+    static void waitSilentInterval(ModbusRTUSlave *)
+    {
+    }
+    static void transmit(ModbusRTUSlave *slave, uint8_t c)
+    {
+        static_cast<CaptureSlave *>(slave)->response.push_back(c);
+    }
+};
+const ModbusRTUPhysical CaptureSlave::PHYSICAL = {waitSilentInterval, transmit};
+
+/*
+ * Receiver as before frame tracking: Frame starts after a silent interval, Read Input Registers only.
+ */
+class LegacyReceiver
+{
+public:
+    unsigned long responses = 0;
+
+    void onReceive(uint8_t c, bool quiet)
+    {
+        if (quiet)
+        {
+            zz = (c == OUR_ADDRESS) ? 1 : 0;
+        }
+        else if (zz == 1)
+        {
+            zz = (c == RS_485_READ_INPUT_REGISTER) ? 2 : 0;
+            ct = 0;
+            apdu[ct++] = c;
+        }
+        else if (zz == 2)
+        {
+            apdu[ct++] = c;
+            if (ct == 7)
+            {
+                zz = 0;
+                ModbusCRC crc;
+                crc.feed(OUR_ADDRESS);
+                for (uint8_t k = 0; k < 5; k++)
+                {
+                    crc.feed(apdu[k]);
+                }
+                responses += (apdu[5] == crc.getCRCLowByte() && apdu[6] == crc.getCRCHighByte());
+            }
+        }
+    }
+
+private:
+    uint8_t apdu[16];
+    uint8_t zz = 0;
+    uint8_t ct = 0;
+};
+
+static double random01()
+{
+    return rand() / (RAND_MAX + 1.0);
+}
+
+static void appendFrame(std::vector<BusByte> &bus, std::vector<uint8_t> frame, const Faults &f, bool *intact)
+{
+    ModbusCRC crc;
+    crc.feed(frame.data(), frame.size());
+    frame.push_back(crc.getCRCLowByte());
+    frame.push_back(crc.getCRCHighByte());
+    *intact = true;
+    for (size_t k = 0; k < frame.size(); k++)
+    {
+        BusByte b;
+        b.c = frame[k];
+        b.quiet = k == 0 ? random01() >= f.missedGap : random01() < f.spuriousGap;
+        if (random01() < f.corruption)
+        {
+            b.c ^= 1 << (rand() % 8);
+            *intact = false;
+        }
+        bus.push_back(b);
+    }
+}
+
+static void randomBytes(std::vector<uint8_t> &frame, size_t n)
+{
+    while (n--)
+    {
+        frame.push_back((uint8_t)rand());
+    }
+}
+
+/*
+ * One poll cycle of the master: request plus response, to us or to some other slave.
+ * Return true if this was an intact request to us, i.e. one we should answer.
+ */
+static bool transaction(std::vector<BusByte> &bus, const Faults &f)
+{
+    bool intact;
+    if (rand() % 8 == 0)
+    {
+        uint8_t count = 1 + rand() % 8;
+        appendFrame(bus, {OUR_ADDRESS, RS_485_READ_INPUT_REGISTER, LIVE_REGISTERS_BASE >> 8, 0, 0, count}, f, &intact);
+        return intact; // Our response is not seen on the bus
+    }
+
+    uint8_t slave = 1 + rand() % 20;
+    slave += (slave >= OUR_ADDRESS);
+    static const uint8_t FUNCTIONS[] = {0x03, 0x04, 0x01, 0x06, 0x10, 0x08, 0x2B};
+    uint8_t function = FUNCTIONS[rand() % sizeof(FUNCTIONS)];
+    std::vector<uint8_t> request = {slave, function};
+    std::vector<uint8_t> response = {slave, function};
+    uint8_t n = 1 + rand() % 32;
+    switch (function)
+    {
+    case 0x01:
+    case 0x03:
+    case 0x04:
+        randomBytes(request, 2);
+        request.push_back(0);
+        request.push_back(n);
+        response.push_back(function == 0x01 ? (n + 7) / 8 : 2 * n);
+        randomBytes(response, response.back());
+        break;
+    case 0x06:
+    case 0x08:
+        randomBytes(request, 4);
+        response = request;
+        break;
+    case 0x10:
+        randomBytes(request, 2);
+        request.push_back(0);
+        request.push_back(n);
+        request.push_back(2 * n);
+        randomBytes(request, 2 * n);
+        response.insert(response.end(), request.begin() + 2, request.begin() + 6);
+        break;
+    case 0x2B:
+        request.push_back(0x0E);
+        request.push_back(0x01);
+        request.push_back(0x00);
+        response.insert(response.end(), {0x0E, 0x01, 0x01, 0x00, 0x00, 0x01, 0x00, n});
+        randomBytes(response, n);
+        break;
+    }
+    appendFrame(bus, request, f, &intact);
+    uint8_t outcome = rand() % 20;
+    if (outcome == 0)
+    {
+        appendFrame(bus, {slave, (uint8_t)(function | 0x80), 0x02}, f, &intact); // Exception
+    }
+    else if (outcome != 1) // Otherwise no response at all
+    {
+        appendFrame(bus, response, f, &intact);
+    }
+    return false;
+}
+
+/*
+ * Bytes sent back-to-back at txBaud, 8N2, received by an AVR style USART clocked at rxBaud * oversampling:
+ * A start bit is a falling edge, each bit is the majority of three samples around its middle (8, 9, 10 of 16 or
+ * 4, 5, 6 of 8 with U2X). Phase [0, 1) of the first sample relative to the line. Return wrong bytes and frame errors.
+ */
+static int uartErrors(const std::vector<uint8_t> &bytes, double txBaud, double rxBaud, int oversampling, double phase)
+{
+    const double tBit = 1.0 / txBaud;
+    const double tSample = 1.0 / (rxBaud * oversampling);
+    auto line = [&](double t) -> int
+    {
+        size_t frame = (size_t)(t / (11 * tBit));
+        if (t < 0 || frame >= bytes.size())
+        {
+            return 1;
+        }
+        int bit = (int)((t - frame * 11 * tBit) / tBit);
+        return bit == 0 ? 0 : bit <= 8 ? (bytes[frame] >> (bit - 1)) & 1 : 1;
+    };
+
+    int errors = 0;
+    size_t received = 0;
+    int previous = 1;
+    const double end = (bytes.size() * 11 + 2) * tBit;
+    for (double t = phase * tSample; t < end && received < bytes.size();)
+    {
+        int v = line(t);
+        if (previous == 1 && v == 0)
+        {
+            uint16_t bits = 0; // Start, 8 data, first stop bit
+            for (int k = 0; k < 10; k++)
+            {
+                int middle = k * oversampling + oversampling / 2;
+                int votes = line(t + (middle - 1) * tSample) + line(t + middle * tSample) + line(t + (middle + 1) * tSample);
+                bits |= (votes >= 2) << k;
+            }
+            errors += (bits & 1) || !(bits >> 9) || (uint8_t)(bits >> 1) != bytes[received];
+            received++;
+            t += (9 * oversampling + oversampling / 2 + 2) * tSample; // Look for the next start bit after the stop bit samples
+            previous = 1;
+            continue;
+        }
+        previous = v;
+        t += tSample;
+    }
+    return errors + (int)(bytes.size() - received);
+}
+
+static int checkTiming()
+{
+    int failures = 0;
+    std::vector<uint8_t> bytes = {0x00, 0xFF, 0x55, 0xAA, 0x01, 0x80, 0x7F, 0xFE};
+    while (bytes.size() < 512)
+    {
+        bytes.push_back((uint8_t)rand());
+    }
+    printf("\nRS-485 timing at %luMHz\n", TEST_F_CPU / 1000000);
+    printf("%8s %4s %5s %9s %7s %9s %9s %14s %14s\n", "Baud", "U2X", "UBRR", "Actual", "Error", "RX errors", "TX errors", "T3.5 strict", "T3.5 derived");
+    for (uint32_t baud : BAUD_RATES)
+    {
+        uint8_t divider = rs485Divider(TEST_F_CPU, baud);
+        uint16_t ubrr = rs485Ubrr(TEST_F_CPU, baud, divider);
+        double actual = (double)TEST_F_CPU / divider / (ubrr + 1);
+        int32_t error = rs485BaudErrorPermille(TEST_F_CPU, baud, divider);
+
+        // Master at the nominal baud rate with 16x oversampling, both directions, a few sampling phases
+        int rxErrors = 0, txErrors = 0;
+        for (double phase = 0; phase < 1; phase += 0.25)
+        {
+            rxErrors += uartErrors(bytes, baud, actual, divider, phase);
+            txErrors += uartErrors(bytes, actual, baud, 16, phase);
+        }
+
+        // Silent interval and turnaround in Timer/Counter2 ticks must cover 3.5 character times, or 1750µs
+        uint32_t strict = rs485SilentInterval_us(baud, 35, true);
+        uint32_t derived = rs485SilentInterval_us(baud, 35, false);
+        uint16_t strictTicks = rs485Ticks(TEST_F_CPU, strict);
+        uint16_t derivedTicks = rs485Ticks(TEST_F_CPU, derived);
+        double charTimes35 = 3.5 * 11 / baud * 1e6;
+        bool timingOk = derivedTicks * 8.0 >= charTimes35 && strictTicks * 8.0 >= (baud > 19200 ? 1750 : charTimes35) &&
+                        rs485SilentInterval_us(baud, 15, false) < derived;
+
+        bool usable = rs485Abs(error) <= RS_485_MAX_BAUD_ERROR_PERMILLE;
+        printf("%8u %4s %5u %9.0f %6.1f%% %9d %9d %7uus %4u %7uus %4u %s\n", baud, divider == 8 ? "yes" : "no", ubrr, actual,
+               error / 10.0, rxErrors, txErrors, strict, strictTicks, derived, derivedTicks,
+               !timingOk ? "TIMING FAIL" : !usable ? "(rejected at build time)" : (rxErrors || txErrors) ? "FAIL" : "OK");
+        failures += !timingOk || (usable && (rxErrors || txErrors));
+    }
+    return failures;
+}
+
+// Read Input Registers from unit, return the response
+static std::vector<uint8_t> readInputRegisters(CaptureSlave &slave, uint8_t unit, uint16_t address, uint16_t count)
+{
+    std::vector<uint8_t> request = {unit, RS_485_READ_INPUT_REGISTER, (uint8_t)(address >> 8), (uint8_t)address,
+                                    (uint8_t)(count >> 8), (uint8_t)count};
+    ModbusCRC crc;
+    for (uint8_t c : request)
+    {
+        crc.feed(c);
+    }
+    request.push_back(crc.getCRCLowByte());
+    request.push_back(crc.getCRCHighByte());
+    slave.response.clear();
+    for (size_t k = 0; k < request.size(); k++)
+    {
+        slave.onReceive(request[k], k == 0);
+    }
+    return slave.response;
+}
+
+static int checkLongRequest()
+{
+    ObisValues obisValues = ObisValues();
+    CaptureSlave slave(&obisValues);
+    std::vector<uint8_t> request = {OUR_ADDRESS, 0x10, 0x01, 0x00, 0x00, 0x08, 0x10};
+    request.resize(request.size() + 0x10, 0x55);
+    ModbusCRC crc;
+    crc.feed(request.data(), request.size());
+    request.push_back(crc.getCRCLowByte());
+    request.push_back(crc.getCRCHighByte());
+    for (size_t k = 0; k < request.size(); k++)
+    {
+        slave.onReceive(request[k], k == 0);
+    }
+    const bool ok = slave.response.size() == 5 && slave.response[1] == 0x90 && slave.response[2] == 0x01;
+    printf("\nWrite Multiple Registers, %u bytes: exception 01 %s\n", (unsigned)request.size(), ok ? "OK" : "FAIL");
+    return !ok;
+}
+
+static int checkVirtualSlaves()
+{
+    static const uint8_t OBIS_POWER[6] = {0x01, 0x00, 0x10, 0x07, 0x00, 0xFF};
+    ObisValues obisValues = ObisValues();
+    uint8_t obis[6];
+    memcpy(obis, OBIS_POWER, sizeof(obis));
+    obisValues.feedObisOctetString(obis, sizeof(obis));
+    obisValues.feedObisValue(0x12345678);
+    obisValues.feedObisOctetString(obis, 0);
+    obisValues.commit();
+    CaptureSlave slave(&obisValues);
+
+    int failures = 0;
+    printf("\nVirtual slaves: %u\n", (unsigned)(N_UNITS - 1));
+    if (N_UNITS > 1)
+    {
+        const RegisterBlock &window = UNIT_WINDOWS[1];
+        const std::vector<uint8_t> full = readInputRegisters(slave, OUR_ADDRESS, window.address, window.count);
+        const std::vector<uint8_t> inside = readInputRegisters(slave, OUR_ADDRESS + 1, 0, window.count);
+        const bool insideOk = inside.size() == 5 + 2 * (size_t)window.count && inside[0] == OUR_ADDRESS + 1 && full.size() == inside.size() &&
+                              std::equal(full.begin() + 1, full.end() - 2, inside.begin() + 1);
+        printf("Unit %d, 0..%d = %d..%d: %s\n", OUR_ADDRESS + 1, window.count - 1, window.address, window.address + window.count - 1,
+               insideOk ? "OK" : "FAIL");
+        failures += !insideOk;
+
+        const std::vector<uint8_t> outside = readInputRegisters(slave, OUR_ADDRESS + 1, 1, window.count);
+        const bool outsideOk = outside.size() == 5 && outside[1] == (RS_485_READ_INPUT_REGISTER | 0x80) && outside[2] == 0x02;
+        printf("Unit %d, 1..%d: exception 02 %s\n", OUR_ADDRESS + 1, window.count, outsideOk ? "OK" : "FAIL");
+        failures += !outsideOk;
+    }
+    const std::vector<uint8_t> own = readInputRegisters(slave, OUR_ADDRESS, LIVE_REGISTERS_BASE, 8);
+    const bool ownOk = own.size() == 5 + 2 * 8 && own[0] == OUR_ADDRESS;
+    printf("Unit %d, full map: %s\n", OUR_ADDRESS, ownOk ? "OK" : "FAIL");
+    failures += !ownOk;
+
+    const bool beyondOk = readInputRegisters(slave, OUR_ADDRESS + N_UNITS, 0, 1).empty();
+    printf("Unit %d: no reply %s\n", (int)(OUR_ADDRESS + N_UNITS), beyondOk ? "OK" : "FAIL");
+    failures += !beyondOk;
+    return failures;
+}
+
+int main(int argc, char *argv[])
+{
+    int transactions = argc > 1 ? atoi(argv[1]) : 200000;
+    int failures = 0;
+    printf("%-32s %9s %12s %12s %10s\n", "Scenario", "Requests", "Missed now", "Missed prev", "Mbyte/s");
+    for (const Faults &f : SCENARIOS)
+    {
+        srand(4711);
+        std::vector<BusByte> bus;
+        unsigned long requests = 0;
+        for (int k = 0; k < transactions; k++)
+        {
+            requests += transaction(bus, f);
+        }
+
+        ObisValues obisValues = ObisValues();
+        BenchSlave slave(&obisValues);
+        LegacyReceiver legacy;
+        struct timespec t0, t1;
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        for (const BusByte &b : bus)
+        {
+            slave.onReceive(b.c, b.quiet);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        for (const BusByte &b : bus)
+        {
+            legacy.onReceive(b.c, b.quiet);
+        }
+        double seconds = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+
+        long missedNow = (long)requests - (long)slave.responses;
+        long missedPrev = (long)requests - (long)legacy.responses;
+        printf("%-32s %9lu %11.3f%% %11.3f%% %10.1f\n", f.name, requests, 100.0 * missedNow / requests, 100.0 * missedPrev / requests,
+               bus.size() / seconds / 1e6);
+        // A good CRC by chance (1:65536 per check) may end a frame early, so only the clean bus must be perfect
+        if ((f.missedGap == 0 && f.spuriousGap == 0 && f.corruption == 0 && missedNow != 0) || missedNow > missedPrev)
+        {
+            failures++;
+        }
+    }
+    failures += checkTiming();
+    failures += checkLongRequest();
+    failures += checkVirtualSlaves();
+    return failures ? 1 : 0;
+}
+#endif
+
+// END
@@ -0,0 +1,462 @@
+/*
+ * Modbus slave, independent of transport. One instance per set of ObisValues, no shared state.
+ */
+
+#include <Arduino.h>
+#include "ModbusSlave.h"
+
+#define STRINGIFY_(x) #x
+#define STRINGIFY(x) STRINGIFY_(x)
+
+#define N_DEVICE_OBJECTS 3 // VendorName, ProductCode, MajorMinorRevision
+static const char DEVICE_OBJECTS[] PROGMEM = DEVICE_VENDOR_NAME "\0" DEVICE_PRODUCT_CODE "\0" STRINGIFY(FIRMWARE_VERSION);
+
+uint8_t ModbusSlave::getAddress()
+{
+    return address;
+}
+
+void ModbusSlave::countBusMessage()
+{
+    counters[MODBUS_BUS_MESSAGES]++;
+}
+
+void ModbusSlave::beginResponse()
+{
+    ((void (*)(ModbusSlave *))pgm_read_ptr(&transport->beginResponse))(this);
+}
+
+void ModbusSlave::write(uint8_t c)
+{
+    ((void (*)(ModbusSlave *, uint8_t))pgm_read_ptr(&transport->write))(this, c);
+}
+
+void ModbusSlave::endResponse()
+{
+    ((void (*)(ModbusSlave *))pgm_read_ptr(&transport->endResponse))(this);
+}
+
+/**
+ * Read Input Registers (04) and Read Holding Registers (03), same register map.
+ * Return 0x00 or Modbus Exception Code
+ */
+uint8_t ModbusSlave::executeReadRegistersPdu(const uint8_t *pdu, uint8_t length)
+{
+    if (length != 5)
+    {
+        return 0x03; // Illegal data value
+    }
+
+    uint16_t address = (pdu[1] << 8) | pdu[2];       // Register address 256, 257, ...
+    uint16_t registerCount = (pdu[3] << 8) | pdu[4]; // Number of registers to read 1, 2, 3, ...
+
+    if (unit)
+    {
+        // Virtual slave: Window of the register map, at 0, 1, ...
+        const RegisterBlock &window = UNIT_WINDOWS[unit < N_UNITS ? unit : 0];
+        if (registerCount == 0 || address + registerCount > window.count)
+        {
+            return 0x02; // Illegal data address
+        }
+        address += window.address;
+    }
+    uint8_t exceptionCode = obisValues->checkInputRegisters(address, registerCount);
+    if (exceptionCode)
+    {
+        return exceptionCode;
+    }
+
+    beginResponse();
+    write(pdu[0]);
+    write((uint8_t)(registerCount << 1)); // Number of bytes to send, each register has two bytes
+    const uint16_t *registers = obisValues->getInputRegisters(address);
+    while (registerCount--)
+    {
+        uint16_t value = *registers++;
+        write((uint8_t)(value >> 8));
+        write((uint8_t)value);
+    }
+    endResponse();
+    return 0x00;
+}
+
+/**
+ * Diagnostics (08): Echo, clear counters and the counters themselves.
+ * Return 0x00 or Modbus Exception Code
+ */
+uint8_t ModbusSlave::executeDiagnosticsPdu(const uint8_t *pdu, uint8_t length)
+{
+    if (length != 5)
+    {
+        return 0x03; // Illegal data value
+    }
+
+    uint16_t subFunction = (pdu[1] << 8) | pdu[2];
+    uint16_t data = (pdu[3] << 8) | pdu[4];
+    if (subFunction == MODBUS_DIAG_CLEAR_COUNTERS)
+    {
+        for (uint8_t k = 0; k < N_MODBUS_COUNTERS; k++)
+        {
+            counters[k] = 0;
+        }
+    }
+    else if (subFunction >= MODBUS_DIAG_BUS_MESSAGE_COUNT && subFunction < MODBUS_DIAG_BUS_MESSAGE_COUNT + N_MODBUS_COUNTERS)
+    {
+        data = counters[subFunction - MODBUS_DIAG_BUS_MESSAGE_COUNT];
+    }
+    else if (subFunction != MODBUS_DIAG_RETURN_QUERY_DATA)
+    {
+        return 0x01; // Illegal function, i.e. sub-function not supported
+    }
+
+    beginResponse();
+    write(pdu[0]);
+    write(pdu[1]);
+    write(pdu[2]);
+    write((uint8_t)(data >> 8));
+    write((uint8_t)data);
+    endResponse();
+    return 0x00;
+}
+
+/**
+ * Read Device Identification (2B / 0E). We only have the basic objects, so all read codes return those.
+ * Return 0x00 or Modbus Exception Code
+ */
+uint8_t ModbusSlave::executeReadDeviceIdentificationPdu(const uint8_t *pdu, uint8_t length)
+{
+    if (length != 4 || pdu[1] != RS_485_READ_DEVICE_IDENTIFICATION || pdu[2] < 0x01 || pdu[2] > 0x04)
+    {
+        return 0x03; // Illegal data value: MEI type, length or Read Device ID code
+    }
+
+    uint8_t objectId = pdu[3];
+    bool individual = (pdu[2] == 0x04);
+    if (objectId >= N_DEVICE_OBJECTS)
+    {
+        if (individual)
+        {
+            return 0x02; // Illegal data address
+        }
+        objectId = 0; // Stream access restarts at the first object
+    }
+
+    beginResponse();
+    write(pdu[0]);
+    write(pdu[1]);
+    write(pdu[2]);
+    write(0x81); // Conformity level: basic, stream and individual access
+    write(0x00); // No more follows
+    write(0x00); // Next object ID
+    write(individual ? 1 : N_DEVICE_OBJECTS - objectId);
+
+    const char *p = DEVICE_OBJECTS;
+    for (uint8_t id = 0; id < N_DEVICE_OBJECTS; id++)
+    {
+        uint8_t n = 0;
+        while (pgm_read_byte(p + n))
+        {
+            n++;
+        }
+        if (id == objectId || (id > objectId && !individual))
+        {
+            write(id);
+            write(n);
+            for (uint8_t k = 0; k < n; k++)
+            {
+                write(pgm_read_byte(p + k));
+            }
+        }
+        p += n + 1;
+    }
+    endResponse();
+    return 0x00;
+}
+
+/*
+ * Process incoming PDU.
+ */
+void ModbusSlave::executePdu(const uint8_t *pdu, uint8_t length, uint8_t unit_)
+{
+    unit = unit_;
+    counters[MODBUS_SERVER_MESSAGES]++;
+    obisValues->trace(TRACE_MODBUS_REQUEST, pdu[0]);
+
+    uint8_t exceptionCode = 0x1; // Illegal Function
+    if (pdu[0] == RS_485_READ_INPUT_REGISTER || pdu[0] == RS_485_READ_HOLDING_REGISTER)
+    {
+        exceptionCode = executeReadRegistersPdu(pdu, length);
+    }
+    else if (pdu[0] == RS_485_DIAGNOSTICS)
+    {
+        exceptionCode = executeDiagnosticsPdu(pdu, length);
+    }
+    else if (pdu[0] == RS_485_ENCAPSULATED_INTERFACE)
+    {
+        exceptionCode = executeReadDeviceIdentificationPdu(pdu, length);
+    }
+    if (exceptionCode)
+    {
+        counters[MODBUS_EXCEPTIONS]++;
+        obisValues->trace(TRACE_MODBUS_EXCEPTION, pdu[0]);
+        beginResponse();
+        write(pdu[0] | 0x80);
+        write(exceptionCode);
+        endResponse();
+    }
+}
+
+// Section: Modbus RTU frame tracking
+
+#define RTU_LENGTH_PENDING 0xFFFF
+
+/*
+ * Frame length by function code, including address and CRC, for request [0] and response [1]:
+ * base[] plus the byte count at position countAt[], if not 0. A base of 0 means the length is unknown.
+ */
+static void inferLength(uint8_t function, uint8_t *base, uint8_t *countAt)
+{
+    base[0] = base[1] = 0;
+    countAt[0] = countAt[1] = 0;
+    if (function & 0x80)
+    {
+        base[1] = 5; // Exception response
+    }
+    else if (function >= 0x01 && function <= 0x04)
+    {
+        base[0] = 8;
+        base[1] = 5;
+        countAt[1] = 2;
+    }
+    else if (function == 0x05 || function == 0x06 || function == 0x08)
+    {
+        base[0] = base[1] = 8;
+    }
+    else if (function == 0x0F || function == 0x10)
+    {
+        base[0] = 9;
+        countAt[0] = 6;
+        base[1] = 8;
+    }
+    else if (function == 0x2B)
+    {
+        base[0] = 7; // Read Device Identification. Response length varies, found by CRC.
+    }
+    else if (function == 0x16)
+    {
+        base[0] = base[1] = 10;
+    }
+    else if (function == 0x17)
+    {
+        base[0] = 13;
+        countAt[0] = 10;
+        base[1] = 5;
+        countAt[1] = 2;
+    }
+}
+
+void ModbusRTUFrameTracker::start()
+{
+    active = true;
+    hunting = false;
+    length = 0;
+    crc.reset();
+}
+
+void ModbusRTUFrameTracker::stop()
+{
+    active = false;
+}
+
+bool ModbusRTUFrameTracker::isActive()
+{
+    return active;
+}
+
+uint8_t ModbusRTUFrameTracker::getAddress()
+{
+    return address;
+}
+
+uint8_t ModbusRTUFrameTracker::getFunction()
+{
+    return function;
+}
+
+uint16_t ModbusRTUFrameTracker::getLength()
+{
+    return length;
+}
+
+uint8_t ModbusRTUFrameTracker::feed(uint8_t c)
+{
+    // crc covers all bytes but the last two, which are the candidate CRC
+    if (++length > 2)
+    {
+        crc.feed(delayed[0]);
+    }
+    delayed[0] = delayed[1];
+    delayed[1] = c;
+
+    if (length == 1)
+    {
+        address = c;
+        return RTU_FRAME_PENDING;
+    }
+    if (length == 2)
+    {
+        function = c;
+    }
+    if (length == 2 || requestLength == RTU_LENGTH_PENDING || responseLength == RTU_LENGTH_PENDING)
+    {
+        // Inferred again while a byte count is pending rather than kept per tracker, to save SRAM
+        uint8_t base[2];
+        uint8_t countAt[2];
+        inferLength(function, base, countAt);
+        if (length == 2)
+        {
+            requestLength = countAt[0] ? RTU_LENGTH_PENDING : base[0];
+            responseLength = countAt[1] ? RTU_LENGTH_PENDING : base[1];
+            hunting = !requestLength && !responseLength;
+            return RTU_FRAME_PENDING;
+        }
+        if (countAt[0] && length == countAt[0] + 1)
+        {
+            requestLength = base[0] + c;
+        }
+        if (countAt[1] && length == countAt[1] + 1)
+        {
+            responseLength = base[1] + c;
+        }
+    }
+
+    bool good = length >= 4 && crc.getCRCLowByte() == delayed[0] && crc.getCRCHighByte() == delayed[1];
+    if (good && length == requestLength)
+    {
+        return RTU_FRAME_REQUEST;
+    }
+    if (good && (length == responseLength || hunting))
+    {
+        return RTU_FRAME_RESPONSE;
+    }
+    if (length >= RTU_MAX_FRAME_LENGTH)
+    {
+        active = false;
+        return RTU_FRAME_LOST;
+    }
+    if (!hunting && length >= requestLength && length >= responseLength)
+    {
+        hunting = true; // Past all expected lengths
+        return RTU_FRAME_BAD_CRC;
+    }
+    return RTU_FRAME_PENDING;
+}
+
+// Section: Modbus RTU
+
+const ModbusTransport ModbusRTUSlave::RTU_TRANSPORT PROGMEM = {beginResponse, write, endResponse};
+
+void ModbusRTUSlave::transmit(uint8_t c)
+{
+    ((void (*)(ModbusRTUSlave *, uint8_t))pgm_read_ptr(&physical->transmit))(this, c);
+}
+
+void ModbusRTUSlave::beginResponse(ModbusSlave *slave)
+{
+    ModbusRTUSlave *s = static_cast<ModbusRTUSlave *>(slave);
+    ((void (*)(ModbusRTUSlave *))pgm_read_ptr(&s->physical->waitSilentInterval))(s);
+    s->crc.reset();
+    write(s, s->address + s->unit);
+}
+
+void ModbusRTUSlave::write(ModbusSlave *slave, uint8_t c)
+{
+    ModbusRTUSlave *s = static_cast<ModbusRTUSlave *>(slave);
+    s->transmit(c);
+    s->crc.feed(c);
+}
+
+void ModbusRTUSlave::endResponse(ModbusSlave *slave)
+{
+    ModbusRTUSlave *s = static_cast<ModbusRTUSlave *>(slave);
+    uint8_t crcL = s->crc.getCRCLowByte();
+    uint8_t crcH = s->crc.getCRCHighByte();
+    s->transmit(crcL);
+    s->transmit(crcH);
+}
+
+// Reverse the bytes from first up to, not including, last
+static void reverse(uint8_t *first, uint8_t *last)
+{
+    while (last - first > 1) // Never forms a pointer before first, which may be the start of history
+    {
+        uint8_t c = *first;
+        *first++ = *--last;
+        *last = c;
+    }
+}
+
+void ModbusRTUSlave::onReceive(uint8_t c, bool quiet)
+{
+    history[head++ & (sizeof(history) - 1)] = c;
+
+    if (boundary || (quiet && !frame.isActive()))
+    {
+        frame.start();
+        resync.stop();
+        boundary = false;
+    }
+    else if (quiet)
+    {
+        resync.start(); // Gap inside a frame: Follow both, the first one to see a good CRC wins
+    }
+
+    ModbusRTUFrameTracker *t = &frame;
+    uint8_t result = frame.isActive() ? frame.feed(c) : RTU_FRAME_LOST;
+    if (resync.isActive())
+    {
+        uint8_t r = resync.feed(c);
+        if (r == RTU_FRAME_REQUEST || r == RTU_FRAME_RESPONSE)
+        {
+            t = &resync;
+            result = r;
+        }
+    }
+
+    if (result == RTU_FRAME_REQUEST || result == RTU_FRAME_RESPONSE)
+    {
+        frame.stop();
+        resync.stop();
+        boundary = true;
+        countBusMessage();
+
+        uint16_t length = t->getLength();
+        uint8_t u = t->getAddress() - address; // Own address or virtual slave
+        if (result == RTU_FRAME_REQUEST && u < N_UNITS && length > sizeof(history))
+        {
+            // Only function codes we do not implement come that long (0x0F, 0x10, 0x17 with data). The function code
+            // alone gets the master its exception 0x01 rather than a timeout.
+            uint8_t function = t->getFunction();
+            obisValues->trace(TRACE_MODBUS_OVERSIZE, function);
+            executePdu(&function, 1, u);
+        }
+        else if (result == RTU_FRAME_REQUEST && u < N_UNITS)
+        {
+            // Frame is in the last length bytes received. Rotate it to the start of the history, to be executed in
+            // place rather than from a copy on the stack.
+            uint8_t *start = history + ((uint8_t)(head - length) & (sizeof(history) - 1));
+            reverse(history, start);
+            reverse(start, history + sizeof(history));
+            reverse(history, history + sizeof(history));
+            head = length;
+            executePdu(history + 1, length - 3, u);
+        }
+    }
+    else if (result == RTU_FRAME_BAD_CRC && (uint8_t)(t->getAddress() - address) < N_UNITS)
+    {
+        counters[MODBUS_BUS_CRC_ERRORS]++;
+        obisValues->trace(TRACE_MODBUS_BAD_CRC, t->getAddress());
+    }
+}
+
+// END
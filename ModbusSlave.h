@@ -0,0 +1,202 @@
+/*
+ * Modbus slave, independent of transport. One instance per set of ObisValues, no shared state.
+ */
+
+#ifndef __MODBUSSLAVE_H
+#define __MODBUSSLAVE_H
+
+#include <Arduino.h>
+#include "ModbusCRC.h"
+#include "ObisValues.h"
+
+#define RS_485_READ_HOLDING_REGISTER ((uint8_t)0x03)      // Function Code 03, same map as 04
+#define RS_485_READ_INPUT_REGISTER ((uint8_t)0x04)        // Function Code 04
+#define RS_485_DIAGNOSTICS ((uint8_t)0x08)                // Function Code 08, serial line counters
+#define RS_485_ENCAPSULATED_INTERFACE ((uint8_t)0x2B)     // Function Code 2B
+#define RS_485_READ_DEVICE_IDENTIFICATION ((uint8_t)0x0E) // MEI Type 0E, with Function Code 2B
+
+// Diagnostics (08) sub-functions
+#define MODBUS_DIAG_RETURN_QUERY_DATA 0x00
+#define MODBUS_DIAG_CLEAR_COUNTERS 0x0A
+#define MODBUS_DIAG_BUS_MESSAGE_COUNT 0x0B // First counter, the others follow in order:
+
+// Counters as returned by Diagnostics (08), sub-function MODBUS_DIAG_BUS_MESSAGE_COUNT + n. 16bit, wrap around.
+#define MODBUS_BUS_MESSAGES 0    // Messages seen on the bus, to any address
+#define MODBUS_BUS_CRC_ERRORS 1  // Messages to us dropped for bad CRC
+#define MODBUS_EXCEPTIONS 2      // Exception responses sent
+#define MODBUS_SERVER_MESSAGES 3 // Messages to us processed
+#define N_MODBUS_COUNTERS 4
+
+// Read Device Identification (2B / 0E), basic objects. MajorMinorRevision is FIRMWARE_VERSION.
+#ifndef DEVICE_VENDOR_NAME
+#define DEVICE_VENDOR_NAME "ATtiny-PinKeepAlive"
+#endif
+#ifndef DEVICE_PRODUCT_CODE
+#define DEVICE_PRODUCT_CODE "INFO-DSS SML to Modbus"
+#endif
+
+class ModbusSlave;
+
+/*
+ * Transport: framing around the response PDU. One table of functions per transport, in flash (PROGMEM), read with
+ * pgm_read_ptr(). Unlike the vtables of virtual functions, it takes no SRAM.
+ */
+struct ModbusTransport
+{
+    void (*beginResponse)(ModbusSlave *slave);
+    void (*write)(ModbusSlave *slave, uint8_t c);
+    void (*endResponse)(ModbusSlave *slave);
+};
+
+class ModbusSlave
+{
+public:
+    ModbusSlave(ObisValues *obisValues_, uint8_t address_, const ModbusTransport *transport_)
+        : obisValues(obisValues_), address(address_), transport(transport_)
+    {
+    }
+
+    uint8_t getAddress();
+
+    /*
+     * Count a message seen on the bus, see MODBUS_BUS_MESSAGES.
+     */
+    void countBusMessage();
+
+    /*
+     * Execute request PDU (function code and data) for unit (0: own address, 1, ...: virtual slaves), send the
+     * response PDU.
+     */
+    void executePdu(const uint8_t *pdu, uint8_t length, uint8_t unit_ = 0);
+
+protected:
+    ObisValues *obisValues;
+    uint8_t address;
+    uint8_t unit = 0; // Unit of the request being executed
+    uint16_t counters[N_MODBUS_COUNTERS] = {0};
+
+    // Transport: framing around the response PDU
+    void beginResponse();
+    void write(uint8_t c);
+    void endResponse();
+
+private:
+    const ModbusTransport *transport;
+
+    uint8_t executeReadRegistersPdu(const uint8_t *pdu, uint8_t length);
+    uint8_t executeDiagnosticsPdu(const uint8_t *pdu, uint8_t length);
+    uint8_t executeReadDeviceIdentificationPdu(const uint8_t *pdu, uint8_t length);
+};
+
+/*
+ * Virtual slaves: Further unit IDs following the slave's own address, i.e. address + 1, + 2, ... Each one serves a
+ * window of the register map at register addresses 0, 1, ..., for function codes 03 and 04. Windows must not cross a
+ * page of the map. Diagnostics and device identification are shared. Example, power only at address + 1:
+ *   -DVIRTUAL_SLAVE_WINDOWS="{LIVE_REGISTERS_BASE + 6, 2}"
+ */
+#ifndef VIRTUAL_SLAVE_WINDOWS
+#define VIRTUAL_SLAVE_WINDOWS
+#endif
+
+static constexpr RegisterBlock UNIT_WINDOWS[] = {{0, 0}, VIRTUAL_SLAVE_WINDOWS}; // Unit 0: the full register map
+#define N_UNITS (sizeof(UNIT_WINDOWS) / sizeof(UNIT_WINDOWS[0]))
+
+constexpr bool isValidUnitWindow(uint8_t u = 1)
+{
+    return u >= N_UNITS ||
+           (UNIT_WINDOWS[u].count > 0 && (UNIT_WINDOWS[u].address & 0xFF) + UNIT_WINDOWS[u].count <= registerPageCount(UNIT_WINDOWS[u].address >> 8) &&
+            isValidUnitWindow(u + 1));
+}
+static_assert(isValidUnitWindow(), "Virtual slave windows must lie within one page of the register map");
+
+// Frame tracker results
+#define RTU_FRAME_PENDING 0  // Frame continues
+#define RTU_FRAME_REQUEST 1  // Complete, good CRC at the request length for its function code
+#define RTU_FRAME_RESPONSE 2 // Complete, good CRC at the response length, or at any length for unknown function codes
+#define RTU_FRAME_BAD_CRC 3  // No good CRC at the expected lengths. Frame continues, to be found by CRC only
+#define RTU_FRAME_LOST 4     // No good CRC within the maximum frame length. Tracker stops.
+
+#define RTU_MAX_FRAME_LENGTH 256
+
+/*
+ * Follows one frame on the bus, to any address, to find its end without waiting for the silent interval.
+ * The length of requests and responses is inferred from the function code, including byte counts where present.
+ * As a byte on its own does not tell whether it starts a request or a response, both lengths are tried. The CRC decides.
+ */
+class ModbusRTUFrameTracker
+{
+public:
+    // Next byte starts a frame
+    void start();
+    void stop();
+    bool isActive();
+
+    uint8_t feed(uint8_t c);
+
+    uint8_t getAddress();
+    uint8_t getFunction();
+    uint16_t getLength();
+
+private:
+    bool active = false;
+    bool hunting;
+    uint8_t address;
+    uint8_t function;
+    uint16_t length;
+    uint16_t requestLength;  // 0: none, RTU_LENGTH_PENDING: waiting for byte count
+    uint16_t responseLength; // Same
+    uint8_t delayed[2];      // Last two bytes, not yet fed into crc
+    ModbusCRC crc = ModbusCRC();
+};
+
+class ModbusRTUSlave;
+
+// Physical layer of a Modbus RTU slave, in flash (PROGMEM) as ModbusTransport
+struct ModbusRTUPhysical
+{
+    void (*waitSilentInterval)(ModbusRTUSlave *slave);
+    void (*transmit)(ModbusRTUSlave *slave, uint8_t c);
+};
+
+/*
+ * Modbus RTU framing: Frame tracking, address and CRC.
+ *
+ * All frames on the bus are followed, so frame boundaries are known without waiting for a silent interval: a request
+ * to us right behind a response of another slave is not missed. A silent interval inside a frame (slow slaves, timing
+ * jitter) starts a second tracker, the first one to see a good CRC wins. Assumes that the transceiver does not echo
+ * our own transmissions.
+ */
+class ModbusRTUSlave : public ModbusSlave
+{
+public:
+    ModbusRTUSlave(ObisValues *obisValues_, uint8_t address_, const ModbusRTUPhysical *physical_)
+        : ModbusSlave(obisValues_, address_, &RTU_TRANSPORT), physical(physical_)
+    {
+    }
+
+    /*
+     * Feed received character. Pass quiet = true if it was preceded by a silent interval.
+     */
+    void onReceive(uint8_t c, bool quiet);
+
+private:
+    static const ModbusTransport RTU_TRANSPORT;
+    static void beginResponse(ModbusSlave *slave);
+    static void write(ModbusSlave *slave, uint8_t c);
+    static void endResponse(ModbusSlave *slave);
+
+    const ModbusRTUPhysical *physical;
+    void transmit(uint8_t c);
+
+    // Last bytes received. We only serve short requests, with four parameter bytes at most, and 2 CRC bytes.
+    uint8_t history[16];
+    uint8_t head = 0;
+
+    ModbusRTUFrameTracker frame;  // Started at the end of the previous frame or after a silent interval
+    ModbusRTUFrameTracker resync; // Started after a silent interval inside a frame
+    bool boundary = false;        // Previous frame complete, next byte starts a new one
+
+    ModbusCRC crc = ModbusCRC();
+};
+
+#endif // __MODBUSSLAVE_H
@@ -0,0 +1,707 @@
+/*
+ * Modbus TCP gateway for Linux hosts, e.g. with USB IR heads attached to one or more meters.
+ *
+ * Reads SML from ttys, ptys, pipes or files through TinySMLDecoder/ObisValues and serves the very same Input Register
+ * map as the RS-485 Modbus RTU slave, to any number of concurrent Modbus TCP clients. Meter n is served under unit
+ * ID (first unit + n).
+ *
+ * Each meter has its own decoder, ObisValues and ModbusSlave instance. Meters are decoded in parallel on a pool of
+ * worker threads, each worker owning its meters exclusively. After decoding, a worker publishes a snapshot of the
+ * meter's ObisValues, which the single-threaded epoll loop serving Modbus TCP picks up on the next request.
+ * Responses are assembled in place in each connection's transmit buffer and sent from there.
+ * Send SIGUSR1 to dump per-connection statistics to stderr.
+ * With -l, every committed frame is logged with its timestamp to an ObisTimeSeries file per meter, <prefix>-<unit>.ots
+ * On SIGINT or SIGTERM, the workers stop and close those files, with the rows still buffered, index and footer.
+ *
+ * g++ -O2 -I . -D__TEST__=1 -D__HOST_CRC__=1 -pthread -o modbus-tcp-gateway ModbusTCPGateway.cpp TinySMLDecoder.cpp ModbusCRC.cpp ModbusCRCHost.cpp ModbusSlave.cpp ObisValues.cpp ObisTimeSeries.cpp
+ * ./modbus-tcp-gateway [-p 502] [-u 9] [-b 9600] [-t threads] [-l prefix] /dev/ttyUSB0 [/dev/ttyUSB1 ...]
+ * Baud rates: 1200, 2400, 4800, 9600, 19200, 38400, 57600 or 115200
+ */
+
+#include <stdio.h>
+#include "TinySMLDecoder.h"
+#include "ExposeToModbus.h"
+#include "ObisTimeSeries.h"
+
+#if __TEST__
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#define MBAP_HEADER_LENGTH 7
+#define MAX_PDU_LENGTH 253
+#define MAX_ADU_LENGTH (MBAP_HEADER_LENGTH - 1 + 1 + MAX_PDU_LENGTH)
+#define RX_BUFFER_SIZE (16 * MAX_ADU_LENGTH)
+#define TX_BUFFER_SIZE (16 * MAX_ADU_LENGTH)
+#define MAX_EVENTS 64
+
+enum HandlerKind
+{
+    LISTENER,
+    SIGNALS,
+    CLIENT
+};
+
+// Modbus TCP: Response PDU is written straight into the connection's transmit buffer
+class TCPModbusSlave : public ModbusSlave
+{
+public:
+    TCPModbusSlave(ObisValues *obisValues_, uint8_t address_)
+        : ModbusSlave(obisValues_, address_, &TCP_TRANSPORT)
+    {
+    }
+
+    uint8_t *out;
+    uint8_t length;
+
+private:
+    static const ModbusTransport TCP_TRANSPORT;
+    static void beginResponse(ModbusSlave *slave)
+    {
+        static_cast<TCPModbusSlave *>(slave)->length = 0;
+    }
+    static void write(ModbusSlave *slave, uint8_t c)
+    {
+        TCPModbusSlave *s = static_cast<TCPModbusSlave *>(slave);
+        s->out[s->length++] = c;
+    }
+    static void endResponse(ModbusSlave *)
+    {
+    }
+};
+const ModbusTransport TCPModbusSlave::TCP_TRANSPORT = {beginResponse, write, endResponse};
+
+struct Meter
+{
+    Meter(uint8_t unit)
+        : decoder(&values), slave(&served, unit)
+    {
+    }
+
+    const char *path;
+    int fd;
+
+    // Owned by the worker thread
+    ObisValues values;
+    TinySMLDecoder decoder;
+    std::atomic<uint64_t> bytes{0};
+    ObisTimeSeriesWriter series;
+    bool logging = false;
+    uint16_t frames = 0;
+
+    // Handed over from worker to Modbus TCP
+    std::mutex lock;
+    ObisValues published;
+    std::atomic<uint32_t> generation{0};
+
+    // Owned by the Modbus TCP thread
+    ObisValues served;
+    uint32_t servedGeneration = 0;
+    TCPModbusSlave slave;
+};
+
+struct Connection
+{
+    HandlerKind kind;
+    int fd;
+    uint32_t events; // Currently registered with epoll
+
+    uint8_t rx[RX_BUFFER_SIZE];
+    uint32_t rxLength;
+    uint8_t tx[TX_BUFFER_SIZE];
+    uint32_t txHead; // Next byte to send
+    uint32_t txTail; // Next free byte
+
+    // Statistics
+    Connection *next;
+    char peer[64];
+    struct timespec since;
+    uint64_t requests;
+    uint64_t exceptions;
+    uint64_t bytesIn;
+    uint64_t bytesOut;
+    uint64_t stalls; // Transmit buffer full, had to wait for EPOLLOUT
+};
+
+static Meter *units[256];
+static std::vector<Meter *> meters;
+static int epfd;
+static int stopfd; // Readable once the workers are to stop
+static Connection *connections = NULL;
+
+static double secondsSince(const struct timespec *t0)
+{
+    struct timespec t1;
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    return (t1.tv_sec - t0->tv_sec) + (t1.tv_nsec - t0->tv_nsec) / 1e9;
+}
+
+static void printStatistics(Connection *c, const char *what)
+{
+    double age = secondsSince(&c->since);
+    fprintf(stderr, "%-6s fd=%-4d %-22s %9.1fs %10llu req %8llu exc %12llu in %12llu out %6llu stalls %10.0f req/s\n",
+            what, c->fd, c->peer, age,
+            (unsigned long long)c->requests, (unsigned long long)c->exceptions,
+            (unsigned long long)c->bytesIn, (unsigned long long)c->bytesOut, (unsigned long long)c->stalls,
+            age > 0 ? c->requests / age : 0.0);
+}
+
+static void dumpStatistics()
+{
+    for (Meter *m : meters)
+    {
+        fprintf(stderr, "unit %-3d %-24s %12llu SML bytes %8u updates\n", m->slave.getAddress(), m->path,
+                (unsigned long long)m->bytes.load(), m->generation.load());
+    }
+    for (Connection *c = connections; c; c = c->next)
+    {
+        printStatistics(c, "conn");
+    }
+}
+
+static void setEvents(Connection *c, uint32_t events)
+{
+    if (c->events != events)
+    {
+        struct epoll_event ev;
+        ev.events = events;
+        ev.data.ptr = c;
+        epoll_ctl(epfd, EPOLL_CTL_MOD, c->fd, &ev);
+        c->events = events;
+    }
+}
+
+static void closeConnection(Connection *c)
+{
+    printStatistics(c, "close");
+    epoll_ctl(epfd, EPOLL_CTL_DEL, c->fd, NULL);
+    close(c->fd);
+    for (Connection **p = &connections; *p; p = &(*p)->next)
+    {
+        if (*p == c)
+        {
+            *p = c->next;
+            break;
+        }
+    }
+    delete c;
+}
+
+/*
+ * Execute one request PDU, write response PDU to rsp. Return response PDU length.
+ */
+static uint8_t executePdu(uint8_t unit, const uint8_t *req, uint16_t reqLength, uint8_t *rsp)
+{
+    Meter *m = units[unit];
+    if (!m)
+    {
+        rsp[0] = req[0] | 0x80;
+        rsp[1] = 0x0B; // Gateway Target Device Failed to Respond
+        return 2;
+    }
+    uint32_t generation = m->generation.load(std::memory_order_acquire);
+    if (generation != m->servedGeneration)
+    {
+        std::lock_guard<std::mutex> guard(m->lock);
+        m->served = m->published;
+        m->servedGeneration = m->generation.load(std::memory_order_relaxed);
+    }
+    m->slave.countBusMessage();
+    m->slave.out = rsp;
+    m->slave.executePdu(req, reqLength > 0xFF ? 0xFF : (uint8_t)reqLength);
+    return m->slave.length;
+}
+
+/*
+ * Process all complete requests in the receive buffer, as long as there's space for the responses.
+ * Return false if the connection must be closed.
+ */
+static bool processRequests(Connection *c)
+{
+    uint32_t p = 0;
+    while (c->rxLength - p >= MBAP_HEADER_LENGTH + 1)
+    {
+        const uint8_t *req = c->rx + p;
+        uint16_t protocol = (req[2] << 8) | req[3];
+        uint16_t length = (req[4] << 8) | req[5]; // Unit identifier and PDU
+        if (protocol != 0 || length < 2 || length > 1 + MAX_PDU_LENGTH)
+        {
+            return false;
+        }
+        if (c->rxLength - p < 6u + length)
+        {
+            break; // Incomplete
+        }
+        if (TX_BUFFER_SIZE - c->txTail < MAX_ADU_LENGTH)
+        {
+            if (c->txHead == c->txTail)
+            {
+                c->txHead = c->txTail = 0;
+            }
+            else
+            {
+                c->stalls++;
+                break; // Wait for EPOLLOUT
+            }
+        }
+
+        uint8_t *rsp = c->tx + c->txTail;
+        uint8_t n = executePdu(req[6], req + MBAP_HEADER_LENGTH, length - 1, rsp + MBAP_HEADER_LENGTH);
+        rsp[0] = req[0]; // Transaction identifier
+        rsp[1] = req[1];
+        rsp[2] = 0x00; // Protocol identifier
+        rsp[3] = 0x00;
+        rsp[4] = (uint8_t)((n + 1) >> 8);
+        rsp[5] = (uint8_t)(n + 1);
+        rsp[6] = req[6]; // Unit identifier
+        c->txTail += MBAP_HEADER_LENGTH + n;
+        c->requests++;
+        if (rsp[MBAP_HEADER_LENGTH] & 0x80)
+        {
+            c->exceptions++;
+        }
+        p += 6 + length;
+    }
+    if (p)
+    {
+        c->rxLength -= p;
+        memmove(c->rx, c->rx + p, c->rxLength);
+    }
+    return true;
+}
+
+static bool flush(Connection *c)
+{
+    while (c->txHead < c->txTail)
+    {
+        ssize_t n = send(c->fd, c->tx + c->txHead, c->txTail - c->txHead, MSG_NOSIGNAL);
+        if (n < 0)
+        {
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+        c->txHead += n;
+        c->bytesOut += n;
+    }
+    c->txHead = c->txTail = 0;
+    return true;
+}
+
+static void onClient(Connection *c, uint32_t events)
+{
+    if (events & (EPOLLERR | EPOLLHUP))
+    {
+        closeConnection(c);
+        return;
+    }
+    if (events & EPOLLIN)
+    {
+        ssize_t n = recv(c->fd, c->rx + c->rxLength, RX_BUFFER_SIZE - c->rxLength, 0);
+        if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK))
+        {
+            closeConnection(c);
+            return;
+        }
+        if (n > 0)
+        {
+            c->rxLength += n;
+            c->bytesIn += n;
+        }
+    }
+    if (!processRequests(c) || !flush(c))
+    {
+        closeConnection(c);
+        return;
+    }
+    if (c->txHead == c->txTail)
+    {
+        // Transmit buffer drained, there may be more requests waiting
+        if (!processRequests(c) || !flush(c))
+        {
+            closeConnection(c);
+            return;
+        }
+    }
+    uint32_t want = 0;
+    if (c->rxLength < RX_BUFFER_SIZE)
+    {
+        want |= EPOLLIN;
+    }
+    if (c->txHead < c->txTail)
+    {
+        want |= EPOLLOUT;
+    }
+    setEvents(c, want);
+}
+
+static void onListener(Connection *l)
+{
+    for (;;)
+    {
+        struct sockaddr_in6 addr;
+        socklen_t addrLength = sizeof(addr);
+        int fd = accept4(l->fd, (struct sockaddr *)&addr, &addrLength, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0)
+        {
+            return;
+        }
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        Connection *c = new Connection();
+        c->kind = CLIENT;
+        c->fd = fd;
+        c->events = EPOLLIN;
+        clock_gettime(CLOCK_MONOTONIC, &c->since);
+        char host[INET6_ADDRSTRLEN];
+        inet_ntop(AF_INET6, &addr.sin6_addr, host, sizeof(host));
+        snprintf(c->peer, sizeof(c->peer), "[%s]:%d", host, ntohs(addr.sin6_port));
+        c->next = connections;
+        connections = c;
+
+        struct epoll_event ev;
+        ev.events = c->events;
+        ev.data.ptr = c;
+        epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+    }
+}
+
+static void logFrame(Meter *m)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_REALTIME, &t);
+    int64_t values[N_KNOWN_OBIS_CODES];
+    for (uint8_t k = 0; k < N_KNOWN_OBIS_CODES; k++)
+    {
+        values[k] = (int32_t)(((uint32_t)m->values.getLiveRegister(2 + 2 * k) << 16) | m->values.getLiveRegister(3 + 2 * k));
+    }
+    m->series.append((int64_t)t.tv_sec * 1000 + t.tv_nsec / 1000000, values);
+    m->frames = m->values.getDiagnosticRegister(DIAG_FRAMES);
+}
+
+// Decode input, then publish a snapshot. Return false when input has been closed.
+static bool onSMLInput(Meter *m)
+{
+    uint8_t buffer[4096];
+    ssize_t n = read(m->fd, buffer, sizeof(buffer));
+    if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK))
+    {
+        // EOF, or EIO on a pty without writer: keep serving the last values
+        fprintf(stderr, "%s closed after %llu bytes\n", m->path, (unsigned long long)m->bytes.load());
+        if (m->logging)
+        {
+            m->series.close();
+            m->logging = false;
+        }
+        close(m->fd);
+        return false;
+    }
+    if (n > 0)
+    {
+        struct timespec t;
+        clock_gettime(CLOCK_MONOTONIC, &t);
+        m->values.tick((uint32_t)(t.tv_sec * 1000 + t.tv_nsec / 1000000));
+        for (ssize_t k = 0; k < n; k++)
+        {
+            m->decoder.feed(buffer[k]);
+            if (m->logging && m->values.getDiagnosticRegister(DIAG_FRAMES) != m->frames)
+            {
+                logFrame(m);
+            }
+        }
+        m->bytes += n;
+        std::lock_guard<std::mutex> guard(m->lock);
+        m->published = m->values;
+        m->generation.fetch_add(1, std::memory_order_release);
+    }
+    return true;
+}
+
+// B0 for baud rates we do not support
+static speed_t toSpeed(long baud)
+{
+    switch (baud)
+    {
+    case 1200:
+        return B1200;
+    case 2400:
+        return B2400;
+    case 4800:
+        return B4800;
+    case 9600:
+        return B9600;
+    case 19200:
+        return B19200;
+    case 38400:
+        return B38400;
+    case 57600:
+        return B57600;
+    case 115200:
+        return B115200;
+    default:
+        return B0;
+    }
+}
+
+static int openSMLInput(const char *path, long baud)
+{
+    int fd = open(path, O_RDONLY | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return fd;
+    }
+    if (isatty(fd))
+    {
+        struct termios tio;
+        if (tcgetattr(fd, &tio) < 0)
+        {
+            close(fd);
+            return -1;
+        }
+        cfmakeraw(&tio);
+        cfsetispeed(&tio, toSpeed(baud));
+        cfsetospeed(&tio, toSpeed(baud));
+        tio.c_cflag |= CLOCAL | CREAD;
+        if (tcsetattr(fd, TCSANOW, &tio) < 0)
+        {
+            close(fd);
+            return -1;
+        }
+    }
+    return fd;
+}
+
+static void addHandler(Connection *h, HandlerKind kind, int fd)
+{
+    h->kind = kind;
+    h->fd = fd;
+    h->events = EPOLLIN;
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = h;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+// Worker thread, owns its meters exclusively. Runs until all inputs are closed, or until stopped.
+static void worker(std::vector<Meter *> own)
+{
+    int wfd = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event stop;
+    stop.events = EPOLLIN;
+    stop.data.ptr = NULL;
+    epoll_ctl(wfd, EPOLL_CTL_ADD, stopfd, &stop);
+    int open = 0;
+    for (Meter *m : own)
+    {
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.ptr = m;
+        if (epoll_ctl(wfd, EPOLL_CTL_ADD, m->fd, &ev) == 0)
+        {
+            open++;
+        }
+        else if (errno == EPERM)
+        {
+            // Regular file, cannot be polled. Decode it right away.
+            while (onSMLInput(m))
+                ;
+        }
+    }
+    while (open > 0)
+    {
+        struct epoll_event events[MAX_EVENTS];
+        int n = epoll_wait(wfd, events, MAX_EVENTS, -1);
+        for (int k = 0; k < n; k++)
+        {
+            Meter *m = (Meter *)events[k].data.ptr;
+            if (!m)
+            {
+                open = 0;
+                break;
+            }
+            if (!onSMLInput(m))
+            {
+                epoll_ctl(wfd, EPOLL_CTL_DEL, m->fd, NULL);
+                open--;
+            }
+        }
+    }
+    // Flush what is buffered, write index and footer
+    for (Meter *m : own)
+    {
+        if (m->logging)
+        {
+            m->series.close();
+            m->logging = false;
+        }
+    }
+    close(wfd);
+}
+
+int main(int argc, char *argv[])
+{
+    int port = 502;
+    long baud = 9600;
+    int firstUnit = RS_485_ADDRESS;
+    unsigned threads = std::thread::hardware_concurrency();
+    int opt;
+    const char *logPrefix = NULL;
+    while ((opt = getopt(argc, argv, "p:u:b:t:l:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'p':
+            port = atoi(optarg);
+            break;
+        case 'u':
+            firstUnit = atoi(optarg);
+            break;
+        case 'b':
+            baud = atol(optarg);
+            break;
+        case 't':
+            threads = atoi(optarg);
+            break;
+        case 'l':
+            logPrefix = optarg;
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-p port] [-u unit] [-b baud] [-t threads] [-l prefix] sml-input ...\n", argv[0]);
+            return 1;
+        }
+    }
+    if (optind >= argc || firstUnit + (argc - optind) > 256 || toSpeed(baud) == B0)
+    {
+        fprintf(stderr, "Usage: %s [-p port] [-u unit] [-b baud] [-t threads] [-l prefix] sml-input ...\n", argv[0]);
+        return 1;
+    }
+
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+
+    static Connection listener, signals;
+    int lfd = socket(AF_INET6, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    int one = 1;
+    setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    struct sockaddr_in6 addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin6_family = AF_INET6;
+    addr.sin6_addr = in6addr_any;
+    addr.sin6_port = htons(port);
+    if (bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(lfd, 128) < 0)
+    {
+        perror("bind");
+        return 1;
+    }
+    addHandler(&listener, LISTENER, lfd);
+
+    for (int k = optind; k < argc; k++)
+    {
+        Meter *m = new Meter(firstUnit + (k - optind));
+        m->path = argv[k];
+        m->fd = openSMLInput(argv[k], baud);
+        if (m->fd < 0)
+        {
+            perror(argv[k]);
+            return 1;
+        }
+        if (logPrefix)
+        {
+            char path[256];
+            snprintf(path, sizeof(path), "%s-%d.ots", logPrefix, m->slave.getAddress());
+            m->logging = m->series.open(path, N_KNOWN_OBIS_CODES);
+            if (!m->logging)
+            {
+                perror(path);
+                return 1;
+            }
+        }
+        units[m->slave.getAddress()] = m;
+        meters.push_back(m);
+    }
+
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGUSR1);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    sigprocmask(SIG_BLOCK, &mask, NULL);
+    addHandler(&signals, SIGNALS, signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC));
+
+    // Signals are blocked in all threads, start workers only now
+    stopfd = eventfd(0, EFD_CLOEXEC);
+    if (threads == 0 || threads > meters.size())
+    {
+        threads = meters.size();
+    }
+    std::vector<std::vector<Meter *>> partitions(threads);
+    std::vector<std::thread> workers;
+    for (size_t k = 0; k < meters.size(); k++)
+    {
+        partitions[k % threads].push_back(meters[k]);
+    }
+    for (unsigned t = 0; t < threads; t++)
+    {
+        workers.emplace_back(worker, partitions[t]);
+    }
+
+    fprintf(stderr, "Serving %zu meter(s), unit %d ff. on port %d, %u worker thread(s)\n", meters.size(), firstUnit, port, threads);
+    for (;;)
+    {
+        struct epoll_event events[MAX_EVENTS];
+        int n = epoll_wait(epfd, events, MAX_EVENTS, -1);
+        for (int k = 0; k < n; k++)
+        {
+            Connection *c = (Connection *)events[k].data.ptr;
+            switch (c->kind)
+            {
+            case LISTENER:
+                onListener(c);
+                break;
+            case SIGNALS:
+            {
+                struct signalfd_siginfo si;
+                if (read(c->fd, &si, sizeof(si)) == sizeof(si))
+                {
+                    dumpStatistics();
+                    if (si.ssi_signo != SIGUSR1)
+                    {
+                        // Not read by anyone, so it stays readable for every worker
+                        const uint64_t one = 1;
+                        if (write(stopfd, &one, sizeof(one)) != sizeof(one))
+                        {
+                            perror("eventfd");
+                        }
+                        for (std::thread &w : workers)
+                        {
+                            w.join();
+                        }
+                        return 0;
+                    }
+                }
+                break;
+            }
+            case CLIENT:
+                onClient(c, events[k].events);
+                break;
+            }
+        }
+    }
+}
+#endif
+
+// END
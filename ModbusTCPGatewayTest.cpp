@@ -0,0 +1,359 @@
+/*
+ * Local test and load generator for the Modbus TCP gateway.
+ *
+ * Decodes the SML capture locally for the expected register values, then starts the gateway on a pty, writes the
+ * capture into the pty and hammers the gateway from a number of loopback clients. Every response is verified.
+ * A baud rate the gateway does not support must be rejected at startup.
+ *
+ * g++ -O2 -I . -D__TEST__=1 -pthread -o test-gateway ModbusTCPGatewayTest.cpp TinySMLDecoder.cpp ModbusCRC.cpp ObisValues.cpp
+ * ./test-gateway ./modbus-tcp-gateway testdata/sml.bin [clients] [seconds] [pipeline depth]
+ */
+
+#include <stdio.h>
+#include "TinySMLDecoder.h"
+#include "ExposeToModbus.h"
+
+#if __TEST__
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#define TEST_PORT 15020
+
+static uint16_t expected[64];
+static uint8_t nExpected;
+static int seconds = 3;
+static int depth = 8;
+static std::atomic<unsigned long long> totalRequests(0);
+static std::atomic<unsigned long long> totalErrors(0);
+
+static int connectGateway()
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(TEST_PORT);
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return fd;
+}
+
+static bool readFully(int fd, uint8_t *buf, size_t len)
+{
+    while (len)
+    {
+        ssize_t n = recv(fd, buf, len, 0);
+        if (n <= 0)
+        {
+            return false;
+        }
+        buf += n;
+        len -= n;
+    }
+    return true;
+}
+
+static void request(uint8_t *req, uint16_t transaction, uint8_t unit, uint8_t function, uint16_t address, uint16_t count)
+{
+    uint8_t r[] = {(uint8_t)(transaction >> 8), (uint8_t)transaction, 0, 0, 0, 6, unit, function,
+                   (uint8_t)(address >> 8), (uint8_t)address, (uint8_t)(count >> 8), (uint8_t)count};
+    memcpy(req, r, sizeof(r));
+}
+
+/*
+ * Read count registers from LIVE_REGISTERS_BASE + offset. Return true if response matches expectations.
+ */
+static bool check(const uint8_t *rsp, uint16_t transaction, uint8_t offset, uint8_t count, uint8_t function = RS_485_READ_INPUT_REGISTER)
+{
+    if (rsp[0] != (uint8_t)(transaction >> 8) || rsp[1] != (uint8_t)transaction || rsp[7] != function || rsp[8] != count * 2)
+    {
+        return false;
+    }
+    for (uint8_t k = 0; k < count; k++)
+    {
+        if (((rsp[9 + 2 * k] << 8) | rsp[10 + 2 * k]) != expected[offset + k])
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void client(int id)
+{
+    int fd = connectGateway();
+    if (fd < 0)
+    {
+        totalErrors++;
+        return;
+    }
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    uint16_t transaction = id << 12;
+    unsigned long long requests = 0;
+    std::vector<uint8_t> out(12 * depth);
+    std::vector<uint8_t> in(9 + 2 * nExpected);
+    for (;;)
+    {
+        for (int k = 0; k < depth; k++)
+        {
+            request(&out[12 * k], transaction + k, RS_485_ADDRESS, RS_485_READ_INPUT_REGISTER, LIVE_REGISTERS_BASE, nExpected);
+        }
+        send(fd, out.data(), out.size(), MSG_NOSIGNAL);
+        for (int k = 0; k < depth; k++)
+        {
+            if (!readFully(fd, in.data(), in.size()) || !check(in.data(), transaction + k, 0, nExpected))
+            {
+                totalErrors++;
+                close(fd);
+                return;
+            }
+        }
+        transaction += depth;
+        requests += depth;
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        if (t1.tv_sec - t0.tv_sec >= seconds)
+        {
+            break;
+        }
+    }
+    close(fd);
+    totalRequests += requests;
+}
+
+/*
+ * Expect an exception response to a single request.
+ */
+static bool checkException(int fd, uint8_t unit, uint8_t function, uint16_t address, uint16_t count, uint8_t exceptionCode)
+{
+    uint8_t req[12];
+    uint8_t rsp[9];
+    request(req, 0x4711, unit, function, address, count);
+    send(fd, req, sizeof(req), MSG_NOSIGNAL);
+    return readFully(fd, rsp, sizeof(rsp)) && rsp[7] == (function | 0x80) && rsp[8] == exceptionCode;
+}
+
+/*
+ * Send a request PDU, receive the response PDU. Return response PDU length, 0 on error.
+ */
+static uint16_t exchange(int fd, const uint8_t *pdu, uint8_t length, uint8_t *rsp)
+{
+    uint8_t req[7 + 256] = {0x47, 0x11, 0, 0, 0, (uint8_t)(1 + length), RS_485_ADDRESS};
+    memcpy(req + 7, pdu, length);
+    send(fd, req, 7 + length, MSG_NOSIGNAL);
+    uint8_t header[7];
+    if (!readFully(fd, header, sizeof(header)) || header[5] < 2)
+    {
+        return 0;
+    }
+    return readFully(fd, rsp, header[5] - 1) ? header[5] - 1 : 0;
+}
+
+/*
+ * Read Holding Registers, Diagnostics and Read Device Identification
+ */
+static bool checkFunctionCodes(int fd)
+{
+    uint8_t rsp[256];
+    bool ok = true;
+
+    uint8_t readHolding[] = {RS_485_READ_HOLDING_REGISTER, LIVE_REGISTERS_BASE >> 8, 0, 0, nExpected};
+    ok = ok && exchange(fd, readHolding, sizeof(readHolding), rsp) == 2u + 2 * nExpected && rsp[0] == RS_485_READ_HOLDING_REGISTER;
+    for (uint8_t k = 0; ok && k < nExpected; k++)
+    {
+        ok = ((rsp[2 + 2 * k] << 8) | rsp[3 + 2 * k]) == expected[k];
+    }
+
+    uint8_t echo[] = {RS_485_DIAGNOSTICS, 0, MODBUS_DIAG_RETURN_QUERY_DATA, 0x12, 0x34};
+    ok = ok && exchange(fd, echo, sizeof(echo), rsp) == sizeof(echo) && memcmp(rsp, echo, sizeof(echo)) == 0;
+    uint8_t serverMessages[] = {RS_485_DIAGNOSTICS, 0, MODBUS_DIAG_BUS_MESSAGE_COUNT + MODBUS_SERVER_MESSAGES, 0, 0};
+    ok = ok && exchange(fd, serverMessages, sizeof(serverMessages), rsp) == 5 && ((rsp[3] << 8) | rsp[4]) > 2;
+    uint8_t clear[] = {RS_485_DIAGNOSTICS, 0, MODBUS_DIAG_CLEAR_COUNTERS, 0, 0};
+    ok = ok && exchange(fd, clear, sizeof(clear), rsp) == 5;
+    ok = ok && exchange(fd, serverMessages, sizeof(serverMessages), rsp) == 5 && ((rsp[3] << 8) | rsp[4]) == 1;
+    ok = ok && checkException(fd, RS_485_ADDRESS, RS_485_DIAGNOSTICS, 0x0001, 0, 0x01); // Restart not supported
+    uint8_t exceptions[] = {RS_485_DIAGNOSTICS, 0, MODBUS_DIAG_BUS_MESSAGE_COUNT + MODBUS_EXCEPTIONS, 0, 0};
+    ok = ok && exchange(fd, exceptions, sizeof(exceptions), rsp) == 5 && ((rsp[3] << 8) | rsp[4]) == 1;
+
+    // Basic device identification, stream access from object 1: ProductCode, MajorMinorRevision
+    uint8_t identification[] = {RS_485_ENCAPSULATED_INTERFACE, RS_485_READ_DEVICE_IDENTIFICATION, 0x01, 0x01};
+    uint16_t n = exchange(fd, identification, sizeof(identification), rsp);
+    ok = ok && n > 7 && rsp[3] == 0x81 && rsp[4] == 0x00 && rsp[6] == 2;
+    char revision[12];
+    snprintf(revision, sizeof(revision), "%lu", (unsigned long)FIRMWARE_VERSION);
+    const char *values[] = {DEVICE_PRODUCT_CODE, revision};
+    uint16_t p = 7;
+    for (uint8_t k = 0; ok && k < 2; k++)
+    {
+        uint8_t length = strlen(values[k]);
+        ok = p + 2 + length <= n && rsp[p] == k + 1 && rsp[p + 1] == length && memcmp(rsp + p + 2, values[k], length) == 0;
+        p += 2 + length;
+    }
+    ok = ok && p == n;
+    uint8_t individual[] = {RS_485_ENCAPSULATED_INTERFACE, RS_485_READ_DEVICE_IDENTIFICATION, 0x04, 0x03};
+    ok = ok && exchange(fd, individual, sizeof(individual), rsp) == 2 && rsp[0] == (RS_485_ENCAPSULATED_INTERFACE | 0x80) && rsp[1] == 0x02;
+    return ok;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 3)
+    {
+        fprintf(stderr, "Usage: %s gateway sml-file [clients] [seconds] [pipeline depth]\n", argv[0]);
+        return 1;
+    }
+    int clients = argc > 3 ? atoi(argv[3]) : 4;
+    seconds = argc > 4 ? atoi(argv[4]) : 3;
+    depth = argc > 5 ? atoi(argv[5]) : 8;
+
+    // Expected values, decoded locally
+    ObisValues obisValues = ObisValues();
+    TinySMLDecoder d = TinySMLDecoder(&obisValues);
+    std::vector<uint8_t> sml;
+    FILE *fIN = fopen(argv[2], "rb");
+    if (!fIN)
+    {
+        perror(argv[2]);
+        return 1;
+    }
+    int cc;
+    while ((cc = fgetc(fIN)) != EOF)
+    {
+        sml.push_back((uint8_t)cc);
+        d.feed((uint8_t)cc);
+    }
+    fclose(fIN);
+    nExpected = obisValues.getLiveRegistersCount();
+    for (uint8_t k = 0; k < nExpected; k++)
+    {
+        expected[k] = obisValues.getLiveRegister(k);
+    }
+
+    // pty in raw mode, keep the slave open so the gateway never sees a hangup
+    int master = posix_openpt(O_RDWR | O_NOCTTY);
+    grantpt(master);
+    unlockpt(master);
+    const char *slaveName = ptsname(master);
+    int slave = open(slaveName, O_RDWR | O_NOCTTY);
+    struct termios tio;
+    tcgetattr(slave, &tio);
+    cfmakeraw(&tio);
+    tcsetattr(slave, TCSANOW, &tio);
+
+    char port[8];
+    snprintf(port, sizeof(port), "%d", TEST_PORT);
+    pid_t rejected = fork();
+    if (rejected == 0)
+    {
+        execl(argv[1], argv[1], "-p", port, "-b", "230400", slaveName, (char *)NULL);
+        _exit(0);
+    }
+    int status = 0;
+    waitpid(rejected, &status, 0);
+    const bool baudRejected = WIFEXITED(status) && WEXITSTATUS(status) == 1;
+    printf("Baud 230400: %s\n", baudRejected ? "rejected" : "FAIL");
+    if (!baudRejected)
+    {
+        return 1;
+    }
+
+    pid_t gateway = fork();
+    if (gateway == 0)
+    {
+        execl(argv[1], argv[1], "-p", port, slaveName, (char *)NULL);
+        perror(argv[1]);
+        _exit(1);
+    }
+
+    int fd = -1;
+    for (int tries = 0; fd < 0 && tries < 100; tries++)
+    {
+        usleep(20000);
+        fd = connectGateway();
+    }
+    if (fd < 0)
+    {
+        fprintf(stderr, "Gateway did not start\n");
+        kill(gateway, SIGTERM);
+        return 1;
+    }
+    if (write(master, sml.data(), sml.size()) != (ssize_t)sml.size())
+    {
+        perror("pty");
+    }
+
+    // Wait until the gateway has decoded the capture
+    bool ok = false;
+    std::vector<uint8_t> rsp(9 + 2 * nExpected);
+    for (int tries = 0; !ok && tries < 100; tries++)
+    {
+        uint8_t req[12];
+        request(req, tries, RS_485_ADDRESS, RS_485_READ_INPUT_REGISTER, LIVE_REGISTERS_BASE, nExpected);
+        send(fd, req, sizeof(req), MSG_NOSIGNAL);
+        ok = readFully(fd, rsp.data(), rsp.size()) && check(rsp.data(), tries, 0, nExpected);
+        if (!ok)
+        {
+            usleep(20000);
+        }
+    }
+    printf("Registers via pty and TCP: %s\n", ok ? "OK" : "MISMATCH");
+
+    bool exceptions = checkException(fd, RS_485_ADDRESS, 0x06, LIVE_REGISTERS_BASE, 1, 0x01)             // Illegal Function
+                      && checkException(fd, RS_485_ADDRESS, RS_485_READ_INPUT_REGISTER, 0, 1, 0x02)      // Illegal Data Address
+                      && checkException(fd, RS_485_ADDRESS, RS_485_READ_INPUT_REGISTER, LIVE_REGISTERS_BASE + 1, nExpected, 0x02)
+                      && checkException(fd, RS_485_ADDRESS, RS_485_READ_INPUT_REGISTER, DIAGNOSTIC_REGISTERS_BASE + N_DIAGNOSTIC_REGISTERS, 1, 0x02)
+                      && checkException(fd, RS_485_ADDRESS, RS_485_READ_INPUT_REGISTER, N_REGISTER_PAGES << 8, 1, 0x02)
+                      && checkException(fd, RS_485_ADDRESS + 1, RS_485_READ_INPUT_REGISTER, LIVE_REGISTERS_BASE, 1, 0x0B);
+    printf("Exception responses: %s\n", exceptions ? "OK" : "FAIL");
+    bool functions = checkFunctionCodes(fd);
+    printf("Function codes 03, 08, 2B/0E: %s\n", functions ? "OK" : "FAIL");
+    close(fd);
+
+    // Load
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    std::vector<std::thread> threads;
+    for (int k = 0; k < clients; k++)
+    {
+        threads.push_back(std::thread(client, k));
+    }
+    for (auto &t : threads)
+    {
+        t.join();
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    double elapsed = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+    printf("%d clients, pipeline depth %d: %llu requests in %.2fs = %.0f req/s, %llu errors\n",
+           clients, depth, (unsigned long long)totalRequests, elapsed, totalRequests / elapsed, (unsigned long long)totalErrors);
+
+    kill(gateway, SIGUSR1);
+    usleep(100000);
+    kill(gateway, SIGTERM);
+    waitpid(gateway, NULL, 0);
+    close(slave);
+    close(master);
+    return (ok && exceptions && functions && totalErrors == 0) ? 0 : 1;
+}
+#endif
+
+// END
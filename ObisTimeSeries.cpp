@@ -0,0 +1,372 @@
+/*
+ * Compact columnar time series files for decoded meter values, host builds only. See ObisTimeSeries.h for the format.
+ */
+
+#include "ObisTimeSeries.h"
+
+#if __TEST__
+#include <string.h>
+
+static const char FILE_MAGIC[4] = {'O', 'T', 'S', '1'};
+static const char BLOCK_MAGIC[4] = {'O', 'T', 'S', 'B'};
+static const char INDEX_MAGIC[4] = {'O', 'T', 'S', 'I'};
+static const char END_MAGIC[4] = {'O', 'T', 'S', 'E'};
+
+static void putVarint(std::vector<uint8_t> &out, uint64_t v)
+{
+    while (v >= 0x80)
+    {
+        out.push_back((uint8_t)v | 0x80);
+        v >>= 7;
+    }
+    out.push_back((uint8_t)v);
+}
+
+static uint64_t getVarint(const uint8_t *&p, const uint8_t *end)
+{
+    uint64_t v = 0;
+    for (uint8_t shift = 0; p < end && shift < 64; shift += 7)
+    {
+        uint8_t b = *p++;
+        v |= (uint64_t)(b & 0x7F) << shift;
+        if (b < 0x80)
+        {
+            break;
+        }
+    }
+    return v;
+}
+
+static uint64_t zigzag(int64_t v)
+{
+    return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static int64_t unzigzag(uint64_t v)
+{
+    return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+template <typename T>
+static bool put(FILE *f, T v)
+{
+    return fwrite(&v, sizeof(v), 1, f) == 1; // Little endian hosts only
+}
+
+template <typename T>
+static bool get(FILE *f, T *v)
+{
+    return fread(v, sizeof(*v), 1, f) == 1;
+}
+
+// Section: Writer
+
+bool ObisTimeSeriesWriter::open(const char *path, uint8_t columns_)
+{
+    if (columns_ > OTS_MAX_COLUMNS)
+    {
+        return false;
+    }
+    columns = columns_;
+    rows = 0;
+    index.clear();
+    f = fopen(path, "wb");
+    if (!f)
+    {
+        return false;
+    }
+    const uint8_t reserved[3] = {0, 0, 0};
+    return fwrite(FILE_MAGIC, 4, 1, f) == 1 && put(f, columns) && fwrite(reserved, 3, 1, f) == 1;
+}
+
+void ObisTimeSeriesWriter::encode(uint8_t column, int64_t residual)
+{
+    if (residual == 0)
+    {
+        zeros[column]++;
+    }
+    else
+    {
+        if (zeros[column])
+        {
+            putVarint(encoded[column], ((uint64_t)zeros[column] << 1) | 1);
+            zeros[column] = 0;
+        }
+        putVarint(encoded[column], zigzag(residual) << 1);
+    }
+}
+
+bool ObisTimeSeriesWriter::append(int64_t timestamp, const int64_t *values)
+{
+    if (!f)
+    {
+        return false;
+    }
+    if (rows == 0)
+    {
+        first[0] = previous[0] = timestamp;
+        previousDelta = 0;
+        for (uint8_t c = 0; c <= columns; c++)
+        {
+            if (c)
+            {
+                first[c] = previous[c] = values[c - 1];
+            }
+            zeros[c] = 0;
+            encoded[c].clear();
+        }
+    }
+    else
+    {
+        int64_t delta = timestamp - previous[0];
+        encode(0, delta - previousDelta);
+        previousDelta = delta;
+        previous[0] = timestamp;
+        for (uint8_t c = 1; c <= columns; c++)
+        {
+            encode(c, values[c - 1] - previous[c]);
+            previous[c] = values[c - 1];
+        }
+    }
+    if (++rows == OTS_ROWS_PER_BLOCK)
+    {
+        return flushBlock();
+    }
+    return true;
+}
+
+bool ObisTimeSeriesWriter::flushBlock()
+{
+    if (rows == 0)
+    {
+        return true;
+    }
+    ObisTimeSeriesBlock block;
+    block.firstTimestamp = first[0];
+    block.lastTimestamp = previous[0];
+    block.offset = ftell(f);
+    block.rows = rows;
+    index.push_back(block);
+
+    bool ok = fwrite(BLOCK_MAGIC, 4, 1, f) == 1 && put(f, rows) && put(f, block.firstTimestamp) && put(f, block.lastTimestamp);
+    for (uint8_t c = 1; c <= columns; c++)
+    {
+        ok = ok && put(f, first[c]);
+    }
+    for (uint8_t c = 0; c <= columns; c++)
+    {
+        if (zeros[c])
+        {
+            putVarint(encoded[c], ((uint64_t)zeros[c] << 1) | 1);
+        }
+        ok = ok && put(f, (uint32_t)encoded[c].size());
+    }
+    for (uint8_t c = 0; c <= columns; c++)
+    {
+        ok = ok && fwrite(encoded[c].data(), 1, encoded[c].size(), f) == encoded[c].size();
+    }
+    rows = 0;
+    return ok;
+}
+
+bool ObisTimeSeriesWriter::close()
+{
+    if (!f)
+    {
+        return false;
+    }
+    bool ok = flushBlock();
+    uint64_t indexOffset = ftell(f);
+    ok = ok && fwrite(INDEX_MAGIC, 4, 1, f) == 1 && put(f, (uint32_t)index.size());
+    for (const ObisTimeSeriesBlock &block : index)
+    {
+        ok = ok && put(f, block.firstTimestamp) && put(f, block.lastTimestamp) && put(f, block.offset) && put(f, block.rows) && put(f, (uint32_t)0);
+    }
+    ok = ok && put(f, indexOffset) && fwrite(END_MAGIC, 4, 1, f) == 1;
+    ok = (fclose(f) == 0) && ok;
+    f = NULL;
+    return ok;
+}
+
+// Section: Reader
+
+bool ObisTimeSeriesReader::open(const char *path)
+{
+    f = fopen(path, "rb");
+    char magic[4];
+    uint8_t reserved[3];
+    if (!f || fread(magic, 4, 1, f) != 1 || memcmp(magic, FILE_MAGIC, 4) || !get(f, &columns) || fread(reserved, 3, 1, f) != 1 || columns > OTS_MAX_COLUMNS)
+    {
+        close();
+        return false;
+    }
+    rows = row = 0;
+    skipBefore = INT64_MIN;
+
+    // Index, if present
+    index.clear();
+    long start = ftell(f);
+    uint64_t indexOffset;
+    uint32_t blocks;
+    if (fseek(f, -12, SEEK_END) == 0 && get(f, &indexOffset) && fread(magic, 4, 1, f) == 1 && !memcmp(magic, END_MAGIC, 4) && fseek(f, indexOffset, SEEK_SET) == 0 && fread(magic, 4, 1, f) == 1 && !memcmp(magic, INDEX_MAGIC, 4) && get(f, &blocks))
+    {
+        for (uint32_t b = 0; b < blocks; b++)
+        {
+            ObisTimeSeriesBlock block;
+            uint32_t reserved32;
+            if (!get(f, &block.firstTimestamp) || !get(f, &block.lastTimestamp) || !get(f, &block.offset) || !get(f, &block.rows) || !get(f, &reserved32))
+            {
+                index.clear();
+                break;
+            }
+            index.push_back(block);
+        }
+    }
+    fseek(f, start, SEEK_SET);
+    return true;
+}
+
+uint8_t ObisTimeSeriesReader::getColumns()
+{
+    return columns;
+}
+
+const std::vector<ObisTimeSeriesBlock> &ObisTimeSeriesReader::getIndex()
+{
+    return index;
+}
+
+bool ObisTimeSeriesReader::seek(int64_t timestamp)
+{
+    // Last block starting at or before timestamp, which may still end before it
+    size_t lo = 0, hi = index.size();
+    while (hi - lo > 1)
+    {
+        size_t mid = (lo + hi) / 2;
+        if (index[mid].firstTimestamp <= timestamp)
+        {
+            lo = mid;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+    if (index.empty() || fseek(f, index[lo].offset, SEEK_SET) != 0)
+    {
+        return false;
+    }
+    rows = row = 0;
+    skipBefore = timestamp;
+    return true;
+}
+
+bool ObisTimeSeriesReader::readBlock()
+{
+    char magic[4];
+    uint32_t length[1 + OTS_MAX_COLUMNS];
+    int64_t firstTimestamp, lastTimestamp;
+    int64_t firstValue[OTS_MAX_COLUMNS];
+    uint32_t n;
+    rows = row = 0; // Nothing left to read unless this block is good
+    if (fread(magic, 4, 1, f) != 1 || memcmp(magic, BLOCK_MAGIC, 4) || !get(f, &n) || !get(f, &firstTimestamp) || !get(f, &lastTimestamp))
+    {
+        return false; // End of data, index or truncated file
+    }
+    if (n == 0 || n > OTS_ROWS_PER_BLOCK)
+    {
+        return false; // Corrupt header
+    }
+    for (uint8_t c = 0; c < columns; c++)
+    {
+        if (!get(f, &firstValue[c]))
+        {
+            return false;
+        }
+    }
+    size_t total = 0;
+    for (uint8_t c = 0; c <= columns; c++)
+    {
+        if (!get(f, &length[c]))
+        {
+            return false;
+        }
+        total += length[c];
+    }
+    buffer.resize(total);
+    if (fread(buffer.data(), 1, total, f) != total)
+    {
+        return false;
+    }
+    rows = n;
+
+    const uint8_t *p = buffer.data();
+    for (uint8_t c = 0; c <= columns; c++)
+    {
+        const uint8_t *end = p + length[c];
+        std::vector<int64_t> &out = decoded[c];
+        out.resize(rows);
+        int64_t value = c ? firstValue[c - 1] : firstTimestamp;
+        int64_t delta = 0;
+        out[0] = value;
+        uint32_t r = 1;
+        while (r < rows && p < end)
+        {
+            uint64_t token = getVarint(p, end);
+            if (token & 1)
+            {
+                // Run of zero residuals: timestamps keep their delta, values stay the same
+                delta = c ? 0 : delta;
+                for (uint64_t run = token >> 1; run && r < rows; run--)
+                {
+                    value += delta;
+                    out[r++] = value;
+                }
+            }
+            else
+            {
+                int64_t residual = unzigzag(token >> 1);
+                delta = c ? residual : delta + residual;
+                value += delta;
+                out[r++] = value;
+            }
+        }
+        while (r < rows)
+        {
+            out[r++] = value; // Truncated column
+        }
+        p = end;
+    }
+    return true;
+}
+
+bool ObisTimeSeriesReader::next(int64_t *timestamp, int64_t *values)
+{
+    do
+    {
+        if (row >= rows && !readBlock())
+        {
+            return false;
+        }
+        *timestamp = decoded[0][row];
+        for (uint8_t c = 0; c < columns; c++)
+        {
+            values[c] = decoded[c + 1][row];
+        }
+        row++;
+    } while (*timestamp < skipBefore);
+    skipBefore = INT64_MIN;
+    return true;
+}
+
+void ObisTimeSeriesReader::close()
+{
+    if (f)
+    {
+        fclose(f);
+        f = NULL;
+    }
+}
+#endif // __TEST__
+
+// END
@@ -0,0 +1,108 @@
+/*
+ * Compact columnar time series files for decoded meter values, host builds only.
+ *
+ * Rows are a timestamp [ms] plus one 64 bit value per column, e.g. the OBIS values of a committed frame.
+ * Rows are grouped into blocks. Within a block, every column is stored on its own, so readers may skip columns:
+ * - Timestamps: delta-of-delta
+ * - Values: delta, which suits slowly changing counters (1.8.0, 2.8.0) as well as power (16.7.0)
+ * Residuals are stored as varint tokens: (zigzag(residual) << 1) for a single non-zero residual, (n << 1 | 1) for a
+ * run of n zero residuals. Regular one second readings therefore cost next to nothing for the timestamp, counters
+ * only cost when they change, and small power changes cost one byte. Residuals must fit into 62 bits.
+ *
+ * File layout, little endian:
+ *   "OTS1" u8 columns, u8[3] reserved
+ *   Blocks: "OTSB" u32 rows, i64 first timestamp, i64 last timestamp, i64 first value[columns],
+ *           u32 encoded length[1 + columns], encoded timestamp column, encoded value columns
+ *   Index:  "OTSI" u32 blocks, { i64 first timestamp, i64 last timestamp, u64 offset, u32 rows, u32 reserved }[blocks]
+ *   Footer: u64 index offset, "OTSE"
+ * A file that was not closed properly has no index, but can still be read sequentially.
+ */
+
+#ifndef __OBISTIMESERIES_H
+#define __OBISTIMESERIES_H
+
+#include <Arduino.h>
+
+#if __TEST__
+#include <stdio.h>
+#include <vector>
+
+#define OTS_MAX_COLUMNS 16
+#ifndef OTS_ROWS_PER_BLOCK
+#define OTS_ROWS_PER_BLOCK 4096
+#endif
+
+struct ObisTimeSeriesBlock
+{
+    int64_t firstTimestamp;
+    int64_t lastTimestamp;
+    uint64_t offset;
+    uint32_t rows;
+};
+
+class ObisTimeSeriesWriter
+{
+public:
+    bool open(const char *path, uint8_t columns_);
+    bool append(int64_t timestamp, const int64_t *values);
+    bool close();
+
+private:
+    FILE *f = NULL;
+    uint8_t columns;
+    uint32_t rows;
+    std::vector<ObisTimeSeriesBlock> index;
+
+    // Current block
+    int64_t first[1 + OTS_MAX_COLUMNS]; // Timestamp, values
+    int64_t previous[1 + OTS_MAX_COLUMNS];
+    int64_t previousDelta;               // Timestamps only
+    uint32_t zeros[1 + OTS_MAX_COLUMNS]; // Pending run of zero residuals
+    std::vector<uint8_t> encoded[1 + OTS_MAX_COLUMNS];
+
+    void encode(uint8_t column, int64_t residual);
+    bool flushBlock();
+};
+
+class ObisTimeSeriesReader
+{
+public:
+    bool open(const char *path);
+    uint8_t getColumns();
+
+    /*
+     * Block index, empty if the file was not closed properly.
+     */
+    const std::vector<ObisTimeSeriesBlock> &getIndex();
+
+    /*
+     * Position at the first row with a timestamp at or after the given one. Needs the index.
+     */
+    bool seek(int64_t timestamp);
+
+    /*
+     * Read next row. Return false at end of file.
+     */
+    bool next(int64_t *timestamp, int64_t *values);
+
+    void close();
+
+private:
+    FILE *f = NULL;
+    uint8_t columns;
+    std::vector<ObisTimeSeriesBlock> index;
+    int64_t skipBefore;
+
+    // Current block, decoded
+    uint32_t rows;
+    uint32_t row;
+    std::vector<int64_t> decoded[1 + OTS_MAX_COLUMNS];
+    std::vector<uint8_t> buffer;
+
+    bool readBlock();
+};
+#endif // __TEST__
+
+#endif // __OBISTIMESERIES_H
+
+// END
@@ -0,0 +1,232 @@
+/*
+ * Inspect, dump and benchmark ObisTimeSeries files.
+ *
+ * g++ -O2 -I . -D__TEST__=1 -o ots ObisTimeSeriesTool.cpp ObisTimeSeries.cpp
+ * ./ots info meter-9.ots
+ * ./ots dump meter-9.ots [from timestamp ms]
+ * ./ots bench /tmp/year.ots [days]    Synthetic one second readings: size, write and scan speed, round trip check,
+ *                                     then corrupts the first block header. The scan is next() alone, in decoded
+ *                                     bytes (timestamp and values, 8 bytes each) per second against memcpy() of
+ *                                     64MB chunks, i.e. memory bandwidth.
+ */
+
+#include <stdio.h>
+#include "ObisTimeSeries.h"
+
+#if __TEST__
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+
+static double now()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+static int info(const char *path)
+{
+    ObisTimeSeriesReader r;
+    if (!r.open(path))
+    {
+        fprintf(stderr, "%s: not a time series file\n", path);
+        return 1;
+    }
+    uint64_t rows = 0;
+    for (const ObisTimeSeriesBlock &b : r.getIndex())
+    {
+        printf("block @%-10llu %8u rows %lld .. %lld\n", (unsigned long long)b.offset, b.rows, (long long)b.firstTimestamp, (long long)b.lastTimestamp);
+        rows += b.rows;
+    }
+    printf("%u columns, %zu blocks, %llu rows%s\n", r.getColumns(), r.getIndex().size(), (unsigned long long)rows,
+           r.getIndex().empty() ? " (no index, file not closed?)" : "");
+    r.close();
+    return 0;
+}
+
+static int dump(const char *path, const char *from)
+{
+    ObisTimeSeriesReader r;
+    if (!r.open(path))
+    {
+        fprintf(stderr, "%s: not a time series file\n", path);
+        return 1;
+    }
+    if (from && !r.seek(atoll(from)))
+    {
+        fprintf(stderr, "%s: cannot seek without index\n", path);
+        return 1;
+    }
+    int64_t timestamp;
+    int64_t values[OTS_MAX_COLUMNS];
+    while (r.next(&timestamp, values))
+    {
+        printf("%lld", (long long)timestamp);
+        for (uint8_t c = 0; c < r.getColumns(); c++)
+        {
+            printf(",%lld", (long long)values[c]);
+        }
+        printf("\n");
+    }
+    r.close();
+    return 0;
+}
+
+/*
+ * Household model: base load plus random appliances, a bit of PV during the day. Power in W, counters in Wh.
+ */
+struct Household
+{
+    int64_t timestamp = 1700000000000LL;
+    double imported = 4710942.0;
+    double exported = 123456.0;
+    int64_t power = 0;
+    int appliance = 0;
+    uint32_t seed = 4711;
+
+    uint32_t random()
+    {
+        seed = seed * 1103515245 + 12345;
+        return seed >> 8;
+    }
+
+    void step(int64_t *values)
+    {
+        timestamp += 1000;
+        if (random() % 600 == 0)
+        {
+            appliance = (random() % 4) * 700; // Kettle, oven, ...
+        }
+        int64_t secondOfDay = (timestamp / 1000) % 86400;
+        int64_t pv = (secondOfDay > 28800 && secondOfDay < 64800) ? 1500 : 0;
+        power = 180 + appliance - pv + (int)(random() % 7) - 3;
+        if (power > 0)
+        {
+            imported += power / 3600.0;
+        }
+        else
+        {
+            exported -= power / 3600.0;
+        }
+        values[0] = (int64_t)imported;
+        values[1] = (int64_t)exported;
+        values[2] = power;
+    }
+};
+
+static int bench(const char *path, int days)
+{
+    const uint64_t rows = (uint64_t)days * 86400;
+    const uint8_t columns = 3;
+    int64_t values[columns];
+
+    ObisTimeSeriesWriter w;
+    if (!w.open(path, columns))
+    {
+        perror(path);
+        return 1;
+    }
+    Household h;
+    double t0 = now();
+    for (uint64_t k = 0; k < rows; k++)
+    {
+        h.step(values);
+        w.append(h.timestamp, values);
+    }
+    w.close();
+    double written = now() - t0;
+
+    struct stat st;
+    stat(path, &st);
+    printf("%d days of one second readings: %llu rows, %lld bytes, %.2f bytes/row, written in %.2fs\n",
+           days, (unsigned long long)rows, (long long)st.st_size, (double)st.st_size / rows, written);
+
+    // Scan: next() alone, the sum keeps the compiler from dropping the values
+    ObisTimeSeriesReader r;
+    r.open(path);
+    int64_t timestamp;
+    int64_t sum = 0;
+    uint64_t read = 0;
+    t0 = now();
+    while (r.next(&timestamp, values))
+    {
+        sum += timestamp + values[0] + values[1] + values[2];
+        read++;
+    }
+    double scanned = now() - t0;
+    const double decoded = (double)read * (1 + columns) * sizeof(int64_t);
+
+    // Baseline: memcpy() of as many bytes, in chunks larger than the caches, i.e. memory bandwidth
+    std::vector<uint8_t> from((size_t)64 << 20, 1), to(from.size());
+    t0 = now();
+    for (double copied = 0; copied < decoded; copied += from.size())
+    {
+        memcpy(to.data(), from.data(), from.size());
+        from[(size_t)copied % from.size()] = to[0] + 1;
+    }
+    double copying = now() - t0;
+    printf("Scan: %llu rows in %.2fs = %.1f Mrows/s, %.0f MB/s decoded, memcpy %.0f MB/s (%.0f%%) [%lld]\n",
+           (unsigned long long)read, scanned, read / scanned / 1e6, decoded / scanned / 1e6, decoded / copying / 1e6,
+           100 * copying / scanned, (long long)(sum & 0xFF));
+
+    // Round trip check, not timed
+    r.close();
+    r.open(path);
+    Household check;
+    int64_t expected[columns];
+    uint64_t mismatches = 0;
+    read = 0;
+    while (r.next(&timestamp, values))
+    {
+        check.step(expected);
+        mismatches += (timestamp != check.timestamp) || memcmp(values, expected, sizeof(values));
+        read++;
+    }
+    printf("Round trip: %llu rows, %llu mismatches\n", (unsigned long long)read, (unsigned long long)mismatches);
+
+    // Seek to the middle via the block index
+    int64_t middle = 1700000000000LL + (int64_t)(rows / 2) * 1000;
+    bool sought = r.seek(middle) && r.next(&timestamp, values) && timestamp == middle;
+    printf("Seek: %s\n", sought ? "OK" : "FAIL");
+    const uint64_t offset = r.getIndex()[0].offset;
+    r.close();
+
+    // Corrupt row counts in the first block header must end the scan, not be decoded
+    const uint32_t badRows[] = {0, OTS_ROWS_PER_BLOCK + 1, 0xFFFFFFFF};
+    bool rejected = true;
+    for (uint32_t bad : badRows)
+    {
+        FILE *f = fopen(path, "r+b");
+        fseek(f, offset + 4, SEEK_SET);
+        fwrite(&bad, sizeof(bad), 1, f);
+        fclose(f);
+        ObisTimeSeriesReader c;
+        rejected &= c.open(path) && !c.next(&timestamp, values);
+        c.close();
+    }
+    printf("Corrupt block headers: %s\n", rejected ? "OK" : "FAIL");
+    return (read == rows && mismatches == 0 && sought && rejected) ? 0 : 1;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc >= 3 && !strcmp(argv[1], "info"))
+    {
+        return info(argv[2]);
+    }
+    if (argc >= 3 && !strcmp(argv[1], "dump"))
+    {
+        return dump(argv[2], argc > 3 ? argv[3] : NULL);
+    }
+    if (argc >= 3 && !strcmp(argv[1], "bench"))
+    {
+        return bench(argv[2], argc > 3 ? atoi(argv[3]) : 365);
+    }
+    fprintf(stderr, "Usage: %s info|dump file [from] | bench file [days]\n", argv[0]);
+    return 1;
+}
+#endif
+
+// END
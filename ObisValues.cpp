@@ -8,38 +8,125 @@
 #ifndef N_KNOWN_OBIS_CODES
 #error Number of known OBIS codes should have been defined in ObisValues.h
 #endif
-#define N_PERSISTENT_OBIS_REGISTERS 4 // Registers at or beyond this index will be reset to 0 when not received
 #define UNKNOWN_OBIS_CODE -1
 #define OBIS_CODE_BYTES_LENGTH 5
 
+// Latency: Rise of the lower envelope per second of sensor time [ms], to follow clock drift between meter and us.
+// Must exceed the drift, 3% covers the internal oscillator.
+#define LATENCY_DRIFT_MS_PER_S 31
+#define LATENCY_MAX_GAP_S 3600 // Start over after longer gaps in sensor time
+#define LATENCY_UNKNOWN 0xFFFF
+
+// Power estimate
+#define POWER_STATE_NONE 0      // No energy reading yet
+#define POWER_STATE_REFERENCE 1 // Energy reading, but not at a counter change
+#define POWER_STATE_CHANGE 2    // Counter change seen, time of a change known
+#define POWER_STATE_ESTIMATE 3  // Two counter changes seen
+#define POWER_MAX_STEP_WH 50000 // Larger counter changes start over, e.g. meter replaced
+#define POWER_MAX_ERROR 0x7FFE
+static_assert(POWER_MAX_STEP_WH <= 0xFFFF, "Counter steps up to POWER_MAX_STEP_WH are kept as 16 bit resolution");
+
 // Version indicator, exposed via Live Registers 0, 1
-static const uint32_t VERSION = 2024050601;
+static const uint32_t VERSION = FIRMWARE_VERSION;
 
-static const uint8_t KNOWN_OBIS_CODES[N_KNOWN_OBIS_CODES][OBIS_CODE_BYTES_LENGTH] = {
+static const uint8_t KNOWN_OBIS_CODES[][OBIS_CODE_BYTES_LENGTH] PROGMEM = {
     {0x01, 0x00, 0x01, 0x08, 0x00}, // 1-0:1.8.0 Positive active energy (A+) total [kWh]
     {0x01, 0x00, 0x02, 0x08, 0x00}, // 1-0:2.8.0 Negative active energy (A+) total [kWh]
-    {0x01, 0x00, 0x10, 0x07, 0x00}  // 1-0:16.7.0 Sum active instantaneous power (A+ - A-) [kW]
+    {0x01, 0x00, 0x10, 0x07, 0x00}, // 1-0:16.7.0 Sum active instantaneous power (A+ - A-) [kW]
+    EXTRA_OBIS_CODES};
+static_assert(sizeof(KNOWN_OBIS_CODES) / OBIS_CODE_BYTES_LENGTH == N_KNOWN_OBIS_CODES, "EXTRA_OBIS_CODES must match N_KNOWN_OBIS_CODES");
+static_assert(N_KNOWN_OBIS_CODES <= 8, "Codes fed are flagged in 8 bits");
+#define OBIS_IMPORT 0 // Index into KNOWN_OBIS_CODES
+#define OBIS_EXPORT 1
+#define OBIS_POWER 2
+
+/*
+ * Register array index and register count per page, generated from REGISTER_MAP, in flash
+ */
+struct RegisterPage
+{
+    uint8_t start;
+    uint8_t count;
+};
+struct RegisterPageTable
+{
+    RegisterPage pages[N_REGISTER_PAGES];
 };
 
+template <uint8_t... P>
+struct RegisterPages
+{
+    static constexpr RegisterPageTable make()
+    {
+        return {{{(uint8_t)registerPageStart(P), (uint8_t)registerPageCount(P)}...}};
+    }
+};
+
+template <uint8_t N, uint8_t... P>
+struct MakeRegisterPages : MakeRegisterPages<N - 1, N - 1, P...>
+{
+};
+template <uint8_t... P>
+struct MakeRegisterPages<0, P...> : RegisterPages<P...>
+{
+};
+
+static const RegisterPageTable REGISTER_PAGE_TABLE PROGMEM = MakeRegisterPages<N_REGISTER_PAGES>::make();
+#define REGISTER_PAGES REGISTER_PAGE_TABLE.pages
+
 ObisValues::ObisValues()
 {
     reset();
 
+    for (uint8_t rr = 0; rr < N_INPUT_REGISTERS; rr++)
+    {
+        registers[rr] = 0;
+    }
     for (uint8_t rr = 0; rr < N_KNOWN_OBIS_REGISTERS; rr++)
     {
-        liveRegisters[rr] = 0;
         tempRegisters[rr] = 0;
     }
+    for (uint8_t cc = 0; cc < N_KNOWN_OBIS_CODES; cc++)
+    {
+        getBlock<BLOCK_VALUE_AGE>()[cc] = VALUE_AGE_UNKNOWN;
+#if VALUE_VIEWS
+        tempScaler[cc] = 0;
+#endif
+    }
+#if TELEMETRY_PUSH
+    changedLiveRegisters = 0;
+#endif
+    now = 0;
+#if SML_MESSAGE_DATA
+    minOffset = 0;
+#endif
+    getBlock<BLOCK_DIAGNOSTICS>()[DIAG_SML_LATENCY] = LATENCY_UNKNOWN;
+    powerState = POWER_STATE_NONE;
+    resolution = 0;
+    estimate = 0;
+    estimateError = 0;
+    getBlock<BLOCK_POWER>()[POWER_QUALITY] = POWER_UNKNOWN;
+    trace(TRACE_BOOT, 0);
+    getBlock<BLOCK_VERSION>()[0] = (uint16_t)(VERSION >> 16);
+    getBlock<BLOCK_VERSION>()[1] = (uint16_t)(VERSION);
+}
+
+void ObisValues::setLiveRegister(uint8_t rr, uint16_t value)
+{
+    if (registers[rr] != value)
+    {
+        registers[rr] = value;
+#if TELEMETRY_PUSH
+        changedLiveRegisters |= 1UL << rr; // Live registers come first
+#endif
+    }
 }
 
 void ObisValues::reset()
 {
     obisCodeDetected = UNKNOWN_OBIS_CODE;
 
-    for (uint8_t rr = 0; rr < N_KNOWN_OBIS_REGISTERS; rr++)
-    {
-        registerIsSet[rr] = false;
-    }
+    codesSet = 0;
 }
 
 void ObisValues::feedObisOctetString(uint8_t *buf, uint8_t len)
@@ -57,7 +144,7 @@ void ObisValues::feedObisOctetString(uint8_t *buf, uint8_t len)
             uint8_t m = 0;
             for (uint8_t jj = 0; jj < OBIS_CODE_BYTES_LENGTH; jj++)
             {
-                m |= (*p++ != *b++);
+                m |= (pgm_read_byte(p++) != *b++);
             }
             if (m == 0)
             {
@@ -68,58 +155,397 @@ void ObisValues::feedObisOctetString(uint8_t *buf, uint8_t len)
     }
 }
 
+static uint32_t getValue(const uint16_t *registers, uint8_t n)
+{
+    return ((uint32_t)registers[2 * n] << 16) | registers[2 * n + 1];
+}
+
 void ObisValues::feedObisValue(uint32_t value)
 {
     if (obisCodeDetected != UNKNOWN_OBIS_CODE)
     {
-        uint8_t rr = obisCodeDetected * 2;
-        registerIsSet[rr] = true;
+        const uint8_t rr = obisCodeDetected * 2;
+        codesSet |= 1 << obisCodeDetected;
         tempRegisters[rr] = (uint16_t)(value >> 16);
-        rr++;
-        registerIsSet[rr] = true;
-        tempRegisters[rr] = (uint16_t)value;
+        tempRegisters[rr + 1] = (uint16_t)value;
+#if VALUE_VIEWS
+        tempScaler[obisCodeDetected] = 0;
+#endif
         obisCodeDetected = UNKNOWN_OBIS_CODE;
     }
 }
 
+#if VALUE_VIEWS
+void ObisValues::feedObisRawValue(int64_t raw, int8_t scaler)
+{
+    const int8_t cc = obisCodeDetected;
+    if (cc != UNKNOWN_OBIS_CODE)
+    {
+        // Narrowed to 32 bit, unsigned for OBIS_UNSIGNED_CODES, by dropping digits on the right. Only values beyond
+        // 32 bit lose precision, to about 9 digits.
+        const bool isUnsigned = OBIS_UNSIGNED_CODES & (1UL << cc);
+        while (isUnsigned ? (uint64_t)raw > UINT32_MAX : (raw > INT32_MAX || raw < INT32_MIN))
+        {
+            raw = scaleValue(raw, -1);
+            scaler++;
+        }
+        feedObisValue((uint32_t)raw);
+        tempScaler[cc] = scaler;
+    }
+}
+
+// Value of code cc as fed, see feedObisRawValue()
+static int64_t getRawValue(const uint16_t *tempRegisters, uint8_t cc)
+{
+    const uint32_t value = getValue(tempRegisters, cc);
+    return (OBIS_UNSIGNED_CODES & (1UL << cc)) ? (int64_t)value : (int64_t)(int32_t)value;
+}
+#endif
+
+#if SML_MESSAGE_DATA
+void ObisValues::feedMessageData(uint32_t sensorTime, uint16_t serverId, uint16_t transaction)
+{
+    updateLatency(sensorTime, serverId); // Against the previous frame, still in the registers
+    setRegister<BLOCK_SML>(SML_SENSOR_TIME, (uint16_t)(sensorTime >> 16));
+    setRegister<BLOCK_SML>(SML_SENSOR_TIME + 1, (uint16_t)sensorTime);
+    setRegister<BLOCK_SML>(SML_SERVER_ID, serverId);
+    setRegister<BLOCK_SML>(SML_TRANSACTION, transaction);
+}
+#endif
+
+void ObisValues::tick(uint32_t now_)
+{
+    const uint32_t elapsed = now_ - now;
+    now = now_;
+#if TRACE_ENTRIES
+    getBlock<BLOCK_TRACE>()[TRACE_NOW] = (uint16_t)(now >> TRACE_TICK_SHIFT);
+#endif
+    uint16_t *ages = getBlock<BLOCK_VALUE_AGE>();
+    for (uint8_t cc = 0; cc < N_KNOWN_OBIS_CODES; cc++)
+    {
+        // Saturates at VALUE_AGE_UNKNOWN, which stays so until received again
+        ages[cc] = (elapsed < (uint32_t)(VALUE_AGE_UNKNOWN - ages[cc])) ? ages[cc] + elapsed : VALUE_AGE_UNKNOWN;
+    }
+}
+
+bool ObisValues::isExpired(uint8_t cc)
+{
+    return !(OBIS_PERSISTENT_CODES & (1UL << cc)) && getBlock<BLOCK_VALUE_AGE>()[cc] >= OBIS_TTL_MS;
+}
+
+#if TRACE_ENTRIES
+void ObisValues::addTrace(uint8_t event, uint8_t arg)
+{
+    uint16_t *traceRegisters = getBlock<BLOCK_TRACE>();
+    traceRegisters[N_TRACE_HEADER_REGISTERS + (traceRegisters[TRACE_COUNT] & (TRACE_ENTRIES - 1))] =
+        (traceRegisters[TRACE_NOW] << 8) | (event << 4) | (arg & 0x0F);
+    traceRegisters[TRACE_COUNT]++;
+}
+#endif
+
+/*
+ * Values missing from the frame are kept until they expire, see OBIS_TTL_MS
+ */
 void ObisValues::commit()
 {
+#if TELEMETRY_PUSH
+    changedLiveRegisters = 0;
+#endif
+    setRegister<BLOCK_WARM_START>(WARM_START_STALE, 0);
+    for (uint8_t cc = 0; cc < N_KNOWN_OBIS_CODES; cc++)
+    {
+        if (codesSet & (1 << cc))
+        {
+            getBlock<BLOCK_VALUE_AGE>()[cc] = 0;
+#if VALUE_VIEWS
+            const int64_t raw = getRawValue(tempRegisters, cc);
+            const uint32_t value = (uint32_t)scaleValue(raw, tempScaler[cc]);
+            tempRegisters[2 * cc] = (uint16_t)(value >> 16);
+            tempRegisters[2 * cc + 1] = (uint16_t)value;
+            updateView(cc, raw, tempScaler[cc]);
+#endif
+        }
+#if VALUE_VIEWS
+        else if (isExpired(cc))
+        {
+            updateView(cc, 0, 0);
+        }
+#endif
+    }
+    const bool powerMeasured = !isExpired(OBIS_POWER) && getBlock<BLOCK_VALUE_AGE>()[OBIS_POWER] != VALUE_AGE_UNKNOWN;
     for (uint8_t rr = 0; rr < N_KNOWN_OBIS_REGISTERS; rr++)
     {
-        if (registerIsSet[rr])
+        if (codesSet & (1 << (rr / 2)))
         {
-            registerIsSet[rr] = false;
-            liveRegisters[rr] = tempRegisters[rr];
+            setRegister<BLOCK_OBIS>(rr, tempRegisters[rr]);
         }
-        else if (rr >= N_PERSISTENT_OBIS_REGISTERS)
+        else if (isExpired(rr / 2))
         {
-            liveRegisters[rr] = 0;
+            setRegister<BLOCK_OBIS>(rr, 0);
         }
     }
+    codesSet = 0;
     obisCodeDetected = UNKNOWN_OBIS_CODE;
+    incrementDiagnosticRegister(DIAG_FRAMES);
+#if SML_MESSAGE_DATA
+    trace(TRACE_SML_COMMIT, (uint8_t)getBlock<BLOCK_SML>()[SML_TRANSACTION]);
+#else
+    trace(TRACE_SML_COMMIT, 0);
+#endif
+    updatePower(powerMeasured);
 }
 
-uint8_t ObisValues::getLiveRegistersCount()
+void ObisValues::restore(const uint16_t *values)
 {
-    return 2 + N_KNOWN_OBIS_REGISTERS;
+    for (uint8_t rr = 0; rr < N_COUNTER_REGISTERS; rr++)
+    {
+        setRegister<BLOCK_OBIS>(rr, values[rr]);
+    }
+#if VALUE_VIEWS
+    for (uint8_t cc = 0; cc < N_COUNTER_REGISTERS / 2; cc++)
+    {
+        updateView(cc, getValue(values, cc), 0);
+    }
+#endif
+    setRegister<BLOCK_WARM_START>(WARM_START_STALE, 1);
 }
 
-uint16_t ObisValues::getLiveRegister(uint8_t n)
+int64_t scaleValue(int64_t value, int8_t scaler)
+{
+    for (; scaler > 0; scaler--)
+    {
+        value *= 10;
+    }
+    int8_t remainder = 0;
+    for (; scaler < 0; scaler++)
+    {
+        remainder = value % 10;
+        value /= 10;
+    }
+    return value + (remainder >= 5) - (remainder <= -5);
+}
+
+#if VALUE_VIEWS
+static void putValue(uint16_t *view, uint32_t value)
+{
+    view[0] = (uint16_t)(value >> 16);
+    view[1] = (uint16_t)value;
+}
+
+/*
+ * View of OBIS code cc, from the value as sent. Done once per commit, so it costs the same to read as the plain
+ * registers.
+ */
+void ObisValues::updateView(uint8_t cc, int64_t raw, int8_t scaler)
+{
+#if VALUE_VIEWS == VALUE_VIEW_SCALED
+    putValue(getBlock<BLOCK_VIEW>() + 2 * cc, (uint32_t)scaleValue(raw, scaler - VALUE_VIEW_SCALER));
+#else
+    union
+    {
+        float f;
+        uint32_t bits;
+    } ieee;
+    ieee.f = (float)raw;
+    for (int8_t s = scaler - VALUE_VIEW_FLOAT_SCALER; s > 0; s--)
+    {
+        ieee.f *= 10;
+    }
+    for (int8_t s = scaler - VALUE_VIEW_FLOAT_SCALER; s < 0; s++)
+    {
+        ieee.f /= 10;
+    }
+#if VALUE_VIEWS == VALUE_VIEW_FLOAT_SWAPPED
+    ieee.bits = (ieee.bits << 16) | (ieee.bits >> 16);
+#endif
+    putValue(getBlock<BLOCK_VIEW>() + 2 * cc, ieee.bits);
+#endif
+}
+#endif
+
+/*
+ * Average power over the time between counter changes (A+ - A-), at least POWER_ESTIMATE_WINDOW_MS, from local commit
+ * times. The counters are read at commit, so each change is known to within one counter step: the error is bounded by
+ * resolution / averaging time. Without a change, the counters moved by less than one step since the last one, which
+ * bounds the power to resolution / time since, and the estimate decays accordingly.
+ */
+void ObisValues::updatePower(bool measured)
+{
+    const uint16_t *liveRegisters = getBlock<BLOCK_OBIS>();
+    const int32_t energy = (int32_t)(getValue(liveRegisters, OBIS_IMPORT) - getValue(liveRegisters, OBIS_EXPORT));
+    const int32_t step = energy - lastEnergy;
+
+    if (powerState == POWER_STATE_NONE || step > POWER_MAX_STEP_WH || step < -POWER_MAX_STEP_WH)
+    {
+        powerState = POWER_STATE_REFERENCE;
+        lastEnergy = energy;
+    }
+    else if (step != 0)
+    {
+        const uint32_t size = (step < 0) ? -step : step;
+        if (resolution == 0 || size < resolution)
+        {
+            resolution = size;
+        }
+        const uint32_t window = (now - windowStart) / 100; // [100ms]
+        if (powerState == POWER_STATE_REFERENCE)
+        {
+            powerState = POWER_STATE_CHANGE;
+            windowEnergy = energy;
+            windowStart = now;
+        }
+        else if (window > 0 && window * 100 >= POWER_ESTIMATE_WINDOW_MS)
+        {
+            const int32_t delta = energy - windowEnergy;
+            if (delta > POWER_MAX_STEP_WH || delta < -POWER_MAX_STEP_WH)
+            {
+                powerState = POWER_STATE_CHANGE;
+            }
+            else
+            {
+                // [Wh] * 3600 [s/h] / ([100ms] / 10) = [W]
+                const uint32_t error = (uint32_t)resolution * 36000 / window;
+                estimate = delta * 36000 / (int32_t)window;
+                estimateError = (error < POWER_MAX_ERROR) ? error : POWER_MAX_ERROR;
+                powerState = POWER_STATE_ESTIMATE;
+            }
+            windowEnergy = energy;
+            windowStart = now;
+        }
+        lastEnergy = energy;
+        lastChange = now;
+    }
+    else if (powerState == POWER_STATE_ESTIMATE)
+    {
+        const uint32_t since = (now - lastChange) / 100;
+        const uint32_t bound = since ? (uint32_t)resolution * 36000 / since : POWER_MAX_STEP_WH * 36000UL;
+        if (estimate > (int32_t)bound || estimate < -(int32_t)bound)
+        {
+            estimate = (estimate > 0) ? bound : -(int32_t)bound;
+            estimateError = (bound < POWER_MAX_ERROR) ? bound : POWER_MAX_ERROR;
+        }
+    }
+
+    int32_t power = 0;
+    uint16_t quality = POWER_UNKNOWN;
+    if (measured)
+    {
+        power = getValue(liveRegisters, OBIS_POWER);
+        quality = POWER_MEASURED;
+    }
+    else if (powerState == POWER_STATE_ESTIMATE)
+    {
+        power = estimate;
+        quality = POWER_ESTIMATED | estimateError;
+    }
+    setRegister<BLOCK_POWER>(POWER_VALUE, (uint16_t)((uint32_t)power >> 16));
+    setRegister<BLOCK_POWER>(POWER_VALUE + 1, (uint16_t)power);
+    setRegister<BLOCK_POWER>(POWER_QUALITY, quality);
+}
+
+#if SML_MESSAGE_DATA
+/*
+ * Meter and local clock are not synchronized, and the sensor time has a resolution of one second. So the offset
+ * between local commit time and sensor time is tracked, and latency is reported relative to its lower envelope,
+ * i.e. to the fastest recent frame.
+ */
+void ObisValues::updateLatency(uint32_t sensorTime, uint16_t serverId)
 {
-    uint16_t r = 0;
-    if (n == 0)
+    const uint16_t *smlRegisters = getBlock<BLOCK_SML>();
+    const uint32_t lastSensorTime = ((uint32_t)smlRegisters[SML_SENSOR_TIME] << 16) | smlRegisters[SML_SENSOR_TIME + 1];
+    if (sensorTime == 0)
+    {
+        setDiagnosticRegister(DIAG_SML_LATENCY, LATENCY_UNKNOWN);
+        return;
+    }
+    uint32_t offset = now - sensorTime * 1000;
+    uint32_t elapsed = sensorTime - lastSensorTime;
+    if (lastSensorTime == 0 || sensorTime < lastSensorTime || elapsed > LATENCY_MAX_GAP_S || serverId != smlRegisters[SML_SERVER_ID])
+    {
+        minOffset = offset; // First frame, meter restarted or replaced
+    }
+    else
     {
-        r = (uint16_t)(VERSION >> 16);
+        minOffset += elapsed * LATENCY_DRIFT_MS_PER_S;
+        if ((int32_t)(offset - minOffset) < 0)
+        {
+            minOffset = offset;
+        }
     }
-    else if (n == 1)
+    uint32_t latency = offset - minOffset;
+    setDiagnosticRegister(DIAG_SML_LATENCY, latency < LATENCY_UNKNOWN ? latency : LATENCY_UNKNOWN - 1);
+}
+#endif
+
+uint8_t ObisValues::getLiveRegistersCount()
+{
+    return registerPageCount(LIVE_REGISTERS_BASE >> 8);
+}
+
+uint16_t ObisValues::getLiveRegister(uint8_t n)
+{
+    return (n < getLiveRegistersCount()) ? registers[registerPageStart(LIVE_REGISTERS_BASE >> 8) + n] : 0;
+}
+
+#if TELEMETRY_PUSH
+uint32_t ObisValues::getChangedLiveRegisters()
+{
+    return changedLiveRegisters;
+}
+#endif
+
+#if SML_MESSAGE_DATA
+uint16_t ObisValues::getSmlRegister(uint8_t n)
+{
+    return (n < N_SML_REGISTERS) ? getBlock<BLOCK_SML>()[n] : 0;
+}
+#endif
+
+uint8_t ObisValues::getDiagnosticRegistersCount()
+{
+    return N_DIAGNOSTIC_REGISTERS;
+}
+
+uint16_t ObisValues::getDiagnosticRegister(uint8_t n)
+{
+    return (n < N_DIAGNOSTIC_REGISTERS) ? getBlock<BLOCK_DIAGNOSTICS>()[n] : 0;
+}
+
+void ObisValues::incrementDiagnosticRegister(uint8_t n)
+{
+    getBlock<BLOCK_DIAGNOSTICS>()[n]++;
+}
+
+void ObisValues::raiseDiagnosticRegister(uint8_t n, uint16_t value)
+{
+    uint16_t *diagnosticRegisters = getBlock<BLOCK_DIAGNOSTICS>();
+    if (diagnosticRegisters[n] < value)
     {
-        r = (uint16_t)(VERSION);
+        diagnosticRegisters[n] = value;
     }
-    else if (n < N_KNOWN_OBIS_REGISTERS + 2)
+}
+
+void ObisValues::setDiagnosticRegister(uint8_t n, uint16_t value)
+{
+    getBlock<BLOCK_DIAGNOSTICS>()[n] = value;
+}
+
+uint8_t ObisValues::checkInputRegisters(uint16_t address, uint16_t count)
+{
+    const uint8_t page = address >> 8;
+    const uint8_t offset = (uint8_t)address;
+    if (page >= N_REGISTER_PAGES                                        // Address high byte must select a register page
+        || count == 0                                                   // Register count must be positive
+        || offset + count > pgm_read_byte(&REGISTER_PAGES[page].count)) // Register access must not exceed the page, if any
     {
-        r = liveRegisters[n - 2];
+        return 0x02; // Illegal data address
     }
-    return r;
+    return 0x00;
+}
+
+const uint16_t *ObisValues::getInputRegisters(uint16_t address)
+{
+    return registers + pgm_read_byte(&REGISTER_PAGES[address >> 8].start) + (uint8_t)address;
 }
 
 // END
@@ -7,11 +7,265 @@
 
 #include <Arduino.h>
 
+// Version indicator, exposed via Input Registers 256, 257 and via Read Device Identification
+#define FIRMWARE_VERSION 2026101902
+
 #ifndef N_KNOWN_OBIS_CODES
 #define N_KNOWN_OBIS_CODES 3
 #endif
 #define N_KNOWN_OBIS_REGISTERS (N_KNOWN_OBIS_CODES*2)
 
+// OBIS codes beyond 1.8.0, 2.8.0 and 16.7.0, five bytes each, with N_KNOWN_OBIS_CODES to match, e.g.
+// -DN_KNOWN_OBIS_CODES=5 -DEXTRA_OBIS_CODES="{0x01, 0x00, 0x20, 0x07, 0x00}, {0x01, 0x00, 0x60, 0x01, 0x00}"
+#ifndef EXTRA_OBIS_CODES
+#define EXTRA_OBIS_CODES
+#endif
+
+// Value types taken per OBIS code, bit n for the n-th known code. Values of other types are skipped without decoding.
+// Signed and unsigned integers (up to 64 bit) are scaled to 32 bit; of octet strings, the last four bytes are taken,
+// e.g. the serial number of a server ID (1-0:96.1.0). For the example above: -DOBIS_UNSIGNED_CODES=0x08
+// -DOBIS_OCTET_CODES=0x10
+#ifndef OBIS_SIGNED_CODES
+#define OBIS_SIGNED_CODES ((1UL << N_KNOWN_OBIS_CODES) - 1)
+#endif
+#ifndef OBIS_UNSIGNED_CODES
+#define OBIS_UNSIGNED_CODES 0
+#endif
+#ifndef OBIS_OCTET_CODES
+#define OBIS_OCTET_CODES 0
+#endif
+#define N_COUNTER_REGISTERS 4 // 1.8.0 and 2.8.0, saved for a warm start
+
+// A value missing from a frame is kept until it was last received OBIS_TTL_MS ago, then reset to 0. Meters that send
+// some codes only every other frame need more than two frame periods. Codes in OBIS_PERSISTENT_CODES (bit n for the
+// n-th known code, default: the counters) never expire.
+#ifndef OBIS_TTL_MS
+#define OBIS_TTL_MS 5000
+#endif
+#ifndef OBIS_PERSISTENT_CODES
+#define OBIS_PERSISTENT_CODES 0x03
+#endif
+
+// Input register windows, selected by address high byte
+#define LIVE_REGISTERS_BASE 256       // Version and OBIS values
+#define DIAGNOSTIC_REGISTERS_BASE 512 // Diagnostics
+#define TRACE_REGISTERS_BASE 768      // Event trace
+#define VIEW_REGISTERS_BASE 1024      // Value views, with VALUE_VIEWS
+#define N_VERSION_REGISTERS 2
+
+// Power registers (16bit), exposed after the OBIS values: 16.7.0 if sent, otherwise derived from 1.8.0 and 2.8.0
+#define POWER_VALUE 0   // 0, 1: Power (A+ - A-) [W], 32 bit signed
+#define POWER_QUALITY 2 // POWER_MEASURED, POWER_ESTIMATED | error bound [W], or POWER_UNKNOWN
+#define N_POWER_REGISTERS 3
+#define POWER_MEASURED 0x0000
+#define POWER_ESTIMATED 0x8000
+#define POWER_UNKNOWN 0xFFFF
+
+// Warm start registers (16bit), exposed after the power registers, see WarmStart.h
+#define WARM_START_STALE 0 // 1 while 1.8.0 and 2.8.0 are restored from EEPROM, 0 from the first commit on
+#define N_WARM_START_REGISTERS 1
+
+// Value age registers (16bit), exposed after the warm start registers: per OBIS value, local time since it was last
+// received [ms], VALUE_AGE_UNKNOWN if longer or never. Advanced with every tick, not tracked as changes. Also what
+// values expire by, see OBIS_TTL_MS.
+#define N_VALUE_AGE_REGISTERS N_KNOWN_OBIS_CODES
+#define VALUE_AGE_UNKNOWN 0xFFFF
+
+// SML message level registers (16bit), with SML_MESSAGE_DATA: exposed after the value ages, taken from the
+// SML_GetList.Res message. The decoder keeps them until the commit. The latency (DIAG_SML_LATENCY) is derived from
+// them, 65535 without.
+#ifndef SML_MESSAGE_DATA
+#define SML_MESSAGE_DATA 0
+#endif
+#define SML_SENSOR_TIME 0  // 0, 1: actSensorTime [s], seconds index or UNIX time as sent by the meter, 0 if not sent
+#define SML_SERVER_ID 2    // X.25 CRC of the server ID, identifies the meter
+#define SML_TRANSACTION 3  // Last two bytes of the transaction ID, counts up with every frame on most meters
+#if SML_MESSAGE_DATA
+#define N_SML_REGISTERS 4
+#else
+#define N_SML_REGISTERS 0
+#endif
+
+// Minimum averaging time for the power estimate [ms]. Longer is smoother with fine counter resolution.
+#ifndef POWER_ESTIMATE_WINDOW_MS
+#define POWER_ESTIMATE_WINDOW_MS 10000
+#endif
+
+// Diagnostic registers (16bit), exposed via Input Registers 512, ...
+#define DIAG_TASK_WCET 0          // 0, 1, 2: Worst-case run time of scheduler tasks [8µs], in priority order
+#define DIAG_DEADLINE_MISSES 3    // Number of times a task had to be run ahead of higher priority tasks
+#define DIAG_FRAMES 4             // Number of frames committed (SML with good CRC, D0)
+#define DIAG_BAD_CRCS 5           // Number of SML frames dropped for bad CRC, D0 telegrams for bad parity
+#define DIAG_RESYNCS 6            // Number of times the SML decoder lost sync on unexpected input
+#define DIAG_INFO_DSS_BAUD 7      // INFO-DSS baud rate [100 baud], bit 15 set while detecting
+#define DIAG_SML_LATENCY 8        // Time from actSensorTime to commit [ms], relative to the fastest recent frame
+#define DIAG_FREE_STACK 9         // Lowest free stack since reset [bytes], see StackMonitor.h
+#define DIAG_WARM_START 10        // Generation of the last warm start record written or restored, low 16 bits
+#define DIAG_INFO_DSS_PROTOCOL 11 // INFO-DSS protocol: INFO_DSS_PROTOCOL_..., see ReadFromInfoDSS.h
+
+// IR link quality, see ReadFromInfoDSS.h. Histograms count frames per bucket.
+#ifndef INFO_DSS_LINK_QUALITY
+#define INFO_DSS_LINK_QUALITY 0
+#endif
+#define DIAG_FRAMING_ERRORS 12    // Number of bytes received with a framing error (USART1 FE1)
+#define DIAG_OVERRUNS 13          // Number of bytes lost to a data overrun (USART1 DOR1)
+#define DIAG_FRAME_PERIODS 14     // 14..21: Time since the previous frame, INFO_DSS_PERIOD_BUCKET_MS buckets, last open
+#define DIAG_FRAME_EXTRA_BYTES 22 // 22..29: Bytes received but not decoded per frame: 0, 1, 2..3, 4..7, ..., 64 and more
+#define N_LINK_BUCKETS 8
+#if INFO_DSS_LINK_QUALITY
+#define N_DIAGNOSTIC_REGISTERS (DIAG_FRAME_EXTRA_BYTES + N_LINK_BUCKETS)
+#else
+#define N_DIAGNOSTIC_REGISTERS 12
+#endif
+
+// Event trace (16bit registers), exposed via Input Registers 768, ...: Header, then a ring of TRACE_ENTRIES entries of
+// one register each, time [TRACE_TICK_MS] << 8 | event << 4 | argument, the low 8 bits of time and the low 4 bits of
+// the argument. Entry n % TRACE_ENTRIES holds the n-th event. Costs 4 + 2 * TRACE_ENTRIES bytes of SRAM, 0 turns it off.
+#ifndef TRACE_ENTRIES
+#define TRACE_ENTRIES 8
+#endif
+#define TRACE_COUNT 0 // Number of events so far, wraps around
+#define TRACE_NOW 1   // Current time [TRACE_TICK_MS]
+#define N_TRACE_HEADER_REGISTERS 2
+#if TRACE_ENTRIES
+#define N_TRACE_REGISTERS (N_TRACE_HEADER_REGISTERS + TRACE_ENTRIES)
+#else
+#define N_TRACE_REGISTERS 0
+#endif
+#define TRACE_TICK_SHIFT 10 // Timestamps [1.024s], wrap around after 4 minutes in the entries
+#define TRACE_TICK_MS (1 << TRACE_TICK_SHIFT)
+
+// Trace events and their argument, low 4 bits
+#define TRACE_BOOT 0             // 0
+#define TRACE_SML_RESYNC 1       // Decoder state
+#define TRACE_SML_BAD_CRC 2      // 0 SML, 1 D0 parity
+#define TRACE_SML_COMMIT 3       // Transaction ID, with SML_MESSAGE_DATA
+#define TRACE_MODBUS_REQUEST 4   // Function code
+#define TRACE_MODBUS_EXCEPTION 5 // Function code
+#define TRACE_MODBUS_BAD_CRC 6   // Unit address
+#define TRACE_MODBUS_OVERSIZE 7  // Function code. Request to us too long for the receive buffer, exception 0x01.
+#define TRACE_BAUD_CHANGE 8      // INFO-DSS baud rate candidate, see BaudDetector.h
+#define TRACE_DEADLINE_MISS 9    // Task index
+#define TRACE_PROTOCOL_CHANGE 10 // INFO_DSS_PROTOCOL_...
+#define N_TRACE_EVENTS 11
+
+#ifndef TRACE_EVENTS
+#define TRACE_EVENTS (~((1UL << TRACE_SML_COMMIT) | (1UL << TRACE_MODBUS_REQUEST)))
+#endif
+
+// Value view (16bit registers), exposed via Input Registers 1024, ... when built with VALUE_VIEWS: the OBIS values in
+// another representation, computed once per commit from the value and scaler as sent, narrowed to 32 bit. Two
+// registers per OBIS code, in the representation VALUE_VIEWS selects:
+#define VALUE_VIEW_FLOAT 1         // IEEE 754 single, high word first (ABCD), in 10^VALUE_VIEW_FLOAT_SCALER Wh or W
+#define VALUE_VIEW_FLOAT_SWAPPED 2 // The same, low word first (CDAB)
+#define VALUE_VIEW_SCALED 3        // 32 bit signed, in 10^VALUE_VIEW_SCALER Wh or W
+#ifndef VALUE_VIEWS
+#define VALUE_VIEWS 0
+#endif
+#ifndef VALUE_VIEW_SCALER
+#define VALUE_VIEW_SCALER -1 // e.g. -1 for 0.1Wh
+#endif
+#ifndef VALUE_VIEW_FLOAT_SCALER
+#define VALUE_VIEW_FLOAT_SCALER 0 // e.g. 3 for kWh and kW
+#endif
+#define N_VIEW_REGISTERS (2 * N_KNOWN_OBIS_CODES)
+
+/*
+ * Input Register map, see README. Each block is a number of consecutive registers at a fixed address.
+ *
+ * All registers are kept in one array, block after block in the order below. A page (address high byte) is served
+ * from that array with one bounds check: blocks in the same page must be adjacent, the first one at offset 0 of the
+ * page. To add a block, e.g. aggregates, append it here and give it a BLOCK_... index. Checked at compile time.
+ * A block that is not built has no registers, so the blocks after it keep their index.
+ */
+struct RegisterBlock
+{
+    uint16_t address; // First register
+    uint8_t count;    // Number of registers (16bit)
+};
+
+#define BLOCK_VERSION 0
+#define BLOCK_OBIS 1
+#define BLOCK_POWER 2
+#define BLOCK_WARM_START 3
+#define BLOCK_VALUE_AGE 4
+#define BLOCK_SML 5 // With SML_MESSAGE_DATA
+#define BLOCK_DIAGNOSTICS 6
+#define BLOCK_TRACE 7 // With TRACE_ENTRIES
+#if VALUE_VIEWS
+#define BLOCK_VIEW 8
+#define N_REGISTER_BLOCKS 9
+#else
+#define N_REGISTER_BLOCKS 8
+#endif
+
+static constexpr RegisterBlock REGISTER_MAP[N_REGISTER_BLOCKS] = {
+    {LIVE_REGISTERS_BASE, N_VERSION_REGISTERS},
+    {LIVE_REGISTERS_BASE + N_VERSION_REGISTERS, N_KNOWN_OBIS_REGISTERS},
+    {LIVE_REGISTERS_BASE + N_VERSION_REGISTERS + N_KNOWN_OBIS_REGISTERS, N_POWER_REGISTERS},
+    {LIVE_REGISTERS_BASE + N_VERSION_REGISTERS + N_KNOWN_OBIS_REGISTERS + N_POWER_REGISTERS, N_WARM_START_REGISTERS},
+    {LIVE_REGISTERS_BASE + N_VERSION_REGISTERS + N_KNOWN_OBIS_REGISTERS + N_POWER_REGISTERS + N_WARM_START_REGISTERS,
+     N_VALUE_AGE_REGISTERS},
+    {LIVE_REGISTERS_BASE + N_VERSION_REGISTERS + N_KNOWN_OBIS_REGISTERS + N_POWER_REGISTERS + N_WARM_START_REGISTERS +
+         N_VALUE_AGE_REGISTERS,
+     N_SML_REGISTERS},
+    {DIAGNOSTIC_REGISTERS_BASE, N_DIAGNOSTIC_REGISTERS},
+    {TRACE_REGISTERS_BASE, N_TRACE_REGISTERS},
+#if VALUE_VIEWS
+    {VIEW_REGISTERS_BASE, N_VIEW_REGISTERS},
+#endif
+};
+
+// Index of first register of block b in the register array
+constexpr uint16_t registerBlockStart(uint8_t b)
+{
+    return b == 0 ? 0 : registerBlockStart(b - 1) + REGISTER_MAP[b - 1].count;
+}
+
+// registerBlockStart(b) as a constant, so firmware code does not need REGISTER_MAP at run time (SRAM on AVR)
+template <uint8_t B>
+struct RegisterBlockStart
+{
+    static constexpr uint8_t value = registerBlockStart(B);
+};
+
+// Index of first register of page in the register array, number of registers in page
+constexpr uint16_t registerPageStart(uint8_t page, uint8_t b = 0)
+{
+    return b >= N_REGISTER_BLOCKS ? 0 : (REGISTER_MAP[b].address >> 8) == page ? registerBlockStart(b) : registerPageStart(page, b + 1);
+}
+constexpr uint16_t registerPageCount(uint8_t page, uint8_t b = 0)
+{
+    return b >= N_REGISTER_BLOCKS ? 0 : ((REGISTER_MAP[b].address >> 8) == page ? REGISTER_MAP[b].count : 0) + registerPageCount(page, b + 1);
+}
+
+constexpr bool isValidRegisterMap(uint8_t b = 0)
+{
+    return b >= N_REGISTER_BLOCKS ||
+           ((REGISTER_MAP[b].address & 0xFF) + REGISTER_MAP[b].count <= 0x100 &&
+            (b == 0 || (REGISTER_MAP[b].address >> 8) != (REGISTER_MAP[b - 1].address >> 8)
+                 ? (REGISTER_MAP[b].address & 0xFF) == 0 && (b == 0 || REGISTER_MAP[b].address > REGISTER_MAP[b - 1].address)
+                 : REGISTER_MAP[b].address == REGISTER_MAP[b - 1].address + REGISTER_MAP[b - 1].count) &&
+            isValidRegisterMap(b + 1));
+}
+
+#define N_INPUT_REGISTERS registerBlockStart(N_REGISTER_BLOCKS)
+#define N_REGISTER_PAGES ((REGISTER_MAP[N_REGISTER_BLOCKS - 1].address >> 8) + 1)
+
+static_assert(isValidRegisterMap(), "Register blocks must be ascending, each page starting at offset 0 without gaps");
+static_assert(N_INPUT_REGISTERS < 0x100, "Register offsets are 8 bit");
+static_assert(OBIS_TTL_MS < VALUE_AGE_UNKNOWN, "Value ages are 16 bit");
+static_assert((TRACE_ENTRIES & (TRACE_ENTRIES - 1)) == 0, "Number of trace entries must be 0 or a power of 2");
+static_assert(N_TRACE_EVENTS <= 16, "Trace events are 4 bit");
+static_assert(VALUE_VIEWS >= 0 && VALUE_VIEWS <= VALUE_VIEW_SCALED, "VALUE_VIEWS selects one of VALUE_VIEW_...");
+static_assert(registerPageStart(LIVE_REGISTERS_BASE >> 8) == 0 && registerPageCount(LIVE_REGISTERS_BASE >> 8) <= 32,
+              "Live registers must come first, change detection has one bit each");
+
+/*
+ * Round value * 10^scaler to an integer, half away from zero. For decoders that get the scaler with the value.
+ */
+int64_t scaleValue(int64_t value, int8_t scaler);
+
 class ObisValues
 {
 public:
@@ -27,17 +281,60 @@ public:
      */
     void feedObisOctetString(uint8_t *buf, uint8_t len);
 
+    /*
+     * Whether a recognized OBIS code has been fed, of one of the codes given, OBIS_..._CODES above. Decoders check
+     * this before decoding a value. False at compile time for a type no code takes.
+     */
+    inline bool expectsValue(uint32_t codes)
+    {
+        return codes && obisCodeDetected >= 0 && (codes & (1UL << obisCodeDetected));
+    }
+
     /*
      * Pass in value.
      * Will not have any effect unless recognized OBIS code has been fed before.
      */
     void feedObisValue(uint32_t value);
 
+#if VALUE_VIEWS
+    /*
+     * Pass in the value as sent, with its scaler, instead of the value. Scaled at commit, together with the view.
+     */
+    void feedObisRawValue(int64_t raw, int8_t scaler);
+#endif
+
+#if SML_MESSAGE_DATA
+    /*
+     * SML message level data of the frame, see SML_... above. Call right before commit(), the registers are written
+     * with it.
+     */
+    void feedMessageData(uint32_t sensorTime, uint16_t serverId, uint16_t transaction);
+#endif
+
+    /*
+     * Current local time [ms]. Call before feeding input, commits and trace events are timestamped with it. Updates
+     * the value ages.
+     */
+    void tick(uint32_t now_);
+
     /*
      * Make fed values become "visible" to consumer.
      */
     void commit();
 
+    /*
+     * Warm start: Set the registers below N_COUNTER_REGISTERS (the counters) to values saved before a reset,
+     * flagged as stale until the first commit.
+     */
+    void restore(const uint16_t *values);
+
+#if TELEMETRY_PUSH
+    /*
+     * Live registers that were changed by the last commit, bit n for live register n.
+     */
+    uint32_t getChangedLiveRegisters();
+#endif
+
     /*
      * Number of registers (16bit) is twice the number of values (32bit)
      */
@@ -48,12 +345,100 @@ public:
      */
     uint16_t getLiveRegister(uint8_t n);
 
+#if SML_MESSAGE_DATA
+    /*
+     * SML message level registers, see SML_... above.
+     */
+    uint16_t getSmlRegister(uint8_t n);
+#endif
+
+    /*
+     * Diagnostic registers, see DIAG_... above. Counters wrap around.
+     */
+    uint8_t getDiagnosticRegistersCount();
+    uint16_t getDiagnosticRegister(uint8_t n);
+    void incrementDiagnosticRegister(uint8_t n);
+    void raiseDiagnosticRegister(uint8_t n, uint16_t value); // Keep maximum value
+    void setDiagnosticRegister(uint8_t n, uint16_t value);
+
+    /*
+     * Record an event in the trace, see TRACE_... above. Events not in TRACE_EVENTS, or all without the trace, compile
+     * to nothing.
+     */
+#if TRACE_ENTRIES
+    inline void trace(uint8_t event, uint8_t arg)
+    {
+        if (TRACE_EVENTS & (1UL << event))
+        {
+            addTrace(event, arg);
+        }
+    }
+#else
+    inline void trace(uint8_t, uint8_t)
+    {
+    }
+#endif
+
+    /*
+     * Input Register map as seen by Modbus masters, see README. Used by the RTU slave as well as by host tools.
+     * Return 0x00 if count registers can be read starting at address, otherwise the Modbus Exception Code.
+     */
+    uint8_t checkInputRegisters(uint16_t address, uint16_t count);
+
+    /*
+     * Get consecutive register values, starting at address. Address and count must have been checked before.
+     */
+    const uint16_t *getInputRegisters(uint16_t address);
+
 private:
     int8_t obisCodeDetected;
 
-    uint16_t liveRegisters[N_KNOWN_OBIS_REGISTERS];
+    uint16_t registers[N_INPUT_REGISTERS]; // All blocks of REGISTER_MAP
     uint16_t tempRegisters[N_KNOWN_OBIS_REGISTERS];
-    bool registerIsSet[N_KNOWN_OBIS_REGISTERS];
+    uint8_t codesSet; // Bit n: n-th known code fed since the last commit
+    bool isExpired(uint8_t cc);
+#if VALUE_VIEWS
+    int8_t tempScaler[N_KNOWN_OBIS_CODES]; // tempRegisters hold the value as sent, narrowed to 32 bit
+    void updateView(uint8_t cc, int64_t raw, int8_t scaler);
+#endif
+
+    uint32_t now;
+
+#if SML_MESSAGE_DATA
+    // Latency: Offset between local time and sensor time, lower envelope thereof
+    uint32_t minOffset;
+    void updateLatency(uint32_t sensorTime, uint16_t serverId);
+#endif
+
+    // Power estimate: Net energy and time at the last counter change and at the start of the averaging window
+    uint8_t powerState;
+    int32_t lastEnergy;
+    uint32_t lastChange;
+    int32_t windowEnergy;
+    uint32_t windowStart;
+    uint16_t resolution; // [Wh], smallest counter step seen, 0 before the first change
+    int32_t estimate;    // [W]
+    uint16_t estimateError;
+    void updatePower(bool measured);
+
+    template <uint8_t B>
+    uint16_t *getBlock()
+    {
+        return registers + RegisterBlockStart<B>::value;
+    }
+    template <uint8_t B>
+    void setRegister(uint8_t n, uint16_t value) // Live registers only, tracks changes
+    {
+        setLiveRegister(RegisterBlockStart<B>::value + n, value);
+    }
+    void setLiveRegister(uint8_t rr, uint16_t value);
+#if TRACE_ENTRIES
+    void addTrace(uint8_t event, uint8_t arg);
+#endif
+
+#if TELEMETRY_PUSH
+    uint32_t changedLiveRegisters;
+#endif
 };
 
 #endif // __OBISVALUES_H
@@ -0,0 +1,244 @@
+/*
+ * ObisValues on the host: Drives commits and ticks with a simulated clock and checks the power estimate. The counters
+ * advance in 1 Wh steps at a constant power without 16.7.0: once estimated, the true power must lie within the
+ * reported error bound, and the estimate must decay when the counters stop. A counter jump beyond POWER_MAX_STEP_WH
+ * (meter replaced) must start over.
+ *
+ * Value expiry: 16.7.0 sent only in every other frame is kept, zeroed OBIS_TTL_MS after it was last received, while
+ * the counters (OBIS_PERSISTENT_CODES) are kept for good. Ticks come more often than frames, as on the unit.
+ *
+ * Trace: More events than TRACE_ENTRIES keep the last ones, each packed into one register with its time and argument.
+ *
+ * g++ -O2 -I . -D__TEST__=1 -o test-obis ObisValuesTest.cpp ObisValues.cpp
+ * ./test-obis
+ */
+
+#include <stdio.h>
+#include "ObisValues.h"
+
+#if __TEST__
+#include <string.h>
+
+#define FRAME_MS 1000
+#define TRUE_POWER_W 537
+#define METER_REPLACED_WH 100000 // Jump beyond POWER_MAX_STEP_WH
+#define CC_IMPORT 0 // Index of the known codes, as in ObisValues.cpp
+#define CC_EXPORT 1
+#define CC_POWER 2
+
+static const uint8_t OBIS_IMPORT_CODE[6] = {0x01, 0x00, 0x01, 0x08, 0x00, 0xFF};
+static const uint8_t OBIS_EXPORT_CODE[6] = {0x01, 0x00, 0x02, 0x08, 0x00, 0xFF};
+static const uint8_t OBIS_POWER_CODE[6] = {0x01, 0x00, 0x10, 0x07, 0x00, 0xFF};
+
+static void feed(ObisValues &obisValues, const uint8_t *obis, uint32_t value)
+{
+    uint8_t buf[6];
+    memcpy(buf, obis, sizeof(buf));
+    obisValues.feedObisOctetString(buf, sizeof(buf));
+    obisValues.feedObisValue(value);
+}
+
+static int32_t getPower(ObisValues &obisValues)
+{
+    const uint8_t rr = registerBlockStart(BLOCK_POWER) + POWER_VALUE;
+    return (int32_t)(((uint32_t)obisValues.getLiveRegister(rr) << 16) | obisValues.getLiveRegister(rr + 1));
+}
+
+static uint16_t getQuality(ObisValues &obisValues)
+{
+    return obisValues.getLiveRegister(registerBlockStart(BLOCK_POWER) + POWER_QUALITY);
+}
+
+static bool isEstimated(uint16_t quality)
+{
+    return quality != POWER_UNKNOWN && (quality & POWER_ESTIMATED);
+}
+
+// One frame with the counters only, at local time t
+static void frame(ObisValues &obisValues, uint32_t t, uint32_t imported)
+{
+    obisValues.tick(t);
+    feed(obisValues, OBIS_IMPORT_CODE, imported);
+    feed(obisValues, OBIS_EXPORT_CODE, 0);
+    obisValues.commit();
+}
+
+/*
+ * Frames every FRAME_MS at TRUE_POWER_W for seconds, from energy [Wh]. Every estimate must hold the true power within
+ * its error bound. Return the number of frames with an estimate.
+ */
+static int run(ObisValues &obisValues, uint32_t *t, double *energy, int seconds, int *failures)
+{
+    int estimated = 0;
+    for (int k = 0; k < seconds * 1000 / FRAME_MS; k++)
+    {
+        *t += FRAME_MS;
+        *energy += TRUE_POWER_W * (FRAME_MS / 1000.0) / 3600;
+        frame(obisValues, *t, (uint32_t)*energy);
+        const uint16_t quality = getQuality(obisValues);
+        if (isEstimated(quality))
+        {
+            estimated++;
+            const int32_t error = quality & ~POWER_ESTIMATED;
+            const int32_t power = getPower(obisValues);
+            if (power - error > TRUE_POWER_W || power + error < TRUE_POWER_W)
+            {
+                printf("t = %us: %d W +- %d W does not hold %d W\n", *t / 1000, power, error, TRUE_POWER_W);
+                (*failures)++;
+            }
+        }
+    }
+    return estimated;
+}
+
+static int32_t getValue(ObisValues &obisValues, uint8_t cc)
+{
+    const uint8_t rr = registerBlockStart(BLOCK_OBIS) + 2 * cc;
+    return (int32_t)(((uint32_t)obisValues.getLiveRegister(rr) << 16) | obisValues.getLiveRegister(rr + 1));
+}
+
+static uint16_t getAge(ObisValues &obisValues, uint8_t cc)
+{
+    return obisValues.getLiveRegister(registerBlockStart(BLOCK_VALUE_AGE) + cc);
+}
+
+// Ticks every TICK_MS up to t, then a frame with the counters and, if given, 16.7.0
+#define TICK_MS 100
+static void tickAndFrame(ObisValues &obisValues, uint32_t *t, uint32_t until, bool withPower)
+{
+    while (*t < until)
+    {
+        *t += TICK_MS;
+        obisValues.tick(*t);
+    }
+    feed(obisValues, OBIS_IMPORT_CODE, 4711);
+    feed(obisValues, OBIS_EXPORT_CODE, 815);
+    if (withPower)
+    {
+        feed(obisValues, OBIS_POWER_CODE, 250);
+    }
+    obisValues.commit();
+}
+
+static int checkExpiry()
+{
+    ObisValues obisValues = ObisValues();
+    int failures = 0;
+    uint32_t t = 0;
+
+    // 16.7.0 in every other frame: kept in between
+    bool kept = true;
+    for (int k = 0; k < 20; k++)
+    {
+        tickAndFrame(obisValues, &t, t + FRAME_MS, k % 2 == 0);
+        kept &= getValue(obisValues, CC_POWER) == 250 && getAge(obisValues, CC_POWER) == (k % 2) * FRAME_MS;
+    }
+    printf("Alternate: 16.7.0 %s\n", kept ? "kept" : "FAIL");
+    failures += !kept;
+
+    // 16.7.0 no longer sent: kept while younger than OBIS_TTL_MS, then 0
+    const uint32_t last = t - FRAME_MS;
+    bool expires = true;
+    for (int k = 0; k < 10; k++)
+    {
+        tickAndFrame(obisValues, &t, t + FRAME_MS, false);
+        const bool young = t - last < OBIS_TTL_MS;
+        expires &= getAge(obisValues, CC_POWER) == t - last && getValue(obisValues, CC_POWER) == (young ? 250 : 0);
+    }
+    printf("Expiry:    16.7.0 %s after %u ms\n", expires ? "zeroed" : "FAIL", OBIS_TTL_MS);
+    failures += !expires;
+
+    // Counters not sent for longer than a value age can tell: still kept
+    for (uint32_t until = t + 2 * VALUE_AGE_UNKNOWN; t < until;)
+    {
+        t += TICK_MS;
+        obisValues.tick(t);
+        obisValues.commit();
+    }
+    const bool persistent = getValue(obisValues, CC_IMPORT) == 4711 && getValue(obisValues, CC_EXPORT) == 815 &&
+                            getAge(obisValues, CC_IMPORT) == VALUE_AGE_UNKNOWN &&
+                            getAge(obisValues, CC_POWER) == VALUE_AGE_UNKNOWN;
+    printf("Counters:  %s after %us\n", persistent ? "kept" : "FAIL", 2 * VALUE_AGE_UNKNOWN / 1000);
+    failures += !persistent;
+    return failures;
+}
+
+static int checkTrace()
+{
+#if TRACE_ENTRIES
+    ObisValues obisValues = ObisValues(); // Boot event at 0
+    const uint32_t n = TRACE_ENTRIES + 3;
+    for (uint32_t k = 1; k < n; k++)
+    {
+        obisValues.tick(k * 300 * TRACE_TICK_MS); // Beyond 8 bits of ticks for the last ones
+        obisValues.trace(TRACE_DEADLINE_MISS, k);
+    }
+    const uint16_t *trace = obisValues.getInputRegisters(TRACE_REGISTERS_BASE);
+    bool ok = trace[TRACE_COUNT] == n && trace[TRACE_NOW] == (uint16_t)((n - 1) * 300);
+    for (uint32_t k = n - TRACE_ENTRIES; k < n; k++)
+    {
+        const uint16_t entry = trace[N_TRACE_HEADER_REGISTERS + k % TRACE_ENTRIES];
+        ok &= entry == (uint16_t)(((k * 300) << 8) | (TRACE_DEADLINE_MISS << 4) | (k & 0x0F));
+    }
+    printf("Trace:     %s, %u events in %u entries\n", ok ? "last kept" : "FAIL", n, TRACE_ENTRIES);
+    return !ok;
+#else
+    return 0;
+#endif
+}
+
+int main()
+{
+    ObisValues obisValues = ObisValues();
+    int failures = 0;
+    uint32_t t = 0;
+    double energy = 4710942;
+
+    // Counters only: estimated after two counter changes and one averaging window
+    const int estimated = run(obisValues, &t, &energy, 120, &failures);
+    const int32_t power = getPower(obisValues);
+    const uint16_t error = getQuality(obisValues) & ~POWER_ESTIMATED;
+    printf("Estimate:  %d W +- %u W for %d W, in %d of 120 frames\n", power, error, TRUE_POWER_W, estimated);
+    failures += estimated < 100;
+
+    // Counters stop: below one step (1 Wh) since the last change, i.e. below 3600 W / seconds since
+    int32_t last = getPower(obisValues);
+    bool decays = true;
+    for (int k = 0; k < 120; k++)
+    {
+        t += FRAME_MS;
+        frame(obisValues, t, (uint32_t)energy);
+        const int32_t p = getPower(obisValues);
+        decays &= isEstimated(getQuality(obisValues)) && p <= last;
+        last = p;
+    }
+    printf("Stopped:   %d W +- %u W after 120s\n", last, getQuality(obisValues) & ~POWER_ESTIMATED);
+    failures += !decays || last > 3600 / 120;
+
+    // Meter replaced: the counter jumps, the estimate starts over
+    energy += METER_REPLACED_WH;
+    t += FRAME_MS;
+    frame(obisValues, t, (uint32_t)energy);
+    const bool restarted = getQuality(obisValues) == POWER_UNKNOWN && getPower(obisValues) == 0;
+    const int again = run(obisValues, &t, &energy, 60, &failures);
+    printf("Jump:      %s, estimated again in %d of 60 frames\n", restarted ? "started over" : "FAIL", again);
+    failures += !restarted || again == 0;
+
+    // 16.7.0 sent: taken as measured
+    t += FRAME_MS;
+    obisValues.tick(t);
+    feed(obisValues, OBIS_POWER_CODE, (uint32_t)-123);
+    obisValues.commit();
+    const bool measured = getPower(obisValues) == -123 && getQuality(obisValues) == POWER_MEASURED;
+    printf("Measured:  %d W, quality %u\n", getPower(obisValues), getQuality(obisValues));
+    failures += !measured;
+
+    failures += checkExpiry();
+    failures += checkTrace();
+
+    printf("%s\n", failures ? "FAIL" : "OK");
+    return failures ? 1 : 0;
+}
+#endif
+
+// END
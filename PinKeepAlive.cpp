@@ -12,7 +12,7 @@
 #error Please copy meterpin-sample.h to meterpin.h and amend to your PIN
 #endif
 #endif
-static const char PIN[] = METER_PIN;
+static const char PIN[] PROGMEM = METER_PIN;
 
 #define LED_W PIN_PB0 // Physical Pin 2
 #ifndef LED_ON
@@ -49,11 +49,16 @@ static const char PIN[] = METER_PIN;
 #endif
 
 
-static int queue[4 + (sizeof(PIN) - 1) * 19 + 1]; // 4 setup, then max 9 pulses with gap1 for each digit, then gap2. Maybe one to force pin mode.
+#define PIN_ENTRY 60000 // Queue entry for the whole PIN entry: setup flashes, then the digits. Expanded by pop().
+#define SETUP_STEPS 5   // Setup as a digit 2 with gap0, without gap2: short pulse, gap0, short pulse, gap0
+
+static int queue[3]; // Two entries at most (keep-alive, or force pin mode and PIN entry), one left free.
 static uint8_t pr = 0;
 static uint8_t pw = 0;
 static uint8_t tocks = 0; // 1 tock is one keep-alive period (about 100s)
 static uint16_t nn = 0;
+static uint8_t pin = 0;   // While entering the PIN: 1 during setup, then 2 + index of the digit being flashed. 0 otherwise.
+static uint8_t steps = 0; // Left of the setup or digit being flashed: pulses and gaps alternating, then gap2
 
 void push(unsigned int onOrOff, unsigned int ticks)
 {
@@ -64,12 +69,40 @@ void push(unsigned int onOrOff, unsigned int ticks)
 
 unsigned int pop()
 {
+    if (steps)
+    {
+        steps--;
+        if (steps == 0 && pin == 1)
+        {
+            return pop(); // Setup done, no gap2
+        }
+        const unsigned int gap = (pin == 1) ? DIGIT_GAP0_TICKS : DIGIT_GAP1_TICKS;
+        return steps == 0 ? DIGIT_GAP2_TICKS : (steps & 1) ? gap : 50000 + SHORT_PULSE_TICKS;
+    }
+    if (pin)
+    {
+        // Next PIN digit d: d x (short pulse, gap1), then gap2
+        const char c = pgm_read_byte(PIN + pin - 1);
+        if (c >= '0' && c <= '9')
+        {
+            steps = 2 * (c - '0') + 1;
+            pin++;
+            return pop();
+        }
+        pin = 0;
+    }
     unsigned int d = 0;
     if (pr != pw)
     {
         d = queue[pr];
         pr = (pr + 1) % (sizeof(queue) / sizeof(queue[0]));
     }
+    if (d == PIN_ENTRY)
+    {
+        pin = 1;
+        steps = SETUP_STEPS;
+        return pop();
+    }
     return d;
 }
 
@@ -79,35 +112,21 @@ void clearQueue()
     pr = 0;
     nn = 0;
     tocks = 0;
+    pin = 0;
+    steps = 0;
 }
 
 // Section: Implementation PinKeepAlive - Flashing the LED
 
 void pushPinEntry()
 {
-    const char *p = PIN;
-    if (!*p)
+    if (!pgm_read_byte(PIN))
     {
         return; // Disable PIN entry via empty PIN.
     }
 
-    // Start with two short pulse flashes to get to the PIN entry mode
-    push(LED_ON, SHORT_PULSE_TICKS);
-    push(LED_OFF, DIGIT_GAP0_TICKS);
-    push(LED_ON, SHORT_PULSE_TICKS);
-    push(LED_OFF, DIGIT_GAP0_TICKS);
-
-    // Then, for each PIN digit, register respective flashes
-    while (*p >= '0' && *p <= '9')
-    {
-        unsigned int digit = *p++ - '0';
-        while (digit--)
-        {
-            push(LED_ON, SHORT_PULSE_TICKS);
-            push(LED_OFF, DIGIT_GAP1_TICKS);
-        }
-        push(LED_OFF, DIGIT_GAP2_TICKS);
-    }
+    // Two short pulse flashes to get to the PIN entry mode, then, for each PIN digit, the respective flashes
+    push(LED_OFF, PIN_ENTRY);
 }
 
 void onTickPinKeepAlive()
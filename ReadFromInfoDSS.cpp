@@ -5,24 +5,290 @@
 #include <Arduino.h>
 #include "ReadFromInfoDSS.h"
 #include "TinySMLDecoder.h"
+#if INFO_DSS_AUTO_BAUD
+#include "BaudDetector.h"
+#endif
+#if TELEMETRY_PUSH
+#include "Telemetry.h"
+#endif
 
+static ObisValues *obisValues;
+
+#if INFO_DSS_AUTO_PROTOCOL
+static_assert(INFO_DSS_PROTOCOL_TIMEOUT_MS >> 8 <= 0xFFFF, "Protocol timeout in 256ms units must fit 16 bit");
+
+static InfoDSSDecoders *decoders;
+static uint8_t protocol = INFO_DSS_PROTOCOL_UNKNOWN;
+static uint8_t lastFrames;     // Low byte of DIAG_FRAMES, a byte per tick cannot commit 256 frames
+static uint16_t lastFrameTime; // millis() in 256ms units
+#else
 static TinySMLDecoder *tinySMLDecoder;
+#endif
+
+#if INFO_DSS_AUTO_BAUD
+static BaudDetector baudDetector = BaudDetector(INFO_DSS_BAUD);
+#endif
+#if TELEMETRY_PUSH
+static TelemetryEncoder telemetryEncoder = TelemetryEncoder();
+#endif
+#if TELEMETRY_PUSH || INFO_DSS_LINK_QUALITY
+static uint16_t frames = 0;
+#endif
+
+#if INFO_DSS_LINK_QUALITY
+static uint16_t received;       // Bytes since the last commit
+static uint16_t lastCommitTime; // millis() in 16ms units, wraps after 17 minutes
+static bool hasCommitted;
+
+/*
+ * The core's Serial1 reads UDR1 in its interrupt and drops the error flags. Its receive interrupt is disabled instead,
+ * and the receiver polled: the flags of a byte are read before the byte.
+ */
+static bool isReceived()
+{
+    return UCSR1A & (1 << RXC1);
+}
+
+static uint8_t receive()
+{
+    const uint8_t status = UCSR1A; // Flags of the byte in UDR1, gone once it is read
+    const uint8_t cc = UDR1;
+    if (status & (1 << FE1))
+    {
+        obisValues->incrementDiagnosticRegister(DIAG_FRAMING_ERRORS);
+    }
+    if (status & (1 << DOR1))
+    {
+        obisValues->incrementDiagnosticRegister(DIAG_OVERRUNS);
+    }
+    return cc;
+}
+
+static uint8_t getExtraBytesBucket(uint16_t extra)
+{
+    uint8_t bucket = 0;
+    while (extra && bucket < N_LINK_BUCKETS - 1)
+    {
+        extra >>= 1;
+        bucket++;
+    }
+    return bucket;
+}
+
+static void onCommitLinkQuality(uint16_t frameLength)
+{
+    const uint16_t now = millis() >> 4;
+    if (hasCommitted)
+    {
+        const uint32_t bucket = ((uint32_t)(uint16_t)(now - lastCommitTime) * 16 + INFO_DSS_PERIOD_BUCKET_MS / 2) /
+                                INFO_DSS_PERIOD_BUCKET_MS;
+        obisValues->incrementDiagnosticRegister(DIAG_FRAME_PERIODS + (bucket < N_LINK_BUCKETS ? bucket : N_LINK_BUCKETS - 1));
+    }
+    obisValues->incrementDiagnosticRegister(DIAG_FRAME_EXTRA_BYTES +
+                                            getExtraBytesBucket(received > frameLength ? received - frameLength : 0));
+    hasCommitted = true;
+    lastCommitTime = now;
+    received = 0;
+}
+#else
+static bool isReceived()
+{
+    return Serial1.available() > 0;
+}
+
+static uint8_t receive()
+{
+    return Serial1.read();
+}
+#endif // INFO_DSS_LINK_QUALITY
+
+static void endInfoDSS()
+{
+    Serial1.end();
+}
+
+static void beginInfoDSS(uint32_t baud)
+{
+    Serial1.begin(baud, SERIAL_8N1);
+    while (!Serial1)
+        ;
+#if INFO_DSS_LINK_QUALITY
+    UCSR1B &= ~(1 << RXCIE1); // Polled, see receive()
+#endif
+#if __DEBUG__ || TELEMETRY_PUSH
+        // Do not disable TX
+#else
+    // https://github.com/SpenceKonde/ATTinyCore/blob/v2.0.0-devThis-is-the-head-submit-PRs-against-this/avr/extras/ATtiny_x41.md#uart-serial-support
+    UCSR1B &= ~(1 << TXEN1); // disable TX, we only ever read from INFO DSS
+#endif // __DEBUG__ || TELEMETRY_PUSH
+}
+
+#if INFO_DSS_AUTO_PROTOCOL
+static void setProtocol(uint8_t protocol_)
+{
+    if (protocol != protocol_)
+    {
+        protocol = protocol_;
+        obisValues->setDiagnosticRegister(DIAG_INFO_DSS_PROTOCOL, protocol);
+        obisValues->trace(TRACE_PROTOCOL_CHANGE, protocol);
+    }
+    if (protocol == INFO_DSS_PROTOCOL_SML)
+    {
+        decoders->sml.reset();
+    }
+    else if (protocol == INFO_DSS_PROTOCOL_D0)
+    {
+        decoders->d0.reset();
+    }
+    else
+    {
+        decoders->recent = 0;
+    }
+    lastFrames = obisValues->getDiagnosticRegister(DIAG_FRAMES);
+    lastFrameTime = millis() >> 8;
+}
+
+static bool isLetter(uint8_t c)
+{
+    c = (c & 0x7F) | 0x20;
+    return c >= 'a' && c <= 'z';
+}
+
+/*
+ * SML starts with 1B 1B 1B 1B, D0 with '/' and the three letter manufacturer ID. Once one of them is seen, its decoder
+ * gets those four bytes, and all bytes after them.
+ */
+static void detectProtocol(uint8_t cc)
+{
+    decoders->recent = (decoders->recent << 8) | cc;
+    const uint32_t start = decoders->recent; // Gone once a decoder is reset
+    if (start == 0x1B1B1B1B)
+    {
+        setProtocol(INFO_DSS_PROTOCOL_SML);
+        for (uint8_t k = 0; k < 4; k++)
+        {
+            decoders->sml.feed(0x1B);
+        }
+    }
+    else if (((start >> 24) & 0x7F) == '/' && isLetter(start >> 16) && isLetter(start >> 8) && isLetter(start))
+    {
+        setProtocol(INFO_DSS_PROTOCOL_D0);
+        for (int8_t k = 24; k >= 0; k -= 8)
+        {
+            decoders->d0.feed((uint8_t)(start >> k));
+        }
+    }
+}
+#endif
+
+bool isInfoDSSPending()
+{
+#if INFO_DSS_AUTO_BAUD
+    if (baudDetector.update(millis(), obisValues->getDiagnosticRegister(DIAG_FRAMES)))
+    {
+        // Next candidate: drop whatever was received at the old rate
+        obisValues->trace(TRACE_BAUD_CHANGE, baudDetector.getCandidate());
+        endInfoDSS();
+        beginInfoDSS(baudDetector.getBaud());
+#if INFO_DSS_AUTO_PROTOCOL
+        setProtocol(INFO_DSS_PROTOCOL_UNKNOWN);
+#else
+        tinySMLDecoder->reset();
+#endif
+    }
+    obisValues->setDiagnosticRegister(DIAG_INFO_DSS_BAUD, baudDetector.getRegister());
+#endif
+#if TELEMETRY_PUSH
+    if (telemetryEncoder.isPending() && Serial1.availableForWrite() > 0)
+    {
+        return true;
+    }
+#endif
+    return isReceived();
+}
 
 void onTickInfoDSS()
 {
-    if (Serial1.available() > 0)
+    if (isReceived())
     {
-        uint8_t cc = Serial1.read();
+        uint8_t cc = receive();
+#if INFO_DSS_LINK_QUALITY
+        received++;
+#endif
+#if INFO_DSS_AUTO_PROTOCOL
+        if (protocol == INFO_DSS_PROTOCOL_SML)
+        {
+            decoders->sml.feed(cc);
+        }
+        else if (protocol == INFO_DSS_PROTOCOL_D0)
+        {
+            decoders->d0.feed(cc);
+        }
+        else
+        {
+            detectProtocol(cc);
+        }
+        if (protocol != INFO_DSS_PROTOCOL_UNKNOWN)
+        {
+            if ((uint8_t)obisValues->getDiagnosticRegister(DIAG_FRAMES) != lastFrames)
+            {
+                lastFrames = obisValues->getDiagnosticRegister(DIAG_FRAMES);
+                lastFrameTime = millis() >> 8;
+            }
+            else if ((uint16_t)((millis() >> 8) - lastFrameTime) > (INFO_DSS_PROTOCOL_TIMEOUT_MS >> 8))
+            {
+                setProtocol(INFO_DSS_PROTOCOL_UNKNOWN);
+            }
+        }
+#else
         tinySMLDecoder->feed(cc);
+#endif
+#if INFO_DSS_AUTO_BAUD
+        baudDetector.feed(cc);
+#endif
+#if TELEMETRY_PUSH || INFO_DSS_LINK_QUALITY
+        if (obisValues->getDiagnosticRegister(DIAG_FRAMES) != frames)
+        {
+            frames = obisValues->getDiagnosticRegister(DIAG_FRAMES);
+#if TELEMETRY_PUSH
+            telemetryEncoder.onCommit(obisValues->getChangedLiveRegisters());
+#endif
+#if INFO_DSS_LINK_QUALITY
+#if INFO_DSS_AUTO_PROTOCOL
+            onCommitLinkQuality(protocol == INFO_DSS_PROTOCOL_D0 ? decoders->d0.getFrameLength()
+                                                                 : decoders->sml.getFrameLength());
+#else
+            onCommitLinkQuality(tinySMLDecoder->getFrameLength());
+#endif
+#endif
+        }
+#endif
     }
+#if TELEMETRY_PUSH
+    // One byte at a time, never wait for the TX buffer
+    if (telemetryEncoder.isPending() && Serial1.availableForWrite() > 0)
+    {
+        Serial1.write(telemetryEncoder.next(obisValues));
+    }
+#endif
 }
 
-void setupInfoDSS(TinySMLDecoder *tinySMLDecoder_)
+#if INFO_DSS_AUTO_PROTOCOL
+void setupInfoDSS(InfoDSSDecoders *decoders_, ObisValues *obisValues_)
+{
+    decoders = decoders_;
+    decoders->recent = 0;
+#else
+void setupInfoDSS(TinySMLDecoder *tinySMLDecoder_, ObisValues *obisValues_)
 {
     tinySMLDecoder = tinySMLDecoder_;
-    Serial1.begin(INFO_DSS_BAUD, SERIAL_8N1);
-    while (!Serial1)
-        ;
+#endif
+    obisValues = obisValues_;
+    obisValues->setDiagnosticRegister(DIAG_INFO_DSS_BAUD, INFO_DSS_BAUD / 100);
+#if !INFO_DSS_AUTO_PROTOCOL
+    obisValues->setDiagnosticRegister(DIAG_INFO_DSS_PROTOCOL, INFO_DSS_PROTOCOL_SML);
+#endif
+    beginInfoDSS(INFO_DSS_BAUD);
 }
 
 // END
@@ -6,14 +6,69 @@
 #define __READFROMINFODSS_H
 
 #include <Arduino.h>
+#include "ObisValues.h"
 #include "TinySMLDecoder.h"
+#include "TinyD0Decoder.h"
 
 #ifndef INFO_DSS_BAUD
 #define INFO_DSS_BAUD 9600
 #endif
 
+// Detect the baud rate, starting with INFO_DSS_BAUD. See BaudDetector.h.
+#ifndef INFO_DSS_AUTO_BAUD
+#define INFO_DSS_AUTO_BAUD 0
+#endif
+
+// Detect the protocol from the start of each meter's first frame: SML, or D0 (IEC 62056-21 mode D, see TinyD0Decoder.h).
+// Detection starts over after INFO_DSS_PROTOCOL_TIMEOUT_MS without a frame.
+#ifndef INFO_DSS_AUTO_PROTOCOL
+#define INFO_DSS_AUTO_PROTOCOL 0
+#endif
+#ifndef INFO_DSS_PROTOCOL_TIMEOUT_MS
+#define INFO_DSS_PROTOCOL_TIMEOUT_MS 30000
+#endif
+#define INFO_DSS_PROTOCOL_UNKNOWN 0 // Detecting
+#define INFO_DSS_PROTOCOL_SML 1
+#define INFO_DSS_PROTOCOL_D0 2
+
+// Send a telemetry frame after each commit on TXD1, see Telemetry.h. Uses the INFO-DSS baud rate.
+#ifndef TELEMETRY_PUSH
+#define TELEMETRY_PUSH 0
+#endif
+
+#if TELEMETRY_PUSH && __DEBUG__
+#error "Debug output and push telemetry both use TXD1"
+#endif
+
+// IR link quality (INFO_DSS_LINK_QUALITY, see ObisValues.h): USART1 framing errors and overruns, and histograms of the
+// time between frames and of the bytes received but not decoded per frame. USART1 is polled rather than received by
+// Serial1's interrupt, which drops the error flags: the scheduler's 2ms deadline keeps up with the receiver's two byte
+// FIFO at 9600 baud, at higher rates the overruns count the polling's misses as well.
+#ifndef INFO_DSS_PERIOD_BUCKET_MS
+#define INFO_DSS_PERIOD_BUCKET_MS 500 // Bucket n holds n * 500ms +- 250ms, a lost frame shows as a double period
+#endif
+
+#if INFO_DSS_AUTO_PROTOCOL
+// Only one decoder is fed once the protocol is detected, and none while detecting: they share their SRAM. Both start
+// with the ObisValues pointer and the frame length, the one switched to is reset.
+union InfoDSSDecoders
+{
+    InfoDSSDecoders(ObisValues *obisValues) : sml(obisValues) {}
+    TinySMLDecoder sml;
+    TinyD0Decoder d0;
+    uint32_t recent; // Last four bytes, while detecting
+};
+#endif
+
 // Setup
-void setupInfoDSS(TinySMLDecoder *tinySMLDecoder_);
+#if INFO_DSS_AUTO_PROTOCOL
+void setupInfoDSS(InfoDSSDecoders *decoders_, ObisValues *obisValues_);
+#else
+void setupInfoDSS(TinySMLDecoder *tinySMLDecoder_, ObisValues *obisValues_);
+#endif
+
+// Check for pending input.
+bool isInfoDSSPending();
 
 // Notify on every main loop.
 void onTickInfoDSS();
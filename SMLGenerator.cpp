@@ -0,0 +1,323 @@
+/*
+ * Synthetic SML frames. See SMLGenerator.h.
+ */
+
+#include "SMLGenerator.h"
+
+#if __TEST__
+#include <stdint.h>
+#include <string.h>
+#include "ModbusCRC.h"
+
+static const uint8_t START_SEQUENCE[8] = {0x1B, 0x1B, 0x1B, 0x1B, 0x01, 0x01, 0x01, 0x01};
+static const uint8_t ESCAPE[4] = {0x1B, 0x1B, 0x1B, 0x1B};
+
+static const uint8_t OBIS_IMPORT[6] = {0x01, 0x00, 0x01, 0x08, 0x00, 0xFF};
+static const uint8_t OBIS_EXPORT[6] = {0x01, 0x00, 0x02, 0x08, 0x00, 0xFF};
+static const uint8_t OBIS_POWER[6] = {0x01, 0x00, 0x10, 0x07, 0x00, 0xFF};
+
+#define SML_UNIT_WH 30
+#define SML_UNIT_W 27
+
+SMLGenerator::SMLGenerator(uint32_t seed)
+    : state(seed ? seed : 1)
+{
+}
+
+uint32_t SMLGenerator::random()
+{
+    // xorshift32
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+/*
+ * Type-length field, Section 6.3.1: Length in nibbles, most significant first, bit 7 set while more follow. For
+ * lists, the length is the number of elements, otherwise the number of bytes including the TL field.
+ */
+void SMLGenerator::tl(uint8_t type, size_t length)
+{
+    uint8_t n = 1;
+    while ((type == 0x70 ? length : length + n) >> (4 * n))
+    {
+        n++;
+    }
+    if (type != 0x70)
+    {
+        length += n;
+    }
+    for (uint8_t k = n; k-- > 0;)
+    {
+        uint8_t c = (length >> (4 * k)) & 0x0F;
+        c |= (k == n - 1) ? type : 0;
+        c |= k ? 0x80 : 0;
+        m.push_back(c);
+    }
+}
+
+void SMLGenerator::list(uint8_t n)
+{
+    tl(0x70, n);
+}
+
+void SMLGenerator::octets(const uint8_t *b, size_t n)
+{
+    tl(0x00, n);
+    m.insert(m.end(), b, b + n);
+}
+
+void SMLGenerator::integer(int64_t v, uint8_t width)
+{
+    tl(0x50, width);
+    for (uint8_t k = width; k-- > 0;)
+    {
+        m.push_back((uint8_t)(v >> (8 * k)));
+    }
+}
+
+void SMLGenerator::unsignedInt(uint64_t v, uint8_t width)
+{
+    tl(0x60, width);
+    for (uint8_t k = width; k-- > 0;)
+    {
+        m.push_back((uint8_t)(v >> (8 * k)));
+    }
+}
+
+void SMLGenerator::none()
+{
+    m.push_back(0x01);
+}
+
+/*
+ * SML_Message up to the body choice: transactionId, groupNo, abortOnError, then list of tag and body
+ */
+void SMLGenerator::message(uint16_t tag)
+{
+    const uint8_t id[4] = {(uint8_t)(transaction >> 24), (uint8_t)(transaction >> 16), (uint8_t)(transaction >> 8), (uint8_t)transaction};
+    list(6);
+    octets(id, sizeof(id));
+    unsignedInt(0, 1);
+    unsignedInt(0, 1);
+    list(2);
+    unsignedInt(tag, 2);
+}
+
+/*
+ * Value list entry. Return the type its value was sent as, SML_TYPE_NONE if nested into lists.
+ */
+uint8_t SMLGenerator::entry(const uint8_t *obis, int8_t scaler, int64_t raw, uint8_t width, const SMLGeneratorOptions &options,
+                            uint8_t type, bool madeUp)
+{
+    list(7);
+    octets(obis, 6);
+    none(); // status
+    if (options.valTime)
+    {
+        list(2);
+        unsignedInt(1, 1); // secIndex
+        unsignedInt(sensorTime, 4);
+    }
+    else
+    {
+        none();
+    }
+    unsignedInt(obis[2] == 0x10 ? SML_UNIT_W : SML_UNIT_WH, 1);
+    integer(scaler, 1);
+    for (uint8_t k = 0; madeUp && k < options.depth; k++)
+    {
+        list(1);
+    }
+    if (madeUp && options.escape)
+    {
+        // Contains an aligned block of four, wherever it starts
+        const uint8_t b[7] = {0x1B, 0x1B, 0x1B, 0x1B, 0x1B, 0x1B, 0x1B};
+        octets(b, sizeof(b));
+        type = SML_TYPE_OCTETS;
+    }
+    else if (type == SML_TYPE_OCTETS)
+    {
+        uint8_t b[8];
+        for (uint8_t k = 0; k < width; k++)
+        {
+            b[k] = (uint8_t)(raw >> (8 * (width - 1 - k)));
+        }
+        octets(b, width);
+    }
+    else if (type == SML_TYPE_UNSIGNED)
+    {
+        unsignedInt(raw, width);
+    }
+    else
+    {
+        integer(raw, width);
+    }
+    none(); // valueSignature
+    return (madeUp && options.depth) ? SML_TYPE_NONE : type;
+}
+
+void SMLGenerator::frame(const SMLGeneratorOptions &options, std::vector<uint8_t> &out, SMLGeneratorValues *values)
+{
+    const uint8_t width = options.width < 1 ? 1 : options.width > 8 ? 8 : options.width;
+    const int64_t maxRaw = (width == 8) ? INT64_MAX : ((int64_t)1 << (8 * width - 1)) - 1;
+    int64_t scale = 1;
+    for (int8_t k = options.scaler < 0 ? -options.scaler : options.scaler; k > 0; k--)
+    {
+        scale *= 10;
+    }
+    // Units u: raw = u * scale for negative scalers, value = u * scale otherwise
+    int64_t maxUnits = options.scaler < 0 ? maxRaw / scale : maxRaw;
+    const int64_t maxValue = options.scaler < 0 ? INT32_MAX : INT32_MAX / scale;
+    maxUnits = maxUnits < maxValue ? maxUnits : maxValue;
+
+    sensorTime++;
+    transaction++;
+    imported = (imported + random() % 4) % (maxUnits + 1);
+    exported = (exported + random() % 2) % (maxUnits + 1);
+    const int64_t maxPower = maxUnits < 20000 ? maxUnits : 20000;
+    const int64_t power = (int64_t)(random() % (2 * maxPower + 1)) - maxPower;
+    const int64_t rawScale = options.scaler < 0 ? scale : 1;
+    const int64_t valueScale = options.scaler < 0 ? 1 : scale;
+    if (values)
+    {
+        values->imported = (uint32_t)(imported * valueScale);
+        values->exported = (uint32_t)(exported * valueScale);
+        values->power = (int32_t)(power * valueScale);
+        values->sensorTime = sensorTime;
+        values->transaction = (uint16_t)transaction;
+        for (uint8_t k = 0; k < SML_MADE_UP_VALUES; k++)
+        {
+            values->madeUpTypes[k] = SML_TYPE_NONE;
+            values->madeUp[k] = 0;
+        }
+    }
+
+    m.clear();
+    uint8_t serverId[64];
+    for (uint8_t k = 0; k < sizeof(serverId); k++)
+    {
+        serverId[k] = (uint8_t)(0x0A + k);
+    }
+    const uint8_t serverIdLength = options.serverIdLength < sizeof(serverId) ? options.serverIdLength : sizeof(serverId);
+
+    size_t begin = m.size();
+    message(0x0101); // SML_PublicOpen.Res
+    list(6);
+    none();              // codepage
+    octets(NULL, 0);     // clientId
+    octets(serverId, 2); // reqFileId
+    octets(serverId, serverIdLength);
+    none(); // refTime
+    none(); // smlVersion
+    X25CRC crc = X25CRC();
+    crc.feed(m.data() + begin, m.size() - begin);
+    unsignedInt((crc.getCRCHighByte() << 8) | crc.getCRCLowByte(), 2); // Message CRC, not checked by the decoder
+    m.push_back(0x00);                                                 // endOfSmlMsg
+
+    begin = m.size();
+    message(0x0701); // SML_GetList.Res
+    list(7);
+    none(); // clientId
+    octets(serverId, serverIdLength);
+    none(); // listName
+    list(2);
+    unsignedInt(1, 1); // secIndex
+    unsignedInt(sensorTime, 4);
+    list(options.entries);
+    const uint8_t *known[3] = {OBIS_IMPORT, OBIS_EXPORT, OBIS_POWER};
+    const int64_t raw[3] = {imported * rawScale, exported * rawScale, power * rawScale};
+    for (uint8_t k = 0; k < options.entries; k++)
+    {
+        if (k < 3)
+        {
+            entry(known[k], options.scaler, raw[k], width, options, SML_TYPE_INTEGER, false);
+        }
+        else
+        {
+            // Phase currents and voltages, 1-0:31.7.0, 1-0:32.7.0, ...
+            const uint8_t obis[6] = {0x01, 0x00, (uint8_t)(31 + k - 3), 0x07, 0x00, 0xFF};
+            const int64_t units = random() % (maxPower + 1);
+            const uint32_t bit = k < 32 ? 1UL << k : 0;
+            const uint8_t type = (options.octetEntries & bit)      ? SML_TYPE_OCTETS
+                                 : (options.unsignedEntries & bit) ? SML_TYPE_UNSIGNED
+                                                                   : SML_TYPE_INTEGER;
+            const uint8_t sent = entry(obis, options.scaler, units * rawScale, width, options, type, true);
+            if (values && k - 3 < SML_MADE_UP_VALUES)
+            {
+                values->madeUpTypes[k - 3] = sent;
+                // Octet strings are taken as they are, without the scaler
+                values->madeUp[k - 3] = sent == SML_TYPE_OCTETS ? (options.escape ? 0x1B1B1B1B : (uint32_t)(units * rawScale))
+                                                                : (uint32_t)(units * valueScale);
+            }
+        }
+    }
+    none(); // listSignature
+    none(); // actGatewayTime
+    crc.reset();
+    crc.feed(m.data() + begin, m.size() - begin);
+    unsignedInt((crc.getCRCHighByte() << 8) | crc.getCRCLowByte(), 2);
+    m.push_back(0x00);
+
+    begin = m.size();
+    message(0x0201); // SML_PublicClose.Res
+    list(1);
+    none(); // globalSignature
+    crc.reset();
+    crc.feed(m.data() + begin, m.size() - begin);
+    unsignedInt((crc.getCRCHighByte() << 8) | crc.getCRCLowByte(), 2);
+    m.push_back(0x00);
+
+    // Transport v1, Section 8.1: Receivers read blocks of four, an escape sequence among them is sent twice
+    const size_t start = out.size();
+    out.insert(out.end(), START_SEQUENCE, START_SEQUENCE + sizeof(START_SEQUENCE));
+    const uint8_t pad = (uint8_t)((4 - m.size() % 4) % 4);
+    m.insert(m.end(), pad, 0x00);
+    for (size_t k = 0; k < m.size(); k += 4)
+    {
+        out.insert(out.end(), m.begin() + k, m.begin() + k + 4);
+        if (!memcmp(&m[k], ESCAPE, sizeof(ESCAPE)))
+        {
+            out.insert(out.end(), ESCAPE, ESCAPE + sizeof(ESCAPE));
+        }
+    }
+    out.insert(out.end(), ESCAPE, ESCAPE + sizeof(ESCAPE));
+    out.push_back(0x1A);
+    out.push_back(pad);
+    crc.reset();
+    crc.feed(out.data() + start, out.size() - start);
+    out.push_back(crc.getCRCLowByte());
+    out.push_back(crc.getCRCHighByte());
+}
+
+size_t SMLGenerator::corrupt(std::vector<uint8_t> &out, size_t begin, uint8_t kind)
+{
+    const size_t length = out.size() - begin;
+    size_t at = begin + random() % length;
+    switch (kind)
+    {
+    case SML_CORRUPT_FLIP:
+        out[at] ^= 1 << (random() % 8);
+        break;
+    case SML_CORRUPT_DROP:
+        out.erase(out.begin() + at);
+        break;
+    case SML_CORRUPT_INSERT:
+        out.insert(out.begin() + at, (uint8_t)random());
+        break;
+    case SML_CORRUPT_TRUNCATE:
+        out.resize(at);
+        break;
+    default:
+        at = begin;
+        for (uint8_t n = 1 + random() % 32; n > 0; n--)
+        {
+            out.insert(out.begin() + begin, (uint8_t)random());
+        }
+    }
+    return at;
+}
+#endif // __TEST__
+
+// END
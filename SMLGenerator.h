@@ -0,0 +1,101 @@
+/*
+ * Synthetic SML frames for host tests and benchmarks, host builds only.
+ *
+ * Each frame is SML_PublicOpen.Res, SML_GetList.Res and SML_PublicClose.Res in transport v1: start sequence,
+ * messages, padding, end sequence and X.25 CRC. 1B 1B 1B 1B in the messages is escaped by sending it twice. The value
+ * list has 1.8.0, 2.8.0 and 16.7.0 with the values given, followed by made up OBIS codes. Options vary what the
+ * decoder has to cope with: number of entries, integer widths, scaler, nesting, TL fields longer than one byte, and
+ * the value types of the made up entries: Integer, Unsigned or octet string.
+ *
+ * Values are chosen such that they are exact after scaling, and fit the integer width. The counters count up from
+ * frame to frame, the power is random.
+ */
+
+#ifndef __SMLGENERATOR_H
+#define __SMLGENERATOR_H
+
+#include <Arduino.h>
+
+#if __TEST__
+#include <vector>
+
+struct SMLGeneratorOptions
+{
+    uint8_t entries = 3;          // Value list entries, 1.8.0, 2.8.0, 16.7.0 first. More than 15 need a two byte TL.
+    uint8_t width = 8;            // Integer width of the values [bytes], 1..8
+    int8_t scaler = -1;           // 10^scaler Wh or W per unit of the raw value
+    uint8_t depth = 0;            // Lists nested into the values of the made up entries
+    uint8_t serverIdLength = 10;  // Octets. More than 14 need a two byte TL.
+    bool valTime = true;          // secIndex valTime in the entries
+    bool escape = false;          // Made up entries carry 1B 1B 1B 1B in an octet string
+    uint32_t unsignedEntries = 0; // Bit k: made up entry k (k >= 3) sends its value as Unsigned
+    uint32_t octetEntries = 0;    // Bit k: made up entry k sends its value as an octet string of width bytes
+};
+
+// Value types as in the TL field, Section 6.3.1
+#define SML_TYPE_OCTETS 0x00
+#define SML_TYPE_NONE 0x01 // Not sent, or nested into a list
+#define SML_TYPE_INTEGER 0x50
+#define SML_TYPE_UNSIGNED 0x60
+#define SML_MADE_UP_VALUES 4 // Made up entries reported in SMLGeneratorValues, 31.7.0, 32.7.0, ...
+
+// Expected registers for a frame
+struct SMLGeneratorValues
+{
+    uint32_t imported; // Wh
+    uint32_t exported; // Wh
+    int32_t power;     // W
+    uint32_t sensorTime;
+    uint16_t transaction;
+    uint8_t madeUpTypes[SML_MADE_UP_VALUES];
+    uint32_t madeUp[SML_MADE_UP_VALUES]; // Registers if taken: scaled integers, last four bytes of octet strings
+};
+
+#define SML_CORRUPT_FLIP 0     // Flip one bit
+#define SML_CORRUPT_DROP 1     // Drop one byte
+#define SML_CORRUPT_INSERT 2   // Insert a random byte
+#define SML_CORRUPT_TRUNCATE 3 // Cut the frame short
+#define SML_CORRUPT_GARBAGE 4  // Random bytes in front of the frame
+#define N_SML_CORRUPTIONS 5
+
+class SMLGenerator
+{
+public:
+    SMLGenerator(uint32_t seed = 1);
+
+    /*
+     * Append the next frame to out. Values of that frame in values, if given.
+     */
+    void frame(const SMLGeneratorOptions &options, std::vector<uint8_t> &out, SMLGeneratorValues *values = NULL);
+
+    /*
+     * Corrupt the frame starting at offset begin of out. Return the offset of the damage.
+     */
+    size_t corrupt(std::vector<uint8_t> &out, size_t begin, uint8_t kind);
+
+    uint32_t random();
+
+private:
+    uint32_t state;
+    uint32_t sensorTime = 1000;
+    uint32_t transaction = 0x10000;
+    int64_t imported = 4710942; // Wh
+    int64_t exported = 123456;
+
+    std::vector<uint8_t> m; // Messages of the current frame, not escaped
+
+    void tl(uint8_t type, size_t length);
+    void list(uint8_t n);
+    void octets(const uint8_t *b, size_t n);
+    void integer(int64_t v, uint8_t width);
+    void unsignedInt(uint64_t v, uint8_t width);
+    void none();
+    void message(uint16_t tag);
+    uint8_t entry(const uint8_t *obis, int8_t scaler, int64_t raw, uint8_t width, const SMLGeneratorOptions &options,
+                  uint8_t type, bool madeUp);
+};
+#endif // __TEST__
+
+#endif // __SMLGENERATOR_H
+
+// END
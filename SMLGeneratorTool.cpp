@@ -0,0 +1,372 @@
+/*
+ * Write synthetic SML captures, and benchmark the decoder on them.
+ *
+ * Without -b, writes frames with the given options to a file (see SMLGenerator.h), every n-th of them corrupted with -c.
+ *
+ * With -b, decodes generated frames and checks every commit against the values sent, for a series of variations:
+ * number of OBIS entries, integer width, scaler, nesting, server ID length (TL fields), escape sequences. Reports the
+ * frame size, throughput and the share of frames decoded correctly. Then corrupts every tenth frame in each of several
+ * ways and reports the frames lost per corruption, and the time from the damage to the next commit at INFO_DSS_BAUD.
+ * Fails if the baseline does not decode, or a corruption costs more than the damaged frame and the one after it.
+ * Built with VALUE_VIEWS, the commits are checked against the value view as well.
+ *
+ * Built with EXTRA_OBIS_CODES, these must be the made up entries 31.7.0, 32.7.0, ... in order. Each is checked to hold
+ * the value sent if its type is one the code takes (OBIS_SIGNED_CODES, OBIS_UNSIGNED_CODES, OBIS_OCTET_CODES), and 0
+ * otherwise. The second build below takes 31.7.0 as Unsigned and 32.7.0 as octet string, while 33.7.0 is sent as
+ * Unsigned but expected signed, so must be skipped.
+ *
+ * g++ -O2 -I . -D__TEST__=1 -o sml-gen SMLGeneratorTool.cpp SMLGenerator.cpp TinySMLDecoder.cpp ModbusCRC.cpp ObisValues.cpp
+ * g++ -O2 -I . -D__TEST__=1 -DN_KNOWN_OBIS_CODES=6 -DEXTRA_OBIS_CODES="{1, 0, 31, 7, 0}, {1, 0, 32, 7, 0}, {1, 0, 33, 7, 0}" -DOBIS_SIGNED_CODES=0x27 -DOBIS_UNSIGNED_CODES=0x08 -DOBIS_OCTET_CODES=0x10 -o sml-gen-types SMLGeneratorTool.cpp SMLGenerator.cpp TinySMLDecoder.cpp ModbusCRC.cpp ObisValues.cpp
+ * ./sml-gen [-n frames] [-e entries] [-w width] [-s scaler] [-d depth] [-i server ID length] [-t] [-x] [-u mask] [-o mask]
+ *           [-c n] [-r seed] out.bin
+ * ./sml-gen -b [MB per variation]
+ */
+
+#include <stdio.h>
+#include "SMLGenerator.h"
+#include "TinySMLDecoder.h"
+
+#if __TEST__
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifndef INFO_DSS_BAUD
+#define INFO_DSS_BAUD 9600
+#endif
+#define RECOVERY_FRAMES 1000 // Per corruption kind, every tenth corrupted
+
+static const char *CORRUPTION_NAMES[N_SML_CORRUPTIONS] = {"bit flip", "byte dropped", "byte inserted", "truncated", "garbage before"};
+
+static double now()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+static uint32_t getRegisters(ObisValues &obisValues, uint8_t n)
+{
+    return ((uint32_t)obisValues.getLiveRegister(n) << 16) | obisValues.getLiveRegister(n + 1);
+}
+
+#if VALUE_VIEWS
+/*
+ * Value view of OBIS code cc against the value expected [Wh or W]
+ */
+static bool viewMatches(ObisValues &obisValues, uint8_t cc, int64_t expected)
+{
+    const uint16_t *r = obisValues.getInputRegisters(REGISTER_MAP[BLOCK_VIEW].address + 2 * cc);
+    const uint32_t view = ((uint32_t)r[0] << 16) | r[1];
+#if VALUE_VIEWS == VALUE_VIEW_SCALED
+    return (int32_t)view == (int32_t)llround(expected * pow(10, -VALUE_VIEW_SCALER));
+#else
+#if VALUE_VIEWS == VALUE_VIEW_FLOAT_SWAPPED
+    const uint32_t bits = (view << 16) | (view >> 16);
+#else
+    const uint32_t bits = view;
+#endif
+    float f;
+    memcpy(&f, &bits, sizeof(f));
+    const double e = expected * pow(10, -VALUE_VIEW_FLOAT_SCALER);
+    return fabs(f - e) <= 1e-6 * fabs(e);
+#endif
+}
+#endif
+
+static_assert(N_KNOWN_OBIS_CODES <= 3 + SML_MADE_UP_VALUES, "Extra OBIS codes beyond the made up entries reported");
+
+static bool matches(ObisValues &obisValues, const SMLGeneratorValues &v)
+{
+    for (uint8_t cc = 3; cc < N_KNOWN_OBIS_CODES; cc++)
+    {
+        const uint8_t type = v.madeUpTypes[cc - 3];
+        const uint32_t codes = type == SML_TYPE_INTEGER ? OBIS_SIGNED_CODES : type == SML_TYPE_UNSIGNED ? OBIS_UNSIGNED_CODES
+                                                       : type == SML_TYPE_OCTETS   ? OBIS_OCTET_CODES
+                                                                                   : 0;
+        if (getRegisters(obisValues, N_VERSION_REGISTERS + 2 * cc) != ((codes & (1UL << cc)) ? v.madeUp[cc - 3] : 0))
+        {
+            return false;
+        }
+    }
+#if VALUE_VIEWS
+    if (!viewMatches(obisValues, 0, v.imported) || !viewMatches(obisValues, 1, v.exported) || !viewMatches(obisValues, 2, v.power))
+    {
+        return false;
+    }
+#endif
+    return getRegisters(obisValues, N_VERSION_REGISTERS) == v.imported && getRegisters(obisValues, N_VERSION_REGISTERS + 2) == v.exported &&
+#if SML_MESSAGE_DATA
+           (((uint32_t)obisValues.getSmlRegister(SML_SENSOR_TIME) << 16) | obisValues.getSmlRegister(SML_SENSOR_TIME + 1)) == v.sensorTime &&
+           obisValues.getSmlRegister(SML_TRANSACTION) == v.transaction &&
+#endif
+           (int32_t)getRegisters(obisValues, N_VERSION_REGISTERS + 4) == v.power;
+}
+
+/*
+ * Decode frames of the given kind, about mb megabytes. Print size, throughput and correct commits. Return the share
+ * of frames decoded correctly.
+ */
+static double variation(const char *name, const SMLGeneratorOptions &options, double mb)
+{
+    SMLGenerator generator = SMLGenerator(42);
+    std::vector<uint8_t> corpus;
+    std::vector<size_t> ends;
+    std::vector<SMLGeneratorValues> values;
+    while (corpus.size() < mb * 1e6)
+    {
+        values.push_back(SMLGeneratorValues());
+        generator.frame(options, corpus, &values.back());
+        ends.push_back(corpus.size());
+    }
+
+    // Throughput: the corpus in one go
+    ObisValues obisValues = ObisValues();
+    TinySMLDecoder decoder = TinySMLDecoder(&obisValues);
+    double t = now();
+    for (uint8_t c : corpus)
+    {
+        decoder.feed(c);
+    }
+    t = now() - t;
+
+    // Correctness: check after each frame
+    ObisValues checked = ObisValues();
+    TinySMLDecoder checker = TinySMLDecoder(&checked);
+    size_t good = 0;
+    size_t p = 0;
+    for (size_t k = 0; k < ends.size(); k++)
+    {
+        const uint16_t frames = checked.getDiagnosticRegister(DIAG_FRAMES);
+        for (; p < ends[k]; p++)
+        {
+            checker.feed(corpus[p]);
+        }
+        good += checked.getDiagnosticRegister(DIAG_FRAMES) == (uint16_t)(frames + 1) && matches(checked, values[k]);
+    }
+
+    const double share = (double)good / ends.size();
+    printf("%-24s %6zu %9.1f %11.0f %8.1f%%%s\n", name, corpus.size() / ends.size(), corpus.size() / t / 1e6, ends.size() / t,
+           100.0 * share, share < 1 ? "  !" : "");
+    return share;
+}
+
+/*
+ * Every tenth frame corrupted. Return the worst number of frames lost per corruption.
+ */
+static unsigned recovery(uint8_t kind)
+{
+    SMLGenerator generator = SMLGenerator(7 + kind);
+    SMLGeneratorOptions options;
+    std::vector<uint8_t> corpus;
+    std::vector<size_t> ends;
+    std::vector<size_t> damage;
+    for (unsigned k = 0; k < RECOVERY_FRAMES; k++)
+    {
+        const size_t begin = corpus.size();
+        generator.frame(options, corpus);
+        if (k % 10 == 5)
+        {
+            damage.push_back(generator.corrupt(corpus, begin, kind));
+        }
+        ends.push_back(corpus.size());
+    }
+
+    ObisValues obisValues = ObisValues();
+    TinySMLDecoder decoder = TinySMLDecoder(&obisValues);
+    size_t d = 0;
+    size_t from = 0;   // Damage being recovered from, if any
+    bool recovering = false;
+    unsigned lost = 0; // Since the damage
+    unsigned worst = 0;
+    double totalBytes = 0;
+    size_t maxBytes = 0;
+    size_t p = 0;
+    for (size_t k = 0; k < ends.size(); k++)
+    {
+        const uint16_t frames = obisValues.getDiagnosticRegister(DIAG_FRAMES);
+        for (; p < ends[k]; p++)
+        {
+            if (d < damage.size() && p == damage[d])
+            {
+                from = p;
+                recovering = true;
+                lost = 0;
+                d++;
+            }
+            const uint16_t before = obisValues.getDiagnosticRegister(DIAG_FRAMES);
+            decoder.feed(corpus[p]);
+            if (recovering && obisValues.getDiagnosticRegister(DIAG_FRAMES) != before)
+            {
+                recovering = false;
+                totalBytes += p + 1 - from;
+                maxBytes = (p + 1 - from) > maxBytes ? p + 1 - from : maxBytes;
+                worst = lost > worst ? lost : worst;
+            }
+        }
+        if (obisValues.getDiagnosticRegister(DIAG_FRAMES) == frames)
+        {
+            lost++;
+        }
+    }
+    const double bytesPerMs = INFO_DSS_BAUD / 10 / 1000.0;
+    printf("%-16s %5zu %5u %5u %9.0fms %9.0fms %5u %s\n", CORRUPTION_NAMES[kind], damage.size(), obisValues.getDiagnosticRegister(DIAG_BAD_CRCS),
+           obisValues.getDiagnosticRegister(DIAG_RESYNCS), totalBytes / damage.size() / bytesPerMs, maxBytes / bytesPerMs, worst,
+           worst <= 2 ? "OK" : "FAIL");
+    return worst;
+}
+
+static int bench(double mb)
+{
+    printf("%-24s %6s %9s %11s %9s\n", "Variation", "Bytes", "MB/s", "Frames/s", "Decoded");
+    SMLGeneratorOptions options;
+    int failures = variation("baseline", options, mb) < 1;
+    char name[32];
+    for (uint8_t entries : {6, 12, 15, 16, 32})
+    {
+        options = SMLGeneratorOptions();
+        options.entries = entries;
+        snprintf(name, sizeof(name), "%u entries", entries);
+        variation(name, options, mb);
+    }
+    for (uint8_t width : {1, 2, 4})
+    {
+        options = SMLGeneratorOptions();
+        options.width = width;
+        options.scaler = 0;
+        snprintf(name, sizeof(name), "%u byte values", width);
+        variation(name, options, mb);
+    }
+    for (int8_t scaler : {-3, 0, 2})
+    {
+        options = SMLGeneratorOptions();
+        options.scaler = scaler;
+        snprintf(name, sizeof(name), "scaler %d", scaler);
+        variation(name, options, mb);
+    }
+    options = SMLGeneratorOptions();
+    options.valTime = false;
+    variation("no valTime", options, mb);
+    for (uint8_t depth : {1, 3, 4})
+    {
+        options = SMLGeneratorOptions();
+        options.entries = 6;
+        options.depth = depth;
+        snprintf(name, sizeof(name), "6 entries, nested %u", depth);
+        variation(name, options, mb);
+    }
+    for (uint8_t length : {14, 15, 40})
+    {
+        options = SMLGeneratorOptions();
+        options.serverIdLength = length;
+        snprintf(name, sizeof(name), "server ID %u bytes", length);
+        variation(name, options, mb);
+    }
+    options = SMLGeneratorOptions();
+    options.entries = 4;
+    options.escape = true;
+    variation("escape sequence", options, mb);
+    options = SMLGeneratorOptions();
+    options.entries = 6;
+    options.unsignedEntries = (1 << 3) | (1 << 5);
+    options.octetEntries = 1 << 4;
+    failures += variation("Unsigned, octet string", options, mb) < 1;
+
+    printf("\n%-16s %5s %5s %5s %11s %11s %5s\n", "Corruption", "N", "CRC", "Sync", "Recovery", "Max", "Lost");
+    for (uint8_t kind = 0; kind < N_SML_CORRUPTIONS; kind++)
+    {
+        failures += recovery(kind) > 2;
+    }
+    printf("%s\n", failures ? "FAIL" : "OK");
+    return failures ? 1 : 0;
+}
+
+int main(int argc, char *argv[])
+{
+    SMLGeneratorOptions options;
+    unsigned frames = 100;
+    unsigned corruptEvery = 0;
+    uint32_t seed = 1;
+    bool benchmark = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:e:w:s:d:i:txu:o:c:r:b")) != -1)
+    {
+        switch (opt)
+        {
+        case 'n':
+            frames = atoi(optarg);
+            break;
+        case 'e':
+            options.entries = atoi(optarg);
+            break;
+        case 'w':
+            options.width = atoi(optarg);
+            break;
+        case 's':
+            options.scaler = atoi(optarg);
+            break;
+        case 'd':
+            options.depth = atoi(optarg);
+            break;
+        case 'i':
+            options.serverIdLength = atoi(optarg);
+            break;
+        case 't':
+            options.valTime = false;
+            break;
+        case 'x':
+            options.escape = true;
+            break;
+        case 'u':
+            options.unsignedEntries = strtoul(optarg, NULL, 0);
+            break;
+        case 'o':
+            options.octetEntries = strtoul(optarg, NULL, 0);
+            break;
+        case 'c':
+            corruptEvery = atoi(optarg);
+            break;
+        case 'r':
+            seed = atoi(optarg);
+            break;
+        case 'b':
+            benchmark = true;
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-n frames] [-e entries] [-w width] [-s scaler] [-d depth] [-i server ID length] [-t] [-x] "
+                            "[-u mask] [-o mask] [-c n] [-r seed] out.bin | -b [MB]\n",
+                    argv[0]);
+            return 2;
+        }
+    }
+    if (benchmark)
+    {
+        return bench(optind < argc ? atof(argv[optind]) : 2);
+    }
+    FILE *f = optind < argc ? fopen(argv[optind], "wb") : NULL;
+    if (!f)
+    {
+        fprintf(stderr, "Cannot write %s\n", optind < argc ? argv[optind] : "(no output file)");
+        return 2;
+    }
+    SMLGenerator generator = SMLGenerator(seed);
+    std::vector<uint8_t> out;
+    for (unsigned k = 0; k < frames; k++)
+    {
+        const size_t begin = out.size();
+        generator.frame(options, out);
+        if (corruptEvery && k % corruptEvery == corruptEvery - 1)
+        {
+            generator.corrupt(out, begin, generator.random() % N_SML_CORRUPTIONS);
+        }
+    }
+    fwrite(out.data(), 1, out.size(), f);
+    fclose(f);
+    printf("%u frames, %zu bytes\n", frames, out.size());
+    return 0;
+}
+#endif
+
+// END
@@ -0,0 +1,312 @@
+/*
+ * Replay large SML capture archives on a Linux host.
+ *
+ * Each capture file is memory-mapped and split into chunks at SML start sequences (1B 1B 1B 1B 01 01 01 01), so no
+ * frame ever spans two chunks. Chunks are decoded in parallel with independent decoders and ObisValues. Every
+ * committed frame is printed in file order with its byte offset and values. Per file, frames/sec as well as bad CRC
+ * and resync counts are reported on stderr.
+ *
+ * Values keep their value when missing from a frame: captures carry no local time, so they never expire (see
+ * OBIS_TTL_MS). To get the same result as a serial decode, each chunk first decodes the frame preceding it, without
+ * reporting it. For meters that leave out a code for more than one frame in a row, values may differ at chunk starts.
+ *
+ * g++ -O2 -I . -D__TEST__=1 -D__HOST_CRC__=1 -pthread -o sml-replay SMLReplay.cpp TinySMLDecoder.cpp ModbusCRC.cpp ModbusCRCHost.cpp ObisValues.cpp
+ * ./sml-replay [-j threads] [-c chunk MB] [-q] capture.bin ...
+ */
+
+#include <stdio.h>
+#include "TinySMLDecoder.h"
+
+#if __TEST__
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+static const uint8_t BOM[] = {0x1B, 0x1B, 0x1B, 0x1B, 0x01, 0x01, 0x01, 0x01};
+
+struct Chunk
+{
+    size_t warmup; // Start decoding here, at the frame preceding the chunk
+    size_t begin;  // Report frames ending at or after begin
+    size_t end;
+
+    // Results
+    bool done = false;
+    std::string out;
+    uint64_t frames = 0;
+    uint64_t badCRCs = 0;
+    uint64_t resyncs = 0;
+};
+
+struct Capture
+{
+    const char *path;
+    const uint8_t *data;
+    size_t size;
+    std::vector<Chunk> chunks;
+};
+
+static std::vector<Capture> captures;
+static std::vector<Chunk *> queue; // All chunks of all files, in order
+static std::atomic<size_t> nextChunk(0);
+static size_t emitted = 0; // Chunks written to stdout
+static std::mutex lock;
+static std::condition_variable changed;
+static size_t window;    // Max. chunks decoded ahead of output
+static bool quiet = false;
+
+static double now()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+static size_t findBOM(const uint8_t *data, size_t from, size_t size)
+{
+    if (from >= size)
+    {
+        return size;
+    }
+    const void *p = memmem(data + from, size - from, BOM, sizeof(BOM));
+    return p ? (const uint8_t *)p - data : size;
+}
+
+// Last start sequence before position, or position if none within reach
+static size_t findBOMBackward(const uint8_t *data, size_t before)
+{
+    const size_t reach = 1 << 16;
+    size_t from = before > reach ? before - reach : 0;
+    size_t found = before;
+    for (size_t p = findBOM(data, from, before); p < before; p = findBOM(data, p + 1, before))
+    {
+        found = p;
+    }
+    return found;
+}
+
+static void split(Capture &capture, size_t chunkSize)
+{
+    size_t begin = 0;
+    while (begin < capture.size)
+    {
+        size_t end = findBOM(capture.data, begin + chunkSize, capture.size);
+        capture.chunks.push_back(Chunk());
+        Chunk &c = capture.chunks.back();
+        c.begin = begin;
+        c.end = end;
+        c.warmup = begin ? findBOMBackward(capture.data, begin) : 0;
+        begin = end;
+    }
+}
+
+static void appendFrame(std::string &out, size_t offset, ObisValues &obisValues)
+{
+    char line[32 + N_KNOWN_OBIS_CODES * 12];
+    int n = snprintf(line, sizeof(line), "%zu", offset);
+    for (uint8_t k = 0; k < N_KNOWN_OBIS_REGISTERS; k += 2)
+    {
+        int32_t value = (int32_t)(((uint32_t)obisValues.getLiveRegister(2 + k) << 16) | obisValues.getLiveRegister(3 + k));
+        n += snprintf(line + n, sizeof(line) - n, " %d", value);
+    }
+    line[n++] = '\n';
+    out.append(line, n);
+}
+
+static void decode(const Capture &capture, Chunk &c)
+{
+    ObisValues obisValues = ObisValues();
+    TinySMLDecoder d = TinySMLDecoder(&obisValues);
+    uint16_t frames = obisValues.getDiagnosticRegister(DIAG_FRAMES);
+    uint16_t badCRCs = obisValues.getDiagnosticRegister(DIAG_BAD_CRCS);
+    uint16_t resyncs = obisValues.getDiagnosticRegister(DIAG_RESYNCS);
+    uint64_t last8 = 0; // Last eight bytes, to locate the start of the current frame
+    size_t frameStart = c.warmup;
+    for (size_t p = c.warmup; p < c.end; p++)
+    {
+        const uint8_t cc = capture.data[p];
+        d.feed(cc);
+        last8 = (last8 << 8) | cc;
+        if (last8 == 0x1B1B1B1B01010101ULL)
+        {
+            frameStart = p + 1 - sizeof(BOM);
+        }
+
+        // Counters change at most by one per byte
+        uint16_t f = obisValues.getDiagnosticRegister(DIAG_FRAMES);
+        uint16_t b = obisValues.getDiagnosticRegister(DIAG_BAD_CRCS);
+        uint16_t r = obisValues.getDiagnosticRegister(DIAG_RESYNCS);
+        if (p >= c.begin)
+        {
+            if (f != frames)
+            {
+                c.frames++;
+                if (!quiet)
+                {
+                    appendFrame(c.out, frameStart, obisValues);
+                }
+            }
+            c.badCRCs += (uint16_t)(b - badCRCs);
+            c.resyncs += (uint16_t)(r - resyncs);
+        }
+        frames = f;
+        badCRCs = b;
+        resyncs = r;
+    }
+}
+
+static void worker()
+{
+    for (;;)
+    {
+        size_t k = nextChunk++;
+        if (k >= queue.size())
+        {
+            return;
+        }
+        {
+            // Bound memory: don't decode too far ahead of output
+            std::unique_lock<std::mutex> guard(lock);
+            changed.wait(guard, [k] { return k < emitted + window; });
+        }
+        Chunk *c = queue[k];
+        for (const Capture &capture : captures)
+        {
+            if (c >= capture.chunks.data() && c < capture.chunks.data() + capture.chunks.size())
+            {
+                decode(capture, *c);
+                break;
+            }
+        }
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            c->done = true;
+        }
+        changed.notify_all();
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned threads = std::thread::hardware_concurrency();
+    size_t chunkSize = 4 << 20;
+    int opt;
+    while ((opt = getopt(argc, argv, "j:c:q")) != -1)
+    {
+        switch (opt)
+        {
+        case 'j':
+            threads = atoi(optarg);
+            break;
+        case 'c':
+            chunkSize = (size_t)atoi(optarg) << 20;
+            break;
+        case 'q':
+            quiet = true;
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-j threads] [-c chunk MB] [-q] capture.bin ...\n", argv[0]);
+            return 1;
+        }
+    }
+    if (threads == 0)
+    {
+        threads = 1;
+    }
+    if (chunkSize == 0)
+    {
+        chunkSize = 1 << 20;
+    }
+    window = 4 * threads;
+
+    captures.resize(argc - optind);
+    for (int k = optind; k < argc; k++)
+    {
+        Capture &capture = captures[k - optind];
+        capture.path = argv[k];
+        int fd = open(argv[k], O_RDONLY);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) < 0)
+        {
+            perror(argv[k]);
+            return 1;
+        }
+        capture.size = st.st_size;
+        capture.data = NULL;
+        if (capture.size)
+        {
+            void *p = mmap(NULL, capture.size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p == MAP_FAILED)
+            {
+                perror(argv[k]);
+                return 1;
+            }
+            madvise(p, capture.size, MADV_SEQUENTIAL);
+            capture.data = (const uint8_t *)p;
+        }
+        close(fd);
+        split(capture, chunkSize);
+        for (Chunk &c : capture.chunks)
+        {
+            queue.push_back(&c);
+        }
+    }
+
+    std::vector<std::thread> pool;
+    for (unsigned t = 0; t < threads; t++)
+    {
+        pool.push_back(std::thread(worker));
+    }
+
+    // Emit chunk results in order, collect per file statistics
+    for (Capture &capture : captures)
+    {
+        double t0 = now();
+        uint64_t frames = 0, badCRCs = 0, resyncs = 0;
+        if (!quiet)
+        {
+            printf("# %s\n", capture.path);
+        }
+        for (Chunk &c : capture.chunks)
+        {
+            {
+                std::unique_lock<std::mutex> guard(lock);
+                changed.wait(guard, [&c] { return c.done; });
+            }
+            fwrite(c.out.data(), 1, c.out.size(), stdout);
+            std::string().swap(c.out);
+            frames += c.frames;
+            badCRCs += c.badCRCs;
+            resyncs += c.resyncs;
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                emitted++;
+            }
+            changed.notify_all();
+        }
+        double elapsed = now() - t0;
+        fprintf(stderr, "%s: %zu bytes, %zu chunks, %llu frames, %llu bad CRCs, %llu resyncs, %.0f frames/s, %.1f MB/s\n",
+                capture.path, capture.size, capture.chunks.size(),
+                (unsigned long long)frames, (unsigned long long)badCRCs, (unsigned long long)resyncs,
+                elapsed > 0 ? frames / elapsed : 0.0, elapsed > 0 ? capture.size / elapsed / 1e6 : 0.0);
+    }
+
+    for (auto &t : pool)
+    {
+        t.join();
+    }
+    return 0;
+}
+#endif
+
+// END
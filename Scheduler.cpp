@@ -0,0 +1,81 @@
+/*
+ * Small static cooperative scheduler with priorities and deadlines.
+ *
+ * On every pass we ask all tasks if they have work pending. The highest priority pending task is run, unless a lower
+ * priority task has been waiting for longer than its deadline. Run times are measured against Timer/Counter1, which
+ * is set up by PinKeepAlive to count 8µs steps up to OCR1A (100ms).
+ */
+
+#include <Arduino.h>
+#include "Scheduler.h"
+
+static const SchedulerTask *tasks;
+static ObisValues *obisValues;
+
+// Time [8µs] each pending task has been waiting for other tasks to complete
+static uint16_t waiting[N_SCHEDULER_TASKS];
+
+void setupScheduler(const SchedulerTask *tasks_, ObisValues *obisValues_)
+{
+    tasks = tasks_;
+    obisValues = obisValues_;
+    for (uint8_t tt = 0; tt < N_SCHEDULER_TASKS; tt++)
+    {
+        waiting[tt] = 0;
+    }
+}
+
+void onTickScheduler()
+{
+    int8_t next = -1;
+    int8_t overdue = -1;
+    bool pending[N_SCHEDULER_TASKS];
+    for (uint8_t tt = 0; tt < N_SCHEDULER_TASKS; tt++)
+    {
+        pending[tt] = ((bool (*)())pgm_read_ptr(&tasks[tt].pending))();
+        if (!pending[tt])
+        {
+            waiting[tt] = 0;
+        }
+        else
+        {
+            if (next < 0)
+            {
+                next = tt;
+            }
+            if (overdue < 0 && waiting[tt] >= pgm_read_word(&tasks[tt].deadline))
+            {
+                overdue = tt;
+            }
+        }
+    }
+    if (next < 0)
+    {
+        return; // Idle
+    }
+    if (overdue >= 0 && overdue != next)
+    {
+        next = overdue;
+        obisValues->incrementDiagnosticRegister(DIAG_DEADLINE_MISSES);
+        obisValues->trace(TRACE_DEADLINE_MISS, next);
+    }
+
+    obisValues->tick(millis()); // Timestamps for commits and trace events
+    uint16_t t0 = TCNT1;
+    ((void (*)())pgm_read_ptr(&tasks[next].run))();
+    uint16_t t1 = TCNT1;
+    uint16_t elapsed = (t1 >= t0) ? (t1 - t0) : (t1 + OCR1A + 1 - t0);
+
+    obisValues->raiseDiagnosticRegister(DIAG_TASK_WCET + next, elapsed);
+    waiting[next] = 0;
+    for (uint8_t tt = 0; tt < N_SCHEDULER_TASKS; tt++)
+    {
+        if (pending[tt] && tt != next)
+        {
+            uint16_t w = waiting[tt] + elapsed;
+            waiting[tt] = (w < elapsed) ? 0xFFFF : w;
+        }
+    }
+}
+
+// END
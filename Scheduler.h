@@ -0,0 +1,27 @@
+/*
+ * Small static cooperative scheduler with priorities and deadlines.
+ */
+
+#ifndef __SCHEDULER_H
+#define __SCHEDULER_H
+
+#include <Arduino.h>
+#include "ObisValues.h"
+
+#define N_SCHEDULER_TASKS 3
+
+struct SchedulerTask
+{
+    bool (*pending)(); // Cheap check if there is work to do. Called on every pass for every task.
+    void (*run)();     // Do one small unit of work. Should return quickly.
+    uint16_t deadline; // Max. time [8µs] a pending task waits for higher priority tasks before it is run regardless
+};
+
+// Setup. Tasks are given in priority order, highest priority first, in flash (PROGMEM).
+// Worst-case run times [8µs] are reported via the diagnostic registers, starting at DIAG_TASK_WCET.
+void setupScheduler(const SchedulerTask *tasks_, ObisValues *obisValues_);
+
+// Notify on every main loop. Runs at most one task.
+void onTickScheduler();
+
+#endif // __SCHEDULER_H
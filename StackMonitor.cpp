@@ -0,0 +1,47 @@
+/*
+ * Free stack low-water mark. See StackMonitor.h.
+ */
+
+#include <Arduino.h>
+#include "StackMonitor.h"
+
+// From the linker script: end of .data and .bss (no malloc here, so no heap either), and RAMEND.
+extern uint8_t __heap_start;
+extern uint8_t __stack;
+
+static ObisValues *obisValues;
+
+// Runs from .init3, after the stack pointer is set and r1 cleared, before .data and .bss are initialized. Nothing is
+// on the stack yet, and a naked function has no frame, so painting up to RAMEND is safe.
+void paintStack() __attribute__((naked, used, section(".init3")));
+void paintStack()
+{
+    for (uint8_t *p = &__heap_start; p <= &__stack; p++)
+    {
+        *p = STACK_CANARY;
+    }
+}
+
+uint16_t getFreeStack()
+{
+    const uint8_t *p = &__heap_start;
+    while (p <= &__stack && *p == STACK_CANARY)
+    {
+        p++;
+    }
+    return p - &__heap_start;
+}
+
+void setupStackMonitor(ObisValues *obisValues_)
+{
+    obisValues = obisValues_;
+    onTickStackMonitor();
+}
+
+void onTickStackMonitor()
+{
+    // The paint only shrinks, so the scan gets shorter as the stack gets deeper: ~200 bytes, ~0.2ms at most
+    obisValues->setDiagnosticRegister(DIAG_FREE_STACK, getFreeStack());
+}
+
+// END
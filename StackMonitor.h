@@ -0,0 +1,29 @@
+/*
+ * Free stack low-water mark: The SRAM between the static data and the stack is painted with a canary byte at boot,
+ * before main(). Whatever the stack (and the interrupts on top of it) ever reached is no longer canary. The free
+ * stack is what is left of the paint, counted from below.
+ *
+ * The static footprint per module is reported by sram-report.sh, from the object files of a build.
+ */
+
+#ifndef __STACKMONITOR_H
+#define __STACKMONITOR_H
+
+#include <Arduino.h>
+#include "ObisValues.h"
+
+#define STACK_CANARY 0xC5
+
+// Setup. The minimum is reported via DIAG_FREE_STACK.
+void setupStackMonitor(ObisValues *obisValues_);
+
+// Notify every 100ms
+void onTickStackMonitor();
+
+// Free stack since reset [bytes]. Counts up to the first byte used, so a pushed byte that equals the canary by chance
+// at the very bottom makes it one too many.
+uint16_t getFreeStack();
+
+#endif // __STACKMONITOR_H
+
+// END
@@ -0,0 +1,154 @@
+/*
+ * Push telemetry. See Telemetry.h for the frame format.
+ */
+
+#include <Arduino.h>
+#include "Telemetry.h"
+
+static uint8_t lowestBit(uint32_t mask)
+{
+    uint8_t n = 0;
+    while (!(mask & 1))
+    {
+        mask >>= 1;
+        n++;
+    }
+    return n;
+}
+
+void TelemetryEncoder::start(uint32_t changed)
+{
+    if (untilFull == 0)
+    {
+        changed = TELEMETRY_ALL_REGISTERS;
+        untilFull = TELEMETRY_FULL_INTERVAL;
+    }
+    untilFull--;
+    mask = changed;
+    sequence++;
+    step = 0;
+    crc.reset();
+    pending = true;
+}
+
+void TelemetryEncoder::onCommit(uint32_t changed)
+{
+    if (pending)
+    {
+        queued |= changed;
+        isQueued = true;
+    }
+    else
+    {
+        start(changed);
+    }
+}
+
+bool TelemetryEncoder::isPending()
+{
+    return pending;
+}
+
+uint8_t TelemetryEncoder::next(ObisValues *obisValues)
+{
+    uint8_t c;
+    if (step < TELEMETRY_HEADER_LENGTH)
+    {
+        c = (step == 0) ? TELEMETRY_SYNC_1 : (step == 1) ? TELEMETRY_SYNC_2 : (step == 2) ? sequence : (uint8_t)(mask >> (8 * (step - 3)));
+        if (step++ < 2)
+        {
+            return c;
+        }
+    }
+    else if (mask)
+    {
+        const uint16_t value = obisValues->getLiveRegister(lowestBit(mask));
+        if (step == TELEMETRY_HEADER_LENGTH)
+        {
+            c = (uint8_t)(value >> 8);
+            step++;
+        }
+        else
+        {
+            c = (uint8_t)value;
+            step--;
+            mask &= mask - 1; // Next register
+        }
+    }
+    else if (step == TELEMETRY_HEADER_LENGTH)
+    {
+        step++;
+        return crc.getCRCLowByte();
+    }
+    else
+    {
+        c = crc.getCRCHighByte();
+        pending = false;
+        if (isQueued)
+        {
+            isQueued = false;
+            start(queued);
+            queued = 0;
+        }
+        return c;
+    }
+    crc.feed(c);
+    return c;
+}
+
+#if __TEST__
+bool TelemetryDecoder::feed(uint8_t c)
+{
+    if ((p == 0 && c != TELEMETRY_SYNC_1) || (p == 1 && c != TELEMETRY_SYNC_2))
+    {
+        p = (c == TELEMETRY_SYNC_1) ? 1 : 0;
+        return false;
+    }
+    buf[p++] = c;
+    if (p == TELEMETRY_HEADER_LENGTH)
+    {
+        uint32_t m = 0;
+        for (uint8_t k = 0; k < TELEMETRY_MASK_BYTES; k++)
+        {
+            m |= (uint32_t)buf[3 + k] << (8 * k);
+        }
+        length = TELEMETRY_HEADER_LENGTH + 2 * __builtin_popcount(m) + 2;
+    }
+    if (p < TELEMETRY_HEADER_LENGTH || p < length)
+    {
+        return false;
+    }
+
+    ModbusCRC crc = ModbusCRC();
+    crc.feed(buf + 2, length - 4);
+    p = 0;
+    if (crc.getCRCLowByte() != buf[length - 2] || crc.getCRCHighByte() != buf[length - 1])
+    {
+        badCRCs++;
+        return false;
+    }
+    if (frames)
+    {
+        lost += (uint8_t)(buf[2] - sequence - 1);
+    }
+    sequence = buf[2];
+    mask = 0;
+    for (uint8_t k = 0; k < TELEMETRY_MASK_BYTES; k++)
+    {
+        mask |= (uint32_t)buf[3 + k] << (8 * k);
+    }
+    const uint8_t *v = buf + TELEMETRY_HEADER_LENGTH;
+    for (uint8_t n = 0; n < 32; n++)
+    {
+        if (mask & (1UL << n))
+        {
+            registers[n] = (v[0] << 8) | v[1];
+            v += 2;
+        }
+    }
+    frames++;
+    return true;
+}
+#endif // __TEST__
+
+// END
@@ -0,0 +1,90 @@
+/*
+ * Push telemetry: After each commit, a compact binary frame with the live registers that changed, for listen-only
+ * loggers on the otherwise unused INFO-DSS TX line (TXD1).
+ *
+ * Frame:
+ *   A5 5A                     Sync
+ *   u8                        Sequence number, counts up per frame
+ *   u8[TELEMETRY_MASK_BYTES]  Change mask, little endian, bit n for live register n (Input Register 256 + n)
+ *   u16[]                     Changed registers in ascending order, high byte first
+ *   u16                       Modbus CRC over sequence number, mask and registers, low byte first
+ *
+ * The first frame and every TELEMETRY_FULL_INTERVAL-th after that carry all live registers, so a logger started late
+ * is complete soon. The encoder produces the frame byte by byte straight from the live registers, there is no frame
+ * buffer. Changes committed while a frame is being sent go into the next frame.
+ */
+
+#ifndef __TELEMETRY_H
+#define __TELEMETRY_H
+
+#include <Arduino.h>
+#include "ModbusCRC.h"
+#include "ObisValues.h"
+
+#define TELEMETRY_SYNC_1 0xA5
+#define TELEMETRY_SYNC_2 0x5A
+#define TELEMETRY_MASK_BYTES ((registerPageCount(LIVE_REGISTERS_BASE >> 8) + 7) / 8)
+#define TELEMETRY_HEADER_LENGTH (3 + TELEMETRY_MASK_BYTES)
+#define TELEMETRY_ALL_REGISTERS ((uint32_t)((1ULL << registerPageCount(LIVE_REGISTERS_BASE >> 8)) - 1))
+
+#ifndef TELEMETRY_FULL_INTERVAL
+#define TELEMETRY_FULL_INTERVAL 64
+#endif
+
+class TelemetryEncoder
+{
+public:
+    /*
+     * Call after each commit, with ObisValues::getChangedLiveRegisters().
+     */
+    void onCommit(uint32_t changed);
+
+    bool isPending();
+
+    /*
+     * Next byte of the current frame. isPending() must be true.
+     */
+    uint8_t next(ObisValues *obisValues);
+
+private:
+    ModbusCRC crc = ModbusCRC();
+    bool pending = false;
+    uint32_t mask;         // Registers still to send in the current frame
+    uint32_t queued = 0;   // Registers changed since the current frame started
+    bool isQueued = false; // Another frame to follow
+    uint8_t sequence = 0;
+    uint8_t untilFull = 0; // Frames until the next one with all registers
+    uint8_t step;          // Header byte, register byte or CRC byte
+
+    void start(uint32_t changed);
+};
+
+#if __TEST__
+/*
+ * Host side: Reassemble the registers from a telemetry stream.
+ */
+class TelemetryDecoder
+{
+public:
+    uint16_t registers[32] = {0};
+    uint32_t mask = 0; // Registers updated by the last frame
+    uint8_t sequence = 0;
+    unsigned long frames = 0;
+    unsigned long badCRCs = 0;
+    unsigned long lost = 0; // Frames missing in the sequence
+
+    /*
+     * Return true when a good frame was received.
+     */
+    bool feed(uint8_t c);
+
+private:
+    uint8_t buf[TELEMETRY_HEADER_LENGTH + 2 * 32 + 2];
+    uint8_t p = 0;
+    uint8_t length = 0; // Expected frame length, 0 until the mask is complete
+};
+#endif // __TEST__
+
+#endif // __TELEMETRY_H
+
+// END
@@ -0,0 +1,119 @@
+/*
+ * Push telemetry on the host: Round trip check, and a dump of captured telemetry for listen-only loggers.
+ *
+ * With a capture of SML, decodes it like the device does and sends a telemetry frame after each commit, one byte per
+ * SML byte received at most (same baud rate). A TelemetryDecoder reassembles the live registers from that stream,
+ * which must match the decoder's in the end. Reports the telemetry bytes per frame against full frames. The stream
+ * is written to the output file, if given.
+ *
+ * With -d, decodes a telemetry capture (e.g. from a USB UART on TXD1) and prints the changed registers per frame.
+ *
+ * g++ -O2 -I . -D__TEST__=1 -DTELEMETRY_PUSH=1 -o test-telemetry TelemetryTest.cpp Telemetry.cpp TinySMLDecoder.cpp ModbusCRC.cpp ObisValues.cpp
+ * ./test-telemetry testdata/sml.bin [telemetry.bin]
+ * ./test-telemetry -d telemetry.bin
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "Telemetry.h"
+#include "TinySMLDecoder.h"
+
+#if __TEST__
+static int dump(const char *path)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f)
+    {
+        perror(path);
+        return 2;
+    }
+    TelemetryDecoder telemetry;
+    int c;
+    while ((c = fgetc(f)) != EOF)
+    {
+        if (telemetry.feed((uint8_t)c))
+        {
+            printf("#%3u", telemetry.sequence);
+            for (uint8_t n = 0; n < 32; n++)
+            {
+                if (telemetry.mask & (1UL << n))
+                {
+                    printf(" R%d=0x%04X", LIVE_REGISTERS_BASE + n, telemetry.registers[n]);
+                }
+            }
+            printf("\n");
+        }
+    }
+    fclose(f);
+    printf("%lu frames, %lu bad CRCs, %lu lost\n", telemetry.frames, telemetry.badCRCs, telemetry.lost);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc > 2 && !strcmp(argv[1], "-d"))
+    {
+        return dump(argv[2]);
+    }
+    FILE *f = argc > 1 ? fopen(argv[1], "rb") : NULL;
+    if (!f)
+    {
+        fprintf(stderr, "Usage: %s capture.bin [telemetry.bin] | -d telemetry.bin\n", argv[0]);
+        return 2;
+    }
+    FILE *out = argc > 2 ? fopen(argv[2], "wb") : NULL;
+
+    ObisValues obisValues = ObisValues();
+    TinySMLDecoder decoder = TinySMLDecoder(&obisValues);
+    TelemetryEncoder encoder = TelemetryEncoder();
+    TelemetryDecoder telemetry;
+    uint16_t frames = 0;
+    unsigned long bytes = 0;
+    int c;
+    while ((c = fgetc(f)) != EOF || encoder.isPending())
+    {
+        if (c != EOF)
+        {
+            decoder.feed((uint8_t)c);
+            if (obisValues.getDiagnosticRegister(DIAG_FRAMES) != frames)
+            {
+                frames = obisValues.getDiagnosticRegister(DIAG_FRAMES);
+                encoder.onCommit(obisValues.getChangedLiveRegisters());
+            }
+        }
+        if (encoder.isPending())
+        {
+            uint8_t t = encoder.next(&obisValues);
+            telemetry.feed(t);
+            if (out)
+            {
+                fputc(t, out);
+            }
+            bytes++;
+        }
+    }
+    fclose(f);
+    if (out)
+    {
+        fclose(out);
+    }
+
+    int failures = telemetry.badCRCs + telemetry.lost;
+    const uint8_t n = obisValues.getLiveRegistersCount();
+    for (uint8_t k = 0; k < n; k++)
+    {
+        if (telemetry.registers[k] != obisValues.getLiveRegister(k))
+        {
+            printf("R%d: 0x%04X, telemetry 0x%04X\n", LIVE_REGISTERS_BASE + k, obisValues.getLiveRegister(k), telemetry.registers[k]);
+            failures++;
+        }
+    }
+    const unsigned full = TELEMETRY_HEADER_LENGTH + 2 * n + 2;
+    printf("%u commits, %lu telemetry frames, %lu bad CRCs, %lu lost\n", frames, telemetry.frames, telemetry.badCRCs, telemetry.lost);
+    printf("%.1f bytes per frame, %u for all %u live registers\n", telemetry.frames ? (double)bytes / telemetry.frames : 0.0, full, n);
+    printf("%s\n", failures ? "FAIL" : "OK");
+    return failures ? 1 : 0;
+}
+#endif
+
+// END
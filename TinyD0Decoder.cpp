@@ -0,0 +1,244 @@
+/*
+ * Streaming D0 decoder. See TinyD0Decoder.h.
+ */
+
+#include "TinyD0Decoder.h"
+
+#define D0_IDLE 0       // Waiting for '/'
+#define D0_SKIP_LINE 1  // Identification, or a line not of interest
+#define D0_LINE_START 2
+#define D0_OBIS_CODE 3
+#define D0_VALUE 4
+#define D0_UNIT 5
+#define D0_END 6        // Line with '!', checksum if any
+
+#define D0_MAX_SCALER 9 // Integer digits dropped before a value is no longer a number, far beyond any register
+
+static bool isEvenParity(uint8_t cc)
+{
+    cc ^= cc >> 4;
+    cc ^= cc >> 2;
+    cc ^= cc >> 1;
+    return !(cc & 1);
+}
+
+void TinyD0Decoder::reset()
+{
+    state = D0_IDLE;
+    isBad = false;
+    obisValues->reset();
+}
+
+void TinyD0Decoder::onEnd()
+{
+    if (isBad)
+    {
+        obisValues->incrementDiagnosticRegister(DIAG_BAD_CRCS);
+        obisValues->trace(TRACE_SML_BAD_CRC, 1);
+        obisValues->reset();
+    }
+    else
+    {
+        obisValues->commit();
+    }
+    state = D0_IDLE;
+}
+
+void TinyD0Decoder::onLineStart(uint8_t c)
+{
+    if (c == '!')
+    {
+        state = D0_END;
+    }
+    else if (c >= '0' && c <= '9')
+    {
+        obis[0] = 1; // 1-0:C.D.E*255 unless given
+        obis[1] = 0;
+        obis[5] = 0xFF;
+        field = c - '0';
+        dots = 0;
+        state = D0_OBIS_CODE;
+    }
+    else if (c != '\r')
+    {
+        state = D0_SKIP_LINE;
+    }
+}
+
+void TinyD0Decoder::onObisCode(uint8_t c)
+{
+    if (c >= '0' && c <= '9')
+    {
+        field = field * 10 + (c - '0');
+        return;
+    }
+    if (c == '-')
+    {
+        obis[0] = field;
+    }
+    else if (c == ':')
+    {
+        obis[1] = field;
+    }
+    else if (c == '.' && dots < 2)
+    {
+        obis[2 + dots++] = field;
+    }
+    else if (c == '*' && dots == 2)
+    {
+        obis[4] = field;
+        dots = 3;
+    }
+    else if (c == '(' && dots >= 2)
+    {
+        obis[dots == 2 ? 4 : 5] = field;
+        obisValues->feedObisOctetString(obis, sizeof(obis));
+        isNumber = !obisValues->expectsValue(OBIS_OCTET_CODES);
+        isNegative = false;
+        hasDigits = false;
+        decimals = -1;
+        scaler = 0;
+        value = 0;
+        state = D0_VALUE;
+    }
+    else
+    {
+        state = D0_SKIP_LINE;
+    }
+    field = 0;
+}
+
+void TinyD0Decoder::onValue(uint8_t c)
+{
+    if (!isNumber)
+    {
+        value = (value << 8) | c;
+    }
+    else if (c >= '0' && c <= '9')
+    {
+        hasDigits = true;
+        if (value <= (UINT32_MAX - 9) / 10)
+        {
+            value = value * 10 + (c - '0');
+            if (decimals >= 0)
+            {
+                decimals++;
+            }
+        }
+        else if (decimals < 0)
+        {
+            scaler++;
+            isNumber = scaler <= D0_MAX_SCALER;
+        }
+    }
+    else if (c == '.' && decimals < 0)
+    {
+        decimals = 0;
+    }
+    else if (c == '-' && !hasDigits && !isNegative)
+    {
+        isNegative = true;
+    }
+    else
+    {
+        isNumber = false;
+    }
+}
+
+void TinyD0Decoder::onEndOfValue()
+{
+    if (obisValues->expectsValue(OBIS_OCTET_CODES))
+    {
+        obisValues->feedObisValue(value);
+    }
+    else if (isNumber && hasDigits && obisValues->expectsValue(OBIS_SIGNED_CODES | OBIS_UNSIGNED_CODES))
+    {
+        const int64_t raw = isNegative ? -(int64_t)value : (int64_t)value;
+        const int8_t s = scaler - (decimals > 0 ? decimals : 0);
+#if VALUE_VIEWS
+        obisValues->feedObisRawValue(raw, s);
+#else
+        obisValues->feedObisValue((uint32_t)scaleValue(raw, s));
+#endif
+    }
+    obisValues->feedObisOctetString(obis, 0); // Taken or not
+    state = D0_SKIP_LINE;
+}
+
+void TinyD0Decoder::feed(const uint8_t cc)
+{
+    const uint8_t c = cc & 0x7F;
+    if (c == '/')
+    {
+        length = 1;
+        obisValues->reset();
+        isBad = D0_PARITY && !isEvenParity(cc);
+        state = D0_SKIP_LINE;
+        return;
+    }
+    if (state == D0_IDLE)
+    {
+        return;
+    }
+    length++;
+    if (D0_PARITY && !isEvenParity(cc))
+    {
+        isBad = true;
+    }
+    if (c == '\n')
+    {
+        if (state == D0_END)
+        {
+            onEnd();
+            return;
+        }
+        if (state >= D0_OBIS_CODE)
+        {
+            obisValues->feedObisOctetString(obis, 0); // Line cut short
+        }
+        state = D0_LINE_START;
+        return;
+    }
+
+    switch (state)
+    {
+    case D0_SKIP_LINE:
+    case D0_END:
+        break;
+    case D0_LINE_START:
+        onLineStart(c);
+        break;
+    case D0_OBIS_CODE:
+        onObisCode(c);
+        break;
+    case D0_VALUE:
+        if (c == ')')
+        {
+            onEndOfValue();
+        }
+        else if (c == '*')
+        {
+            state = D0_UNIT;
+        }
+        else
+        {
+            onValue(c);
+        }
+        break;
+    default: // D0_UNIT
+        if (c == ')')
+        {
+            onEndOfValue();
+        }
+        else if (c == 'k')
+        {
+            scaler += 3;
+        }
+        else if (c == 'M')
+        {
+            scaler += 6;
+        }
+    }
+}
+
+// END
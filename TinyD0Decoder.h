@@ -0,0 +1,75 @@
+/*
+ * Streaming decoder for IEC 62056-21 (D0) mode D telegrams, as pushed by older meters on the same optical interface:
+ *
+ *     /ESY5Q3DA1004 V3.04
+ *
+ *     1-0:0.0.0*255(1ESY1160112345)
+ *     1-0:1.8.0*255(00004710.9424690*kWh)
+ *     1-0:16.7.0*255(000370.92*W)
+ *     !
+ *
+ * '/' starts a telegram, the line with '!' ends it. Lines are parsed as they come, without a line buffer: the OBIS code into six
+ * bytes, fed to ObisValues on '(', the value into a 32 bit integer with the decimal point as scaler, and the unit
+ * prefix (k, M) on top. Digits beyond 32 bits are dropped: after the decimal point they are below any register's
+ * resolution, before it they count into the scaler. Codes in A-B:C.D.E*F form, or C.D.E with A-B = 1-0 and F = 255 left out. Values of unknown codes are
+ * skipped, octet string codes (OBIS_OCTET_CODES) take the last four characters. Only the first value of a line is
+ * taken.
+ *
+ * The standard's 7E1 is received as 8N1 with the parity in bit 7: with D0_PARITY, a telegram with a parity error is
+ * dropped. There is no checksum in mode D otherwise.
+ */
+
+#ifndef __TINYD0DECODER_H
+#define __TINYD0DECODER_H
+
+#include <Arduino.h>
+#include "ObisValues.h"
+
+// Check even parity in bit 7 (7E1). Set to 0 for meters that send 8N1.
+#ifndef D0_PARITY
+#define D0_PARITY 1
+#endif
+
+class TinyD0Decoder
+{
+public:
+    TinyD0Decoder(ObisValues *obisValues_)
+        : obisValues(obisValues_), length(0)
+    {
+        reset();
+    }
+
+    void reset();
+    void feed(uint8_t cc);
+
+    // Bytes from '/' on, of the telegram being decoded or the one just ended
+    uint16_t getFrameLength() { return length; }
+
+private:
+    ObisValues *obisValues;
+    uint16_t length;
+
+    uint8_t state;
+    bool isBad;    // Parity error in the current telegram
+    uint8_t dots;  // Dots seen in the OBIS code, 3 after the star
+    uint8_t field; // Number being read
+    uint8_t obis[6];
+
+    // Value
+    bool isNumber;   // False for octet string codes, and once a number turned out not to be one
+    bool isNegative;
+    bool hasDigits;
+    int8_t decimals; // Digits after the decimal point, -1 before it
+    int8_t scaler;   // Unit prefix, and integer digits dropped
+    uint32_t value;  // Mantissa, or the last four characters of an octet string
+
+    void onEnd();
+    void onLineStart(uint8_t c);
+    void onObisCode(uint8_t c);
+    void onValue(uint8_t c);
+    void onEndOfValue();
+};
+
+#endif // __TINYD0DECODER_H
+
+// END
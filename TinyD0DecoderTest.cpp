@@ -0,0 +1,138 @@
+/*
+ * D0 decoder on the host: Decodes sample telegrams sent as 7E1 (mode D of a three-phase meter, short codes, negative
+ * power, a parity error, lines cut short) and checks the registers and the frame length, then reports the throughput.
+ * With a file argument, decodes a capture instead and prints the registers.
+ *
+ * g++ -O2 -I . -D__TEST__=1 -o test-d0 TinyD0DecoderTest.cpp TinyD0Decoder.cpp ObisValues.cpp
+ * ./test-d0 [capture.txt]
+ */
+
+#include <stdio.h>
+#include "TinyD0Decoder.h"
+
+#if __TEST__
+#include <string.h>
+#include <time.h>
+
+static const char *TELEGRAM = "/ESY5Q3DA1004 V3.04\r\n"
+                              "\r\n"
+                              "1-0:0.0.0*255(1ESY1160112345)\r\n"
+                              "1-0:1.8.0*255(00004710.9424690*kWh)\r\n"
+                              "1-0:2.8.0*255(00000123.4560000*kWh)\r\n"
+                              "1-0:21.7.255*255(000123.45*W)\r\n"
+                              "1-0:16.7.0*255(000370.92*W)\r\n"
+                              "1-0:96.5.5*255(82)\r\n"
+                              "0-0:96.1.255*255(1ESY1160112345)\r\n"
+                              "!\r\n";
+
+static const char *SHORT_CODES = "/LGZ4ZMF100AC.M23\r\n"
+                                 "\r\n"
+                                 "F.F(00)\r\n"
+                                 "1.8.0(004711.123*kWh)\r\n"
+                                 "2.8.0(000124*kWh)\r\n"
+                                 "16.7.0(-000123.45*W)(garbage\r\n"
+                                 "!\r\n";
+
+static const char *CUT_SHORT = "/ESY5Q3DA1004 V3.04\r\n"
+                               "\r\n"
+                               "1-0:1.8.0*255(00004712\r\n"
+                               "1-0:16.7.0*255(000001.5*kW)\r\n"
+                               "!\r\n";
+
+static void send(TinyD0Decoder &decoder, const char *s, bool parity = true, int flipAt = -1)
+{
+    for (int k = 0; s[k]; k++)
+    {
+        uint8_t c = s[k];
+        if (parity && __builtin_parity(c))
+        {
+            c |= 0x80; // 7E1
+        }
+        decoder.feed(k == flipAt ? c ^ 0x04 : c);
+    }
+}
+
+static uint32_t getValue(ObisValues &obisValues, uint8_t n)
+{
+    const uint8_t rr = registerBlockStart(BLOCK_OBIS) + 2 * n;
+    return ((uint32_t)obisValues.getLiveRegister(rr) << 16) | obisValues.getLiveRegister(rr + 1);
+}
+
+static int check(ObisValues &obisValues, const char *name, uint32_t imported, uint32_t exported, int32_t power, uint16_t frames)
+{
+    const bool ok = getValue(obisValues, 0) == imported && getValue(obisValues, 1) == exported &&
+                    (int32_t)getValue(obisValues, 2) == power && obisValues.getDiagnosticRegister(DIAG_FRAMES) == frames;
+    printf("%-20s %9u Wh %9u Wh %6d W  %u frames  %s\n", name, getValue(obisValues, 0), getValue(obisValues, 1),
+           (int32_t)getValue(obisValues, 2), obisValues.getDiagnosticRegister(DIAG_FRAMES), ok ? "OK" : "FAIL");
+    return !ok;
+}
+
+static int decodeFile(const char *path)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f)
+    {
+        fprintf(stderr, "Cannot read %s\n", path);
+        return 2;
+    }
+    ObisValues obisValues = ObisValues();
+    TinyD0Decoder decoder = TinyD0Decoder(&obisValues);
+    int c;
+    while ((c = fgetc(f)) != EOF)
+    {
+        decoder.feed(c);
+    }
+    fclose(f);
+    for (uint8_t k = 0; k < N_KNOWN_OBIS_CODES; k++)
+    {
+        printf("R%d: %u\n", LIVE_REGISTERS_BASE + registerBlockStart(BLOCK_OBIS) + 2 * k, getValue(obisValues, k));
+    }
+    printf("%u telegrams, %u with parity errors\n", obisValues.getDiagnosticRegister(DIAG_FRAMES),
+           obisValues.getDiagnosticRegister(DIAG_BAD_CRCS));
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc > 1)
+    {
+        return decodeFile(argv[1]);
+    }
+
+    ObisValues obisValues = ObisValues();
+    TinyD0Decoder decoder = TinyD0Decoder(&obisValues);
+    int failures = 0;
+    send(decoder, TELEGRAM);
+    failures += check(obisValues, "mode D, 7E1", 4710942, 123456, 371, 1);
+    failures += decoder.getFrameLength() != strlen(TELEGRAM);
+    send(decoder, TELEGRAM, false);
+    failures += check(obisValues, "8N1: parity errors", 4710942, 123456, 371, 1);
+    failures += obisValues.getDiagnosticRegister(DIAG_BAD_CRCS) != 1;
+    send(decoder, SHORT_CODES);
+    failures += check(obisValues, "short codes", 4711123, 124000, -123, 2);
+    send(decoder, TELEGRAM, true, strstr(TELEGRAM, "(00004710") - TELEGRAM + 6);
+    failures += check(obisValues, "bit flipped", 4711123, 124000, -123, 2);
+    send(decoder, CUT_SHORT);
+    failures += check(obisValues, "line cut short", 4711123, 124000, 1500, 3);
+
+    // Throughput
+    ObisValues timed = ObisValues();
+    TinyD0Decoder d = TinyD0Decoder(&timed);
+    const size_t n = 200000;
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (size_t k = 0; k < n; k++)
+    {
+        send(d, TELEGRAM);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    const double t = t1.tv_sec - t0.tv_sec + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+    printf("%zu telegrams of %zu bytes: %.1f MB/s\n", n, strlen(TELEGRAM), n * strlen(TELEGRAM) / t / 1e6);
+    failures += timed.getDiagnosticRegister(DIAG_FRAMES) != (uint16_t)n;
+
+    printf("%s\n", failures ? "FAIL" : "OK");
+    return failures ? 1 : 0;
+}
+#endif
+
+// END
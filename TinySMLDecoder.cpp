@@ -10,8 +10,21 @@
 #endif
 #include "TinySMLDecoder.h"
 
+// Nesting: 1 SML_Message, 2 message body choice, 3 message body, for SML_GetList.Res: 4 valList, 5 list entry
+#define MESSAGE_ON_LEVEL 1
+#define MESSAGE_BODY_ON_LEVEL 3
 #define OBIS_CODES_ON_LEVEL 5
 
+// Element indices
+#define MESSAGE_TRANSACTION_ID 0 // SML_Message
+#define GET_LIST_SERVER_ID 1     // SML_GetList.Res
+#define GET_LIST_SENSOR_TIME 3
+#define GET_LIST_VAL_LIST 4
+#define ENTRY_OBIS_CODE 0        // SML_ListEntry
+#define ENTRY_SCALER 4
+#define ENTRY_VALUE 5
+#define TIME_VALUE 1             // SML_Time: choice tag (secIndex, timestamp), value
+
 void TinySMLDecoder::reset()
 {
     z = 0;
@@ -21,6 +34,13 @@ void TinySMLDecoder::reset()
     zr = 0;
     p = 0;
     level = 0;
+    messageType = 0;
+#if SML_MESSAGE_DATA
+    sensorTime = 0;
+    serverId = 0;
+    transaction = 0;
+    isListSeen = false;
+#endif
 
 #if __DEBUG__
     maxlevel = 0;
@@ -31,13 +51,20 @@ void TinySMLDecoder::reset()
     obisValues->reset();
 }
 
+void TinySMLDecoder::resync()
+{
+    obisValues->incrementDiagnosticRegister(DIAG_RESYNCS);
+    obisValues->trace(TRACE_SML_RESYNC, z);
+    reset();
+}
+
 void TinySMLDecoder::expect(const uint8_t len)
 {
     n = len - 1;
     zr = z;
     if (n > sizeof(buf))
     {
-        reset();
+        resync();
     }
 }
 
@@ -54,6 +81,10 @@ void TinySMLDecoder::onList(const uint8_t nListElements)
     printf("%s-- %d/%d\n", &indent, read[level] + 1, open[level]);
     printf("%s{\n", &indent);
 #endif
+    if (level == 0)
+    {
+        messageType = 0; // New SML_Message
+    }
     if (nListElements > 0)
     {
         level++;
@@ -100,13 +131,37 @@ void TinySMLDecoder::onElement()
     }
 }
 
+bool TinySMLDecoder::isInValList()
+{
+    return messageType == SML_GET_LIST_RES && level > MESSAGE_BODY_ON_LEVEL && read[MESSAGE_BODY_ON_LEVEL] == GET_LIST_VAL_LIST;
+}
+
 void TinySMLDecoder::onOctetString()
 {
-    if (level == OBIS_CODES_ON_LEVEL && read[level] == 0)
+    if (level == OBIS_CODES_ON_LEVEL && read[level] == ENTRY_OBIS_CODE && isInValList())
     {
         // List Element 5.0
+        scaler = 0; // Unless sent
         obisValues->feedObisOctetString(buf, p);
     }
+    else if (level == OBIS_CODES_ON_LEVEL && read[level] == ENTRY_VALUE && isInValList() && obisValues->expectsValue(OBIS_OCTET_CODES))
+    {
+        // Last four bytes, e.g. the serial number of a server ID
+        const uint32_t value = toUnsigned();
+        obisValues->feedObisValue(value);
+    }
+#if SML_MESSAGE_DATA
+    else if (level == MESSAGE_ON_LEVEL && read[level] == MESSAGE_TRANSACTION_ID && !isListSeen)
+    {
+        transaction = (p >= 2) ? (buf[p - 2] << 8) | buf[p - 1] : (p == 1) ? buf[0] : 0;
+    }
+    else if (level == MESSAGE_BODY_ON_LEVEL && read[level] == GET_LIST_SERVER_ID && messageType == SML_GET_LIST_RES)
+    {
+        X25CRC hash = X25CRC();
+        hash.feed(buf, p);
+        serverId = (hash.getCRCHighByte() << 8) | hash.getCRCLowByte();
+    }
+#endif
 }
 
 void TinySMLDecoder::onBoolean()
@@ -116,40 +171,34 @@ void TinySMLDecoder::onBoolean()
 
 void TinySMLDecoder::onInteger()
 {
-#if __DEBUG__
-    int64_t raw = 0;
-#endif
-    if (level == OBIS_CODES_ON_LEVEL)
+    if (level == OBIS_CODES_ON_LEVEL && isInValList())
     {
         const uint8_t nListElement = read[level];
-        if (nListElement == 4 && p == 1)
+        if (nListElement == ENTRY_SCALER && p == 1)
         {
-            // Scaler
             scaler = buf[0];
         }
-        else if (nListElement == 5)
+        else if (nListElement == ENTRY_VALUE && obisValues->expectsValue(OBIS_SIGNED_CODES))
         {
-            // Value
-            int64_t value = 0;
-            if (buf[0] >= 0x80)
-            {
-                value = ~0;
-            }
-            for (uint8_t k = 0; k < p;)
-            {
-                value = (value << 8) + buf[k++];
-            }
+            onValue(toInteger(true));
+        }
+    }
+}
+
+void TinySMLDecoder::onValue(int64_t value)
+{
 #if __DEBUG__
-            raw = value;
+    printf("%s-- value raw    = %lld\n", &indent, value);
 #endif
-            uint32_t scaled = toScale(value);
-            obisValues->feedObisValue(scaled);
+#if VALUE_VIEWS
+    obisValues->feedObisRawValue(value, scaler); // Scaled at commit, with the view
+#else
+    uint32_t scaled = toScale(value);
+    obisValues->feedObisValue(scaled);
 #if __DEBUG__
-            printf("%s-- value raw    = %lld\n", &indent, raw);
-            printf("%s-- value scaled = %lu\n", &indent, scaled);
+    printf("%s-- value scaled = %lu\n", &indent, scaled);
+#endif
 #endif
-        }
-    }
 }
 
 uint32_t TinySMLDecoder::toScale(int64_t value)
@@ -177,9 +226,52 @@ uint32_t TinySMLDecoder::toScale(int64_t value)
     return (uint32_t)value;
 }
 
+int64_t TinySMLDecoder::toInteger(bool isSigned)
+{
+    int64_t value = (isSigned && p && buf[0] >= 0x80) ? ~0 : 0;
+    for (uint8_t k = 0; k < p;)
+    {
+        value = (value << 8) + buf[k++];
+    }
+    return value;
+}
+
+uint32_t TinySMLDecoder::toUnsigned()
+{
+    uint32_t value = 0;
+    for (uint8_t k = 0; k < p;)
+    {
+        value = (value << 8) + buf[k++];
+    }
+    return value;
+}
+
 void TinySMLDecoder::onUnsigned()
 {
-    // Ignore. All the measurements we're interested in are signed.
+    if (level == MESSAGE_ON_LEVEL + 1 && read[level] == 0)
+    {
+        // Message body tag, e.g. 63 07 01
+        messageType = (uint16_t)toUnsigned();
+#if __DEBUG__
+        printf("%s-- message %04X\n", &indent, messageType);
+#endif
+#if SML_MESSAGE_DATA
+        isListSeen |= messageType == SML_GET_LIST_RES;
+#endif
+    }
+#if SML_MESSAGE_DATA
+    else if (level == MESSAGE_BODY_ON_LEVEL + 1 && read[level] == TIME_VALUE && messageType == SML_GET_LIST_RES &&
+             read[MESSAGE_BODY_ON_LEVEL] == GET_LIST_SENSOR_TIME)
+    {
+        sensorTime = toUnsigned();
+    }
+#endif
+    else if (level == OBIS_CODES_ON_LEVEL && read[level] == ENTRY_VALUE && isInValList() && obisValues->expectsValue(OBIS_UNSIGNED_CODES))
+    {
+        // Values up to 2^63 - 1
+        onValue(toInteger(false));
+    }
+    // Ignore others, e.g. units
 }
 
 void TinySMLDecoder::onUnrecognizedElement()
@@ -238,6 +330,9 @@ void TinySMLDecoder::onGoodCRC()
 {
 #if __DEBUG__
     printf("%s-- CRC OK\n", &indent);
+#endif
+#if SML_MESSAGE_DATA
+    obisValues->feedMessageData(sensorTime, serverId, isListSeen ? transaction : 0);
 #endif
     obisValues->commit();
 }
@@ -247,6 +342,8 @@ void TinySMLDecoder::onBadCRC()
 #if __DEBUG__
     printf("%s-- BAD CRC", &indent);
 #endif
+    obisValues->incrementDiagnosticRegister(DIAG_BAD_CRCS);
+    obisValues->trace(TRACE_SML_BAD_CRC, 0);
     obisValues->reset();
 }
 
@@ -254,6 +351,11 @@ void TinySMLDecoder::feed(const uint8_t cc)
 {
     uint8_t z0 = z;
 
+    if (z == 0 && cc == 0x1B)
+    {
+        length = 0;
+    }
+    length++;
     if (!m)
     {
         crc.feed(cc);
@@ -341,7 +443,7 @@ void TinySMLDecoder::feed(const uint8_t cc)
             }
             else
             {
-                reset();
+                resync();
             }
         }
         else if (cc == 0x1B) // Start of EOM
@@ -366,14 +468,21 @@ void TinySMLDecoder::feed(const uint8_t cc)
         }
         else
         {
-            reset();
+            resync();
         }
     }
 
     // Unchanged state? We could not read a valid next input? Reset and re-sync.
     if (z == z0 && z < 9)
     {
-        reset();
+        if (z)
+        {
+            resync();
+        }
+        else
+        {
+            reset();
+        }
     }
 }
 
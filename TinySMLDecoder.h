@@ -12,11 +12,16 @@
 #include "ModbusCRC.h"
 #include "ObisValues.h"
 
+// SML message body tags (Section 7.1)
+#define SML_PUBLIC_OPEN_RES 0x0101
+#define SML_PUBLIC_CLOSE_RES 0x0201
+#define SML_GET_LIST_RES 0x0701
+
 class TinySMLDecoder
 {
 public:
     TinySMLDecoder(ObisValues *obisValues_)
-        : obisValues(obisValues_)
+        : obisValues(obisValues_), length(0)
     {
         reset();
     }
@@ -24,8 +29,12 @@ public:
     void reset();
     void feed(uint8_t cc);
 
+    // Bytes from the start sequence on, of the frame being decoded or the one just ended
+    uint16_t getFrameLength() { return length; }
+
 private:
     ObisValues *obisValues;
+    uint16_t length;
 
     // State management
     uint8_t z;  // SML encoding-level status
@@ -41,6 +50,16 @@ protected:
 
     int8_t scaler; // which scaler was received in the current OBIS code list element
 
+    // Current SML message
+    uint16_t messageType; // Message body tag, SML_..._RES, 0 until known
+#if SML_MESSAGE_DATA
+    // Message level data for the registers, written at commit. From the current message until SML_GetList.Res is seen.
+    uint32_t sensorTime;  // actSensorTime, 0 if not sent
+    uint16_t serverId;    // X.25 CRC of the server ID
+    uint16_t transaction; // Last two bytes of the transaction ID
+    bool isListSeen;
+#endif
+
     // Nesting
     uint8_t level;
     uint8_t open[9]; // Note we do not need more than 5 levels (for my meter, anyway)
@@ -65,15 +84,20 @@ protected:
     void onBoolean();
     void onInteger();
     void onUnsigned();
+    void onValue(int64_t value); // Signed or unsigned value of a known OBIS code, to be scaled
     void onUnrecognizedElement();
     void onEOM();
     void onGoodCRC();
     void onBadCRC();
     uint32_t toScale(int64_t rawValue);
+    int64_t toInteger(bool isSigned);
+    uint32_t toUnsigned(); // Last four bytes at most
+    bool isInValList();
 
 private:
     // Low level SML structure decoding. It should not be needed to subclass these.
     void expect(uint8_t cc);
+    void resync(); // Reset after unexpected input
     void maybeLeaveLevel();
     void leaveLevel();
 };
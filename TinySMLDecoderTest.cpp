@@ -21,7 +21,7 @@ int main(int argc, char *argv[])
     }
     fclose(fIN);
     printf("\n");
-    uint8_t m = obisValues.getLiveRegistersCount();
+    uint8_t m = N_VERSION_REGISTERS + N_KNOWN_OBIS_REGISTERS;
     uint32_t dec = 0;
     for (uint8_t k = 0; k < m;)
     {
@@ -33,6 +33,14 @@ int main(int argc, char *argv[])
             printf("      %d\n", dec);
         }
     }
+#if SML_MESSAGE_DATA
+    printf("Sensor time: %u s\n", ((uint32_t)obisValues.getSmlRegister(SML_SENSOR_TIME) << 16) | obisValues.getSmlRegister(SML_SENSOR_TIME + 1));
+    printf("Server ID:   0x%04X\n", obisValues.getSmlRegister(SML_SERVER_ID));
+    printf("Transaction: 0x%04X\n", obisValues.getSmlRegister(SML_TRANSACTION));
+#endif
+    uint8_t r = registerBlockStart(BLOCK_POWER);
+    int32_t power = ((uint32_t)obisValues.getLiveRegister(r + POWER_VALUE) << 16) | obisValues.getLiveRegister(r + POWER_VALUE + 1);
+    printf("Power:       %d W, quality 0x%04X\n", power, obisValues.getLiveRegister(r + POWER_QUALITY));
     return 0;
 }
 #endif
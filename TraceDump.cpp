@@ -0,0 +1,162 @@
+/*
+ * Event trace dump: Reads the trace registers (768, ...) and prints the events as a timeline, oldest first, with
+ * their age at the time of reading. Entries keep 8 bits of the timestamp, so ages wrap around after 4 minutes: older
+ * ages are ambiguous, the order is not. Arguments are the low 4 bits of what the unit passed, see ObisValues.h.
+ *
+ * Reads via Modbus TCP, from the gateway or from a Modbus TCP to RTU bridge in front of the unit. With "-", reads
+ * register values from stdin instead, one per line, decimal or 0x hex, e.g. the output of
+ *   modpoll -t 3:hex -a 9 -0 -r 768 -c 10 -1 -b 115200 -s 2 COM6
+ *
+ * g++ -O2 -I . -D__TEST__=1 -o trace-dump TraceDump.cpp
+ * ./trace-dump host [port] [unit]
+ * ./trace-dump - < registers.txt
+ */
+
+#include <stdio.h>
+#include "BaudDetector.h"
+#include "ExposeToModbus.h"
+
+#if __TEST__
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <sys/socket.h>
+
+static_assert(TRACE_ENTRIES > 0, "Build with the TRACE_ENTRIES of the unit, e.g. -DTRACE_ENTRIES=16 if it was built so");
+
+static const char *EVENT_NAMES[] = {"boot", "SML resync", "SML bad CRC", "SML commit", "Modbus request",
+                                    "Modbus exception", "Modbus bad CRC", "Modbus oversize", "INFO-DSS baud", "deadline miss",
+                                    "INFO-DSS protocol"};
+static_assert(sizeof(EVENT_NAMES) / sizeof(EVENT_NAMES[0]) == N_TRACE_EVENTS, "One name per trace event");
+static const char *PROTOCOL_NAMES[] = {"detecting", "SML", "D0"};
+static const uint16_t BAUD_CANDIDATES[N_BAUD_CANDIDATES] = BAUD_CANDIDATES_100;
+
+static bool readRegisters(const char *host, const char *port, uint8_t unit, uint16_t *registers)
+{
+    struct addrinfo hints, *ai;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host, port, &hints, &ai) != 0)
+    {
+        fprintf(stderr, "Cannot resolve %s\n", host);
+        return false;
+    }
+    int fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+    if (fd < 0 || connect(fd, ai->ai_addr, ai->ai_addrlen) < 0)
+    {
+        perror(host);
+        freeaddrinfo(ai);
+        return false;
+    }
+    freeaddrinfo(ai);
+
+    const uint8_t request[] = {0, 1, 0, 0, 0, 6, unit, 0x04, TRACE_REGISTERS_BASE >> 8, (uint8_t)TRACE_REGISTERS_BASE, 0, N_TRACE_REGISTERS};
+    uint8_t response[9 + 2 * N_TRACE_REGISTERS];
+    size_t got = 0;
+    bool ok = write(fd, request, sizeof(request)) == sizeof(request);
+    while (ok && got < sizeof(response))
+    {
+        ssize_t n = read(fd, response + got, sizeof(response) - got);
+        ok = n > 0 && !(got + n >= 9 && (response[7] & 0x80));
+        got += (n > 0) ? n : 0;
+    }
+    close(fd);
+    if (!ok || response[8] != 2 * N_TRACE_REGISTERS)
+    {
+        fprintf(stderr, "No trace registers at %s, unit %d (exception 0x%02X)\n", host, unit, got >= 9 ? response[8] : 0);
+        return false;
+    }
+    for (uint8_t k = 0; k < N_TRACE_REGISTERS; k++)
+    {
+        registers[k] = (response[9 + 2 * k] << 8) | response[10 + 2 * k];
+    }
+    return true;
+}
+
+static bool readStdin(uint16_t *registers)
+{
+    char line[128];
+    uint8_t n = 0;
+    while (n < N_TRACE_REGISTERS && fgets(line, sizeof(line), stdin))
+    {
+        const char *value = strrchr(line, ':'); // modpoll: [768]: 0x0003
+        value = value ? value + 1 : line;
+        char *end;
+        long v = strtol(value, &end, 0);
+        if (end != value)
+        {
+            registers[n++] = (uint16_t)v;
+        }
+    }
+    if (n < N_TRACE_REGISTERS)
+    {
+        fprintf(stderr, "Expected %d registers, got %d\n", N_TRACE_REGISTERS, n);
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "Usage: %s host [port] [unit] | -\n", argv[0]);
+        return 2;
+    }
+    uint16_t registers[N_TRACE_REGISTERS];
+    if (!(strcmp(argv[1], "-") ? readRegisters(argv[1], argc > 2 ? argv[2] : "502", argc > 3 ? atoi(argv[3]) : RS_485_ADDRESS, registers)
+                               : readStdin(registers)))
+    {
+        return 1;
+    }
+
+    const uint16_t count = registers[TRACE_COUNT];
+    const uint16_t now = registers[TRACE_NOW];
+    const uint16_t n = count < TRACE_ENTRIES ? count : TRACE_ENTRIES;
+    printf("%u events, last %u:\n", count, n);
+    for (uint16_t k = count - n; k != count; k++)
+    {
+        const uint16_t entry = registers[N_TRACE_HEADER_REGISTERS + (k & (TRACE_ENTRIES - 1))];
+        const uint8_t event = (entry >> 4) & 0x0F;
+        const uint8_t arg = entry & 0x0F;
+        const double age = (uint8_t)(now - (entry >> 8)) * TRACE_TICK_MS / 1000.0;
+        printf("#%-5u %8.1fs  %-16s ", k, -age, event < N_TRACE_EVENTS ? EVENT_NAMES[event] : "?");
+        switch (event)
+        {
+        case TRACE_SML_RESYNC:
+            printf("state %u\n", arg);
+            break;
+        case TRACE_SML_COMMIT:
+            printf("transaction ..%X\n", arg);
+            break;
+        case TRACE_MODBUS_REQUEST:
+        case TRACE_MODBUS_EXCEPTION:
+        case TRACE_MODBUS_OVERSIZE:
+            printf("function 0x.%X\n", arg);
+            break;
+        case TRACE_MODBUS_BAD_CRC:
+            printf("unit %u (mod 16)\n", arg);
+            break;
+        case TRACE_BAUD_CHANGE:
+            printf("%u baud\n", arg < N_BAUD_CANDIDATES ? BAUD_CANDIDATES[arg] * 100 : 0);
+            break;
+        case TRACE_SML_BAD_CRC:
+            printf("%s\n", arg ? "D0 parity" : "SML");
+            break;
+        case TRACE_DEADLINE_MISS:
+            printf("task %u\n", arg);
+            break;
+        case TRACE_PROTOCOL_CHANGE:
+            printf("%s\n", arg < sizeof(PROTOCOL_NAMES) / sizeof(PROTOCOL_NAMES[0]) ? PROTOCOL_NAMES[arg] : "?");
+            break;
+        default:
+            printf("%u\n", arg);
+        }
+    }
+    return 0;
+}
+#endif
+
+// END
@@ -0,0 +1,343 @@
+/*
+ * Closed loop test of PinKeepAlive against a virtual meter: How much of the time is extended data available?
+ *
+ * PinKeepAlive.cpp runs on the 100ms tick as on the device. Its LED output shines on a model of the meter's optical
+ * input, which recognizes light pulses of at least METER_MIN_PULSE_MS. Note that the keep-alive flash lasts one tick
+ * longer than FLASH_TICKS, the LED is only switched off with the next entry of the queue. So the 300ms flash that works
+ * is 400ms, and 200ms is 300ms. The meter:
+ * - Display off: a pulse starts the display test
+ * - Display test: the next pulse starts PIN entry
+ * - PIN entry: each pulse counts the current digit up, the digit is taken after METER_DIGIT_ADVANCE_MS without a pulse
+ *   and with the light off. A pulse that has started holds the digit, it counts once it ends.
+ * - After the last digit: extended data with the right PIN, display off otherwise
+ * - Extended data: lost, and display off, after METER_TIMEOUT_MS without a pulse
+ * - Display test and PIN entry also end after METER_TIMEOUT_MS without a pulse
+ * Once a second the meter sends an SML frame (SMLGenerator): with 16.7.0 in Wh resolution while extended data is
+ * enabled, a basic frame with the counters in kWh otherwise. The frames go through the decoder, as INFO-DSS input
+ * would, and a second counts as extended when 16.7.0 came with it (value age 0).
+ *
+ * Keep-alive strategies are PinKeepAlive.cpp built with different settings, each in its own namespace. Simulates
+ * a number of hours, much faster than real time, and reports per strategy the share of time with extended data,
+ * the time until the first extended frame, how often extended data got lost, and wrong PINs taken by the meter. Fails
+ * if a strategy expected to work has extended data less than 95% of the time or enters a wrong PIN, or if one expected
+ * not to work reaches 95% (then the model no longer tells them apart).
+ *
+ * g++ -O2 -I . -D__TEST__=1 -o test-meter VirtualMeterTest.cpp SMLGenerator.cpp TinySMLDecoder.cpp ModbusCRC.cpp ObisValues.cpp
+ * ./test-meter [hours]
+ */
+
+#include <Arduino.h>
+#include <stdio.h>
+#include "SMLGenerator.h"
+#include "TinySMLDecoder.h"
+
+#if __TEST__
+#include <stdlib.h>
+#include <string.h>
+
+#define TICK_MS 100
+#define METER_MIN_PULSE_MS 350      // Shorter flashes go unnoticed: 400ms work, 300ms do not
+#define METER_DIGIT_ADVANCE_MS 3000 // Pause after which the current PIN digit is taken
+#define METER_TIMEOUT_MS 120000     // Without light, the meter forgets the PIN
+#define METER_FRAME_MS 1000
+
+// Stock settings, PIN resend every 20 minutes
+#define METER_PIN "1234"
+namespace stock
+{
+#include "PinKeepAlive.cpp"
+}
+#undef METER_PIN
+#undef LED_W
+#undef LED_ON
+#undef LED_OFF
+#undef BTN_IN
+#undef KEEP_ALIVE_TICKS
+#undef FLASH_TICKS
+#undef SHORT_PULSE_TICKS
+#undef DIGIT_GAP0_TICKS
+#undef DIGIT_GAP1_TICKS
+#undef DIGIT_GAP2_TICKS
+#undef PIN_RESEND_TOCKS
+#undef PIN_FORCE_TICKS
+
+// Resend the PIN only every 255 keep-alives, 7 hours
+#define METER_PIN "1234"
+#define PIN_RESEND_TOCKS 255
+namespace rareResend
+{
+#include "PinKeepAlive.cpp"
+}
+#undef METER_PIN
+#undef LED_W
+#undef LED_ON
+#undef LED_OFF
+#undef BTN_IN
+#undef KEEP_ALIVE_TICKS
+#undef FLASH_TICKS
+#undef SHORT_PULSE_TICKS
+#undef DIGIT_GAP0_TICKS
+#undef DIGIT_GAP1_TICKS
+#undef DIGIT_GAP2_TICKS
+#undef PIN_RESEND_TOCKS
+#undef PIN_FORCE_TICKS
+
+// Keep-alive flash of 200ms
+#define METER_PIN "1234"
+#define FLASH_TICKS 2
+namespace shortFlash
+{
+#include "PinKeepAlive.cpp"
+}
+#undef METER_PIN
+#undef LED_W
+#undef LED_ON
+#undef LED_OFF
+#undef BTN_IN
+#undef KEEP_ALIVE_TICKS
+#undef FLASH_TICKS
+#undef SHORT_PULSE_TICKS
+#undef DIGIT_GAP0_TICKS
+#undef DIGIT_GAP1_TICKS
+#undef DIGIT_GAP2_TICKS
+#undef PIN_RESEND_TOCKS
+#undef PIN_FORCE_TICKS
+
+// Keep-alive every 125s, beyond the meter's timeout
+#define METER_PIN "1234"
+#define KEEP_ALIVE_TICKS 1250
+namespace slowKeepAlive
+{
+#include "PinKeepAlive.cpp"
+}
+#undef METER_PIN
+#undef LED_W
+#undef LED_ON
+#undef LED_OFF
+#undef BTN_IN
+#undef KEEP_ALIVE_TICKS
+#undef FLASH_TICKS
+#undef SHORT_PULSE_TICKS
+#undef DIGIT_GAP0_TICKS
+#undef DIGIT_GAP1_TICKS
+#undef DIGIT_GAP2_TICKS
+#undef PIN_RESEND_TOCKS
+#undef PIN_FORCE_TICKS
+
+// A PIN with consecutive zeros
+#define METER_PIN "1004"
+namespace zeroDigits
+{
+#include "PinKeepAlive.cpp"
+}
+
+struct Strategy
+{
+    const char *name;
+    const char *pin; // The meter's
+    bool works;      // Expected to keep extended data
+    void (*setup)();
+    void (*pushPinEntry)();
+    void (*onTick)();
+};
+
+static const Strategy STRATEGIES[] = {
+    {"stock, PIN every 20min", "1234", true, stock::setupPinKeepAlive, stock::pushPinEntry, stock::onTickPinKeepAlive},
+    {"PIN every 7h", "1234", true, rareResend::setupPinKeepAlive, rareResend::pushPinEntry, rareResend::onTickPinKeepAlive},
+    {"200ms keep-alive flash", "1234", false, shortFlash::setupPinKeepAlive, shortFlash::pushPinEntry, shortFlash::onTickPinKeepAlive},
+    {"keep-alive every 125s", "1234", false, slowKeepAlive::setupPinKeepAlive, slowKeepAlive::pushPinEntry, slowKeepAlive::onTickPinKeepAlive},
+    {"PIN 1004", "1004", true, zeroDigits::setupPinKeepAlive, zeroDigits::pushPinEntry, zeroDigits::onTickPinKeepAlive}};
+
+// Simulated hardware. The LED is active LOW (LED_ON in PinKeepAlive.cpp), the button is never pressed.
+uint8_t TCCR1A, TCCR1B, TIMSK1;
+uint16_t TCNT1, OCR1A;
+static bool light = false;
+
+void pinMode(uint8_t, uint8_t)
+{
+}
+
+void digitalWrite(uint8_t pin, uint8_t value)
+{
+    if (pin == PIN_PB0)
+    {
+        light = value == LOW;
+    }
+}
+
+int digitalRead(uint8_t)
+{
+    return HIGH;
+}
+
+#define METER_OFF 0
+#define METER_DISPLAY_TEST 1
+#define METER_PIN_ENTRY 2
+#define METER_EXTENDED 3
+
+class VirtualMeter
+{
+public:
+    VirtualMeter(const char *pin_)
+        : pin(pin_)
+    {
+    }
+
+    // Light at the optical input at time now [ms]
+    void update(uint32_t now, bool on)
+    {
+        if (on && !wasOn)
+        {
+            onSince = now;
+        }
+        if (!on && wasOn && now - onSince >= METER_MIN_PULSE_MS)
+        {
+            pulse(now);
+        }
+        wasOn = on;
+
+        if (state == METER_PIN_ENTRY && !on && now - last >= METER_DIGIT_ADVANCE_MS)
+        {
+            entered[digits++] = '0' + digit;
+            digit = 0;
+            last = now;
+            if (!pin[digits])
+            {
+                entered[digits] = 0;
+                state = strcmp(entered, pin) ? METER_OFF : METER_EXTENDED;
+                wrongPins += state == METER_OFF;
+            }
+        }
+        if (state != METER_OFF && now - last >= METER_TIMEOUT_MS)
+        {
+            state = METER_OFF;
+        }
+    }
+
+    bool isExtended()
+    {
+        return state == METER_EXTENDED;
+    }
+
+    unsigned wrongPins = 0;
+
+private:
+    const char *pin;
+    uint8_t state = METER_OFF;
+    bool wasOn = false;
+    uint32_t onSince = 0;
+    uint32_t last = 0; // Last pulse or digit taken
+    uint8_t digit = 0;
+    uint8_t digits = 0;
+    char entered[16];
+
+    void pulse(uint32_t now)
+    {
+        last = now;
+        switch (state)
+        {
+        case METER_OFF:
+            state = METER_DISPLAY_TEST;
+            break;
+        case METER_DISPLAY_TEST:
+            state = METER_PIN_ENTRY;
+            digit = 0;
+            digits = 0;
+            break;
+        case METER_PIN_ENTRY:
+            digit = (digit + 1) % 10;
+            break;
+        default:
+            break; // Extended data: keep-alive
+        }
+    }
+};
+
+struct Result
+{
+    double extended;    // Share of frames with 16.7.0 as decoded
+    double firstMs;     // Time to the first extended frame, -1 if never
+    unsigned losses;    // Times extended data got lost
+    unsigned wrongPins;
+};
+
+static Result run(const Strategy &s, uint32_t hours)
+{
+    light = false;
+    s.setup();
+    s.pushPinEntry();
+    VirtualMeter meter = VirtualMeter(s.pin);
+    SMLGenerator generator = SMLGenerator(1);
+    SMLGeneratorOptions extended;
+    SMLGeneratorOptions basic;
+    basic.entries = 2;
+    basic.scaler = 3;
+    ObisValues obisValues = ObisValues();
+    TinySMLDecoder decoder = TinySMLDecoder(&obisValues);
+
+    Result r = {0, -1, 0, 0};
+    unsigned frames = 0;
+    unsigned measured = 0;
+    bool was = false;
+    std::vector<uint8_t> frame;
+    const uint32_t end = hours * 3600000UL;
+    for (uint32_t now = 0; now < end; now += TICK_MS)
+    {
+        s.onTick();
+        meter.update(now, light);
+        if (now % METER_FRAME_MS == 0)
+        {
+            frame.clear();
+            generator.frame(meter.isExtended() ? extended : basic, frame);
+            obisValues.tick(now);
+            for (uint8_t c : frame)
+            {
+                decoder.feed(c);
+            }
+            const bool is = obisValues.getLiveRegister(registerBlockStart(BLOCK_VALUE_AGE) + 2) == 0; // 16.7.0 in this frame
+            frames++;
+            measured += is;
+            if (is && r.firstMs < 0)
+            {
+                r.firstMs = now;
+            }
+            r.losses += was && !is;
+            was = is;
+        }
+    }
+    r.extended = frames ? (double)measured / frames : 0;
+    r.wrongPins = meter.wrongPins;
+    return r;
+}
+
+int main(int argc, char *argv[])
+{
+    const uint32_t hours = argc > 1 ? atoi(argv[1]) : 24;
+    printf("%u hours, meter: pulses >= %ums, digit taken after %ums, timeout %us\n", hours, METER_MIN_PULSE_MS,
+           METER_DIGIT_ADVANCE_MS, METER_TIMEOUT_MS / 1000);
+    printf("%-24s %9s %9s %7s %6s\n", "Strategy", "Extended", "First", "Losses", "Wrong");
+    int failures = 0;
+    for (const Strategy &s : STRATEGIES)
+    {
+        Result r = run(s, hours);
+        char first[16] = "never";
+        if (r.firstMs >= 0)
+        {
+            snprintf(first, sizeof(first), "%.1fs", r.firstMs / 1000);
+        }
+        printf("%-24s %8.2f%% %9s %7u %6u\n", s.name, 100 * r.extended, first, r.losses, r.wrongPins);
+        if (s.works)
+        {
+            failures += r.extended < 0.95 || r.wrongPins;
+        }
+        else
+        {
+            failures += r.extended >= 0.95;
+        }
+    }
+    printf("%s\n", failures ? "FAIL" : "OK");
+    return failures ? 1 : 0;
+}
+#endif
+
+// END
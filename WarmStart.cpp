@@ -0,0 +1,110 @@
+/*
+ * Warm start from EEPROM. See WarmStart.h.
+ */
+
+#include <Arduino.h>
+#if !__TEST__
+#include <avr/eeprom.h>
+#endif
+#include "ModbusCRC.h"
+#include "WarmStart.h"
+
+struct WarmStartRecord
+{
+    uint32_t generation; // Counts up per record, 0xFFFFFFFF when erased
+    uint16_t registers[N_COUNTER_REGISTERS];
+    uint16_t crc; // Modbus CRC over the above
+};
+
+#define WARM_START_SLOTS (WARM_START_EEPROM_BYTES / sizeof(WarmStartRecord))
+#define WARM_START_ERASED 0xFFFFFFFF
+
+static ObisValues *obisValues;
+static WarmStartRecord record; // Newest, being written while pos < sizeof(record)
+static uint8_t slot;
+static uint8_t pos;
+static bool isSaved; // Any record at all
+
+static uint16_t getCRC(const WarmStartRecord *r)
+{
+    ModbusCRC crc = ModbusCRC();
+    crc.feed((const uint8_t *)r, offsetof(WarmStartRecord, crc));
+    return (crc.getCRCHighByte() << 8) | crc.getCRCLowByte();
+}
+
+void setupWarmStart(ObisValues *obisValues_)
+{
+    obisValues = obisValues_;
+    isSaved = false;
+    slot = WARM_START_SLOTS - 1; // The first record goes to slot 0
+    pos = sizeof(record);
+    for (uint8_t s = 0; s < WARM_START_SLOTS; s++)
+    {
+        WarmStartRecord r;
+        const uint8_t *address = (const uint8_t *)(s * sizeof(r));
+        for (uint8_t k = 0; k < sizeof(r); k++)
+        {
+            ((uint8_t *)&r)[k] = eeprom_read_byte(address + k);
+        }
+        if (r.generation != WARM_START_ERASED && r.crc == getCRC(&r) && (!isSaved || r.generation > record.generation))
+        {
+            record = r;
+            slot = s;
+            isSaved = true;
+        }
+    }
+    if (isSaved)
+    {
+        obisValues->restore(record.registers);
+        obisValues->setDiagnosticRegister(DIAG_WARM_START, (uint16_t)record.generation);
+    }
+}
+
+static bool isChanged()
+{
+    if (!isSaved)
+    {
+        return true;
+    }
+    for (uint8_t rr = 0; rr < N_COUNTER_REGISTERS; rr += 2)
+    {
+        const uint8_t n = registerBlockStart(BLOCK_OBIS) + rr;
+        const uint32_t value = ((uint32_t)obisValues->getLiveRegister(n) << 16) | obisValues->getLiveRegister(n + 1);
+        const uint32_t saved = ((uint32_t)record.registers[rr] << 16) | record.registers[rr + 1];
+        if ((value > saved ? value - saved : saved - value) >= WARM_START_MIN_CHANGE_WH)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+void onTickWarmStart()
+{
+    if (pos < sizeof(record))
+    {
+        if (eeprom_is_ready())
+        {
+            eeprom_write_byte((uint8_t *)(slot * sizeof(record)) + pos, ((const uint8_t *)&record)[pos]);
+            pos++;
+        }
+        return;
+    }
+    if (obisValues->getLiveRegister(registerBlockStart(BLOCK_WARM_START) + WARM_START_STALE) ||
+        obisValues->getDiagnosticRegister(DIAG_FRAMES) == 0 || !isChanged())
+    {
+        return;
+    }
+    record.generation = isSaved ? record.generation + 1 : 0;
+    for (uint8_t rr = 0; rr < N_COUNTER_REGISTERS; rr++)
+    {
+        record.registers[rr] = obisValues->getLiveRegister(registerBlockStart(BLOCK_OBIS) + rr);
+    }
+    record.crc = getCRC(&record);
+    slot = (slot + 1) % WARM_START_SLOTS;
+    pos = 0;
+    isSaved = true;
+    obisValues->setDiagnosticRegister(DIAG_WARM_START, (uint16_t)record.generation);
+}
+
+// END
@@ -0,0 +1,36 @@
+/*
+ * Warm start: The counters 1.8.0 and 2.8.0 are saved to EEPROM and restored at boot, so masters never read 0 Wh after
+ * a reset. Restored values are flagged stale (WARM_START_STALE) until the first frame is committed.
+ *
+ * Wear leveling: The EEPROM is a ring of records, each with a generation number and a CRC. A new record goes into the
+ * slot after the newest one, at boot the valid record with the highest generation wins. A reset while writing leaves
+ * a record with bad CRC, and the one before it is used. A record is written when a counter has moved by
+ * WARM_START_MIN_CHANGE_WH since the last one. At 100Wh and 10MWh per year, that is 100000 records per year, or about
+ * 3000 writes per cell with 36 slots: far below the 100000 cycles the EEPROM is specified for.
+ *
+ * Writing is one byte per 100ms tick, started only when the EEPROM is ready, so no task ever waits for it.
+ */
+
+#ifndef __WARMSTART_H
+#define __WARMSTART_H
+
+#include <Arduino.h>
+#include "ObisValues.h"
+
+#ifndef WARM_START_MIN_CHANGE_WH
+#define WARM_START_MIN_CHANGE_WH 100
+#endif
+
+#ifndef WARM_START_EEPROM_BYTES
+#define WARM_START_EEPROM_BYTES 512 // ATtiny841
+#endif
+
+// Setup. Restores the newest record, call before anything else reads the registers.
+void setupWarmStart(ObisValues *obisValues_);
+
+// Notify every 100ms
+void onTickWarmStart();
+
+#endif // __WARMSTART_H
+
+// END
@@ -0,0 +1,148 @@
+/*
+ * Warm start on the host: A year of a household with PV, one frame every 10s, with resets now and then, shortly after
+ * a record was started, so mostly before it is complete. After each reset, the restored counters must be flagged
+ * stale and lag the last committed ones by less than WARM_START_MIN_CHANGE_WH plus what came in while writing.
+ * Reports records written, resets while writing, and the EEPROM life from the writes per cell.
+ *
+ * g++ -O2 -I . -D__TEST__=1 -o test-warm-start WarmStartTest.cpp WarmStart.cpp ModbusCRC.cpp ObisValues.cpp
+ * ./test-warm-start [days]
+ */
+
+#include <Arduino.h>
+#include <stdio.h>
+#include "WarmStart.h"
+
+#if __TEST__
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define FRAME_TICKS 100           // 10s between frames, in 100ms ticks
+#define RESET_EVERY_FRAMES 20000  // About every 2.3 days
+#define EEPROM_CYCLES 100000      // Specified endurance
+#define MAX_LAG_WH (WARM_START_MIN_CHANGE_WH + 10)
+
+static const uint8_t OBIS_IMPORT[6] = {0x01, 0x00, 0x01, 0x08, 0x00, 0xFF};
+static const uint8_t OBIS_EXPORT[6] = {0x01, 0x00, 0x02, 0x08, 0x00, 0xFF};
+
+// Simulated EEPROM, erased. A write takes 3.4ms, less than a tick, so it is always ready.
+static uint8_t eeprom[WARM_START_EEPROM_BYTES];
+static unsigned long writes[WARM_START_EEPROM_BYTES];
+
+uint8_t eeprom_read_byte(const uint8_t *p)
+{
+    return eeprom[(uintptr_t)p];
+}
+
+void eeprom_write_byte(uint8_t *p, uint8_t value)
+{
+    eeprom[(uintptr_t)p] = value;
+    writes[(uintptr_t)p]++;
+}
+
+bool eeprom_is_ready()
+{
+    return true;
+}
+
+static void feed(ObisValues *obisValues, const uint8_t *obis, uint32_t value)
+{
+    uint8_t buf[6];
+    memcpy(buf, obis, sizeof(buf));
+    obisValues->feedObisOctetString(buf, sizeof(buf));
+    obisValues->feedObisValue(value);
+}
+
+static uint32_t getCounter(ObisValues *obisValues, uint8_t n)
+{
+    const uint8_t rr = registerBlockStart(BLOCK_OBIS) + 2 * n;
+    return ((uint32_t)obisValues->getLiveRegister(rr) << 16) | obisValues->getLiveRegister(rr + 1);
+}
+
+int main(int argc, char *argv[])
+{
+    const unsigned days = argc > 1 ? atoi(argv[1]) : 365;
+    memset(eeprom, 0xFF, sizeof(eeprom));
+    srand(1);
+
+    ObisValues *obisValues = new ObisValues();
+    setupWarmStart(obisValues);
+    double imported = 4710942; // Wh
+    double exported = 123456;
+    uint32_t committed[2] = {0, 0};
+    unsigned long records = 0;
+    unsigned long resets = 0;
+    unsigned long torn = 0;
+    unsigned long failures = 0;
+    uint16_t generation = 0;
+    bool armed = false;
+    unsigned resetIn = 0; // Ticks
+
+    const unsigned long frames = days * 86400UL / (FRAME_TICKS / 10);
+    for (unsigned long f = 0; f < frames; f++)
+    {
+        // Base load with appliances, PV around noon
+        const double hour = fmod(f * (FRAME_TICKS / 10) / 3600.0, 24);
+        const double load = 250 + (rand() % 100 < 10 ? rand() % 3000 : 0);
+        const double pv = (hour > 7 && hour < 19) ? 2500 * sin((hour - 7) / 12 * M_PI) : 0;
+        const double net = (load - pv) * (FRAME_TICKS / 10) / 3600.0;
+        imported += net > 0 ? net : 0;
+        exported += net < 0 ? -net : 0;
+        committed[0] = (uint32_t)imported;
+        committed[1] = (uint32_t)exported;
+        feed(obisValues, OBIS_IMPORT, committed[0]);
+        feed(obisValues, OBIS_EXPORT, committed[1]);
+        obisValues->commit();
+
+        // Now and then, reset shortly after a record was started, mostly before it is complete
+        armed |= f % RESET_EVERY_FRAMES == RESET_EVERY_FRAMES - 1;
+        for (unsigned t = 0; t < FRAME_TICKS; t++)
+        {
+            if (resetIn && --resetIn == 0 && armed)
+            {
+                const uint16_t started = obisValues->getDiagnosticRegister(DIAG_WARM_START);
+                delete obisValues;
+                obisValues = new ObisValues();
+                setupWarmStart(obisValues);
+                armed = false;
+                resets++;
+                torn += obisValues->getDiagnosticRegister(DIAG_WARM_START) != started;
+                const bool stale = obisValues->getLiveRegister(registerBlockStart(BLOCK_WARM_START) + WARM_START_STALE);
+                for (uint8_t n = 0; n < 2; n++)
+                {
+                    const uint32_t restored = getCounter(obisValues, n);
+                    if (!stale || restored > committed[n] || committed[n] - restored >= MAX_LAG_WH)
+                    {
+                        printf("Reset %lu: %s restored %u, committed %u, stale %d\n", resets, n ? "2.8.0" : "1.8.0", restored, committed[n], stale);
+                        failures++;
+                    }
+                }
+                generation = obisValues->getDiagnosticRegister(DIAG_WARM_START);
+                break; // Next frame after the reset
+            }
+            onTickWarmStart();
+            if (obisValues->getDiagnosticRegister(DIAG_WARM_START) != generation)
+            {
+                generation = obisValues->getDiagnosticRegister(DIAG_WARM_START);
+                records++;
+                resetIn = 1 + rand() % 16; // A record takes a tick per byte, 14 on the device
+            }
+        }
+    }
+    delete obisValues;
+
+    unsigned long most = 0;
+    for (unsigned long w : writes)
+    {
+        most = w > most ? w : most;
+    }
+    const double years = most ? EEPROM_CYCLES / (most * 365.0 / days) : 0;
+    printf("%u days, %.0f kWh imported, %.0f kWh exported\n", days, (imported - 4710942) / 1000, (exported - 123456) / 1000);
+    printf("%lu records, %lu resets, %lu while writing, at most %lu writes per cell: %.0f years\n", records, resets, torn, most, years);
+    failures += days >= 365 && years < 20;
+    printf("%s\n", failures ? "FAIL" : "OK");
+    return failures ? 1 : 0;
+}
+#endif
+
+// END
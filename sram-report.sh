@@ -0,0 +1,52 @@
+#!/bin/sh
+#
+# Static SRAM footprint per module (.data + .bss), from the object files of a build, largest first. What is left of
+# the 512 bytes is for the stack; the low-water mark of that is in Input Register 521 at run time (StackMonitor.h).
+# Given a build directory, the total of the linked image follows: it adds the core (Serial buffers, millis) and
+# drops what is not referenced, so that is the one to hold against the margin in the README.
+#
+# arduino-cli compile --build-path build --build-property "compiler.cpp.extra_flags=..." .
+# ./sram-report.sh build
+# ./sram-report.sh file.o ...
+#
+# Uses avr-objdump and avr-size from the path, or $OBJDUMP and $SIZE.
+
+OBJDUMP=${OBJDUMP:-avr-objdump}
+SIZE=${SIZE:-avr-size}
+SRAM=${SRAM:-512}
+
+if [ $# -eq 0 ]; then
+    echo "Usage: $0 build-dir | file.o ..." >&2
+    exit 2
+fi
+elf=
+if [ $# -eq 1 ] && [ -d "$1" ]; then
+    elf=$(find "$1" -maxdepth 1 -name '*.elf' | head -n 1)
+    set -- $(find "$1" -name '*.o' | sort)
+fi
+
+for f in "$@"; do
+    "$OBJDUMP" -t "$f" | sed "s|^|$(basename "$f" .o) |"
+done | awk '
+    function hex(s,    n, i) { n = 0; for (i = 1; i <= length(s); i++) n = n * 16 + index("0123456789abcdef", substr(s, i, 1)) - 1; return n }
+    # Data objects: module, value, flags, section, then size and name after a tab. Const data (.rodata) is copied to
+    # SRAM on AVR, .progmem stays in flash. Weak objects (vtables, template tables) are linked once, count them once.
+    / O / {
+        split($0, a, "\t"); n = split(a[1], l, " "); section = l[n]; split(a[2], r, " ")
+        if (section ~ /^\.progmem/ || (a[1] ~ / [wu] / && seen[r[2]]++)) next
+        if (section ~ /^\.(data|rodata)/) data[l[1]] += hex(r[1])
+        else if (section ~ /^\.(bss|noinit)/ || section == "*COM*") bss[l[1]] += hex(r[1])
+    }
+    END { for (m in data) bss[m] += 0; for (m in bss) if (data[m] + bss[m]) printf "%6d %6d %6d  %s\n", data[m] + bss[m], data[m], bss[m], m }' |
+    sort -rn | awk -v sram="$SRAM" '
+    BEGIN { printf "%6s %6s %6s  %s\n", "Total", ".data", ".bss", "Module" }
+    { print; total += $1 }
+    END { printf "%6d bytes static, %d left for the stack of %d\n", total, sram - total, sram }'
+
+if [ -n "$elf" ]; then
+    "$SIZE" -A "$elf" | awk -v sram="$SRAM" -v elf="$(basename "$elf")" '
+        $1 ~ /^\.(data|bss|noinit)$/ { total += $2 }
+        END { printf "%6d bytes linked (%s), %d left for the stack of %d\n", total, elf, sram - total, sram }'
+fi
+
+# END